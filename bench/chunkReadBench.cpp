@@ -0,0 +1,209 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "common/message/message.h"
+#include "common/message/pcmChunk.h"
+
+using namespace std;
+
+
+/// Messages per second that the client decodes from the socket into chunks
+/**
+ * The "socket" is a buffer of serialized wire chunks, reading from it is a
+ * memcpy. "stream" is the way ClientConnection and Controller read chunks
+ * before: a header and a payload vector per message, then the chunk is
+ * decoded from the payload through membuf and an istream, which copies the
+ * audio data once more. "direct" is ClientConnection::getNextMessage: the
+ * headers are decoded straight from reused arrays and the audio data is
+ * read into the chunk's payload.
+ * Returns 1 if the two don't decode the same chunks.
+ */
+
+
+namespace
+{
+
+const size_t messages = 1000;
+const double benchSeconds = 0.2;
+
+
+/// Reads from a buffer, like ClientConnection::socketRead from the socket
+class Socket
+{
+public:
+	Socket(const vector<char>& data) : data_(data), pos_(0)
+	{
+	}
+
+	void read(void* to, size_t bytes)
+	{
+		memcpy(to, data_.data() + pos_, bytes);
+		pos_ += bytes;
+	}
+
+	bool eof() const
+	{
+		return pos_ >= data_.size();
+	}
+
+private:
+	const vector<char>& data_;
+	size_t pos_;
+};
+
+
+vector<char> serialize(size_t payloadSize, uint16_t version)
+{
+	ostringstream stream;
+	for (size_t n = 0; n < messages; ++n)
+	{
+		msg::WireChunk chunk(payloadSize);
+		for (size_t i = 0; i < payloadSize; ++i)
+			chunk.payload[i] = (char)(n + i);
+		chunk.timestamp.sec = 1500000000 + n / 50;
+		chunk.timestamp.usec = (n % 50) * 20000;
+		chunk.sequence = n;
+		chunk.serialize(stream, version);
+	}
+	string data = stream.str();
+	return vector<char>(data.begin(), data.end());
+}
+
+
+/// Folds timestamp, sequence and payload of a chunk into "sum"
+void checksum(const msg::PcmChunk& chunk, uint64_t& sum)
+{
+	sum = sum * 31 + chunk.timestamp.sec * 1000000 + chunk.timestamp.usec;
+	sum = sum * 31 + chunk.sequence;
+	for (size_t i = 0; i < chunk.payloadSize; ++i)
+		sum = sum * 31 + (unsigned char)chunk.payload[i];
+}
+
+
+/// Like ClientConnection::getNextMessage and Controller::onMessageReceived before the chunks were read in place
+uint64_t readStream(const vector<char>& data, bool check)
+{
+	uint64_t sum = 0;
+	Socket socket(data);
+	while (!socket.eof())
+	{
+		msg::BaseMessage baseMessage;
+		vector<char> header(msg::BaseMessage::header_v2_size);
+		socket.read(header.data(), msg::BaseMessage::header_size);
+		if (msg::BaseMessage::isV2Header(header.data()))
+			socket.read(header.data() + msg::BaseMessage::header_size, msg::BaseMessage::header_v2_size - msg::BaseMessage::header_size);
+		membuf headerBuf(header.data(), header.data() + header.size());
+		std::istream headerStream(&headerBuf);
+		baseMessage.read(headerStream);
+		vector<char> buffer(baseMessage.size);
+		socket.read(buffer.data(), baseMessage.size);
+		tv t;
+		baseMessage.received = t;
+
+		unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk());
+		chunk->deserialize(baseMessage, buffer.data());
+		if (check)
+			checksum(*chunk, sum);
+	}
+	return sum;
+}
+
+
+/// Like ClientConnection::getNextMessage
+uint64_t readDirect(const vector<char>& data, bool check)
+{
+	uint64_t sum = 0;
+	Socket socket(data);
+	array<char, msg::BaseMessage::header_v2_size> header;
+	array<char, msg::WireChunk::chunk_header_v2_size> chunkHeader;
+	while (!socket.eof())
+	{
+		msg::BaseMessage baseMessage;
+		socket.read(header.data(), msg::BaseMessage::header_size);
+		if (msg::BaseMessage::isV2Header(header.data()))
+			socket.read(header.data() + msg::BaseMessage::header_size, header.size() - msg::BaseMessage::header_size);
+		baseMessage.deserialize(header.data());
+
+		unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk());
+		socket.read(chunkHeader.data(), msg::WireChunk::getChunkHeaderSize(baseMessage.version));
+		if (!chunk->deserializeHeader(baseMessage, chunkHeader.data()))
+			return 0;
+		socket.read(chunk->payload, chunk->payloadSize);
+		tv t;
+		chunk->received = t;
+		if (check)
+			checksum(*chunk, sum);
+	}
+	return sum;
+}
+
+
+/// Messages per second
+double benchmark(uint64_t (*read)(const vector<char>&, bool), const vector<char>& data)
+{
+	size_t runs = 0;
+	auto start = chrono::steady_clock::now();
+	chrono::duration<double> elapsed(0);
+	do
+	{
+		read(data, false);
+		++runs;
+		elapsed = chrono::steady_clock::now() - start;
+	}
+	while (elapsed.count() < benchSeconds);
+	return runs * messages / elapsed.count();
+}
+
+}
+
+
+
+int main()
+{
+	bool ok = true;
+	printf("%-10s%10s%20s%20s%10s\n", "protocol", "payload", "stream [msg/s]", "direct [msg/s]", "speedup");
+	for (uint16_t version: {1, 2})
+	{
+		/// 20ms of FLAC and of PCM (48000:16:2)
+		for (size_t payloadSize: {1500, 3840})
+		{
+			vector<char> data = serialize(payloadSize, version);
+			bool match = (readStream(data, true) == readDirect(data, true));
+			ok = ok && match;
+			double stream = benchmark(readStream, data);
+			double direct = benchmark(readDirect, data);
+			printf("%-10d%10zu%20.0f%20.0f%9.1fx%s\n", version, payloadSize, stream, direct, direct / stream, match ? "" : "  mismatch!");
+		}
+	}
+
+	if (!ok)
+	{
+		printf("\n! the direct read decodes different chunks\n");
+		return 1;
+	}
+	return 0;
+}
+
@@ -0,0 +1,247 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "encoder/encoderFactory.h"
+#include "decoder/pcmDecoder.h"
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBISENC)
+#include "decoder/oggDecoder.h"
+#endif
+#if defined(HAS_FLAC)
+#include "decoder/flacDecoder.h"
+#endif
+#if defined(HAS_OPUS)
+#include "decoder/opusDecoder.h"
+#endif
+
+using namespace std;
+
+
+/// Encode and decode CPU time and latency of the codecs that snapserver is built with
+/**
+ * 10s of a music like 48000:16:2 signal are fed in 20ms chunks into the
+ * server's encoder, the encoded chunks are decoded by the client's decoder,
+ * both with the codec's default options.
+ * Reported are the CPU time per 20ms of audio for encoding and decoding, and
+ * the PCM that the encoder buffers before it emits a chunk (the maximum of
+ * fed minus encoded duration), which adds to the end-to-end latency. The
+ * 2.5ms lookahead of opus is not buffered, but compensated by the decoder.
+ * Returns 1 if a lossless codec doesn't decode bit exact, or if a lossy codec
+ * loses audio or changes the level of the signal.
+ */
+
+
+namespace
+{
+
+const SampleFormat sampleFormat(48000, 16, 2);
+const size_t chunkMs = 20;
+const size_t streamMs = 10000;
+
+
+/// Collects the encoded chunks
+class Collector : public EncoderListener
+{
+public:
+	Collector() : encodedMs(0)
+	{
+	}
+
+	virtual void onChunkEncoded(const Encoder* encoder, msg::PcmChunk* chunk, double duration)
+	{
+		chunks.emplace_back(chunk);
+		encodedMs += duration;
+	}
+
+	vector<unique_ptr<msg::PcmChunk>> chunks;
+	double encodedMs;
+};
+
+
+struct Result
+{
+	/// CPU time per 20ms chunk [us]
+	double encodeUs;
+	double decodeUs;
+	/// Maximum of fed minus encoded PCM [ms]
+	double bufferedMs;
+	size_t encodedBytes;
+	vector<int16_t> decoded;
+};
+
+
+/// Three tones with a slow tremolo, the channels with different phase
+vector<int16_t> signal()
+{
+	size_t frames = sampleFormat.rate * streamMs / 1000;
+	vector<int16_t> samples(frames * sampleFormat.channels);
+	for (size_t n = 0; n < frames; ++n)
+	{
+		double t = (double)n / sampleFormat.rate;
+		double tremolo = 0.6 + 0.4 * sin(2 * M_PI * 0.5 * t);
+		for (size_t c = 0; c < sampleFormat.channels; ++c)
+		{
+			double phase = c * M_PI / 3;
+			double v = 0.4 * sin(2 * M_PI * 220 * t + phase) + 0.2 * sin(2 * M_PI * 1320 * t) + 0.1 * sin(2 * M_PI * 5000 * t + phase);
+			samples[n * sampleFormat.channels + c] = (int16_t)(tremolo * v * 32767);
+		}
+	}
+	return samples;
+}
+
+
+Decoder* createDecoder(const string& codec)
+{
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBISENC)
+	if (codec == "ogg")
+		return new OggDecoder();
+#endif
+#if defined(HAS_FLAC)
+	if (codec == "flac")
+		return new FlacDecoder();
+#endif
+#if defined(HAS_OPUS)
+	if (codec == "opus")
+		return new OpusStreamDecoder();
+#endif
+	return new PcmDecoder();
+}
+
+
+/// Like PcmStream feeds the encoder and Controller decodes the chunks
+Result run(const string& codec, const vector<int16_t>& samples)
+{
+	Result result;
+	Collector collector;
+	EncoderFactory encoderFactory;
+	unique_ptr<Encoder> encoder(encoderFactory.createEncoder(codec));
+	encoder->init(&collector, sampleFormat);
+
+	size_t chunks = streamMs / chunkMs;
+	size_t chunkSamples = sampleFormat.rate * chunkMs / 1000 * sampleFormat.channels;
+	chrono::duration<double> encodeTime(0);
+	result.bufferedMs = 0;
+	for (size_t n = 0; n < chunks; ++n)
+	{
+		msg::PcmChunk chunk(sampleFormat, chunkMs);
+		memcpy(chunk.payload, samples.data() + n * chunkSamples, chunkSamples * sizeof(int16_t));
+		auto start = chrono::steady_clock::now();
+		encoder->encode(&chunk);
+		encodeTime += chrono::steady_clock::now() - start;
+		result.bufferedMs = max(result.bufferedMs, (n + 1) * chunkMs - collector.encodedMs);
+	}
+
+	unique_ptr<Decoder> decoder(createDecoder(codec));
+	SampleFormat decodedFormat = decoder->setHeader(encoder->getHeader().get());
+	chrono::duration<double> decodeTime(0);
+	result.encodedBytes = 0;
+	for (auto& chunk: collector.chunks)
+	{
+		result.encodedBytes += chunk->payloadSize;
+		chunk->format = decodedFormat;
+		auto start = chrono::steady_clock::now();
+		bool decoded = decoder->decode(chunk.get());
+		decodeTime += chrono::steady_clock::now() - start;
+		if (decoded)
+		{
+			const int16_t* pcm = (const int16_t*)chunk->payload;
+			result.decoded.insert(result.decoded.end(), pcm, pcm + chunk->payloadSize / sizeof(int16_t));
+		}
+	}
+
+	result.encodeUs = encodeTime.count() * 1e6 / chunks;
+	result.decodeUs = decodeTime.count() * 1e6 / chunks;
+	return result;
+}
+
+
+double rms(const vector<int16_t>& samples)
+{
+	double sum = 0;
+	for (int16_t sample: samples)
+		sum += (double)sample * sample;
+	return samples.empty() ? 0 : sqrt(sum / samples.size());
+}
+
+
+/// Lossless codecs must decode bit exact, everything but the buffered PCM
+bool exact(const vector<int16_t>& samples, const Result& result)
+{
+	size_t buffered = sampleFormat.rate * result.bufferedMs / 1000 * sampleFormat.channels;
+	if (result.decoded.size() + buffered < samples.size())
+		return false;
+	size_t compare = min(samples.size(), result.decoded.size());
+	return equal(samples.begin(), samples.begin() + compare, result.decoded.begin());
+}
+
+
+/// Lossy codecs must decode all but the buffered PCM, with the level of the input
+bool similar(const vector<int16_t>& samples, const Result& result)
+{
+	size_t buffered = sampleFormat.rate * result.bufferedMs / 1000 * sampleFormat.channels;
+	if (result.decoded.size() + buffered < samples.size())
+		return false;
+	double ratio = rms(result.decoded) / rms(samples);
+	return (ratio > 0.9) && (ratio < 1.1);
+}
+
+}
+
+
+
+int main()
+{
+	vector<int16_t> samples = signal();
+	vector<string> codecs = {"pcm"};
+#if defined(HAS_FLAC)
+	codecs.push_back("flac");
+#endif
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBISENC)
+	codecs.push_back("ogg");
+#endif
+#if defined(HAS_OPUS)
+	codecs.push_back("opus");
+#endif
+
+	bool ok = true;
+	printf("%zu ms of %s in %zu ms chunks\n", streamMs, sampleFormat.getFormat().c_str(), chunkMs);
+	printf("%-8s%16s%16s%16s%16s\n", "codec", "encode [us]", "decode [us]", "buffered [ms]", "bitrate [kbps]");
+	for (const auto& codec: codecs)
+	{
+		Result result = run(codec, samples);
+		bool lossless = (codec == "pcm") || (codec == "flac");
+		bool match = lossless ? exact(samples, result) : similar(samples, result);
+		ok = ok && match;
+		printf("%-8s%16.1f%16.1f%16.1f%16.0f%s\n", codec.c_str(), result.encodeUs, result.decodeUs, result.bufferedMs, result.encodedBytes * 8. / streamMs, match ? "" : "  mismatch!");
+	}
+
+	if (!ok)
+	{
+		printf("\n! a codec doesn't decode what was encoded\n");
+		return 1;
+	}
+	return 0;
+}
+
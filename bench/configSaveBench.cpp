@@ -0,0 +1,209 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <asio.hpp>
+#include "config.h"
+#include "jsonrpcpp.hpp"
+
+using namespace std;
+
+
+/// JSON-RPC throughput of Client.SetVolume with a save per request and with the debounced save
+/**
+ * Client.SetVolume requests are processed within a strand as fast as
+ * possible, the way StreamServer::processMessage does it: parse the request,
+ * look up the client, set the volume, serialize response and notification.
+ * "per request" writes server.json synchronously after every request, as the
+ * server did before the saves were debounced. "debounced" arms a timer like
+ * StreamServer::saveConfig, all changes within the delay are coalesced into
+ * one background Config::save().
+ * Returns 1 if server.json doesn't contain the last volume after a run.
+ */
+
+
+namespace
+{
+
+const string clientId = "00:21:6a:7d:74:fc";
+const double benchSeconds = 1.;
+const size_t saveDelayMs = 100;
+const size_t requestsPerHandler = 100;
+
+
+class Bench
+{
+public:
+	Bench(bool debounced) : debounced_(debounced), strand_(ioService_), saveTimer_(ioService_), savePending_(false), requests_(0), saves_(0), bytes_(0), percent_(0)
+	{
+	}
+
+	/// Requests per second
+	double run()
+	{
+		start_ = chrono::steady_clock::now();
+		strand_.post([this]() { processRequests(); });
+		ioService_.run();
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start_;
+		Config::instance().flush();
+		return requests_ / elapsed.count();
+	}
+
+	size_t saves() const
+	{
+		return saves_;
+	}
+
+	/// Volume of the last request
+	uint16_t percent() const
+	{
+		return percent_;
+	}
+
+private:
+	/// Like StreamServer::processMessage and ProcessRequest
+	void setVolume(const string& message)
+	{
+		jsonrpcpp::entity_ptr entity = jsonrpcpp::Parser::do_parse(message);
+		jsonrpcpp::request_ptr request = dynamic_pointer_cast<jsonrpcpp::Request>(entity);
+		ClientInfoPtr clientInfo = Config::instance().getClientInfo(request->params().get<string>("id"));
+		clientInfo->config.volume.fromJson(request->params().get("volume"));
+		Json result;
+		result["volume"] = clientInfo->config.volume.toJson();
+		jsonrpcpp::Notification notification("Client.OnVolumeChanged", jsonrpcpp::Parameter("id", clientInfo->id, "volume", clientInfo->config.volume.toJson()));
+		string response = jsonrpcpp::Response(*request, result).to_json().dump();
+		string notificationMessage = notification.to_json().dump();
+		/// the ControlSessions would send them
+		bytes_ += response.size() + notificationMessage.size();
+	}
+
+	void processRequests()
+	{
+		for (size_t n = 0; n < requestsPerHandler; ++n)
+		{
+			percent_ = requests_ % 101;
+			setVolume("{\"id\":8,\"jsonrpc\":\"2.0\",\"method\":\"Client.SetVolume\",\"params\":{\"id\":\"" + clientId + "\",\"volume\":{\"muted\":false,\"percent\":" + to_string(percent_) + "}}}");
+			++requests_;
+			if (debounced_)
+				saveConfig();
+			else
+			{
+				Config::instance().save();
+				Config::instance().flush();
+				++saves_;
+			}
+		}
+
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start_;
+		/// posted again, so that the save timer's handler can run in between
+		if (elapsed.count() < benchSeconds)
+			strand_.post([this]() { processRequests(); });
+	}
+
+	/// Like StreamServer::saveConfig
+	void saveConfig()
+	{
+		if (savePending_)
+			return;
+
+		savePending_ = true;
+		saveTimer_.expires_from_now(std::chrono::milliseconds(saveDelayMs));
+		saveTimer_.async_wait(strand_.wrap([this](const std::error_code& ec)
+		{
+			savePending_ = false;
+			if (ec)
+				return;
+			Config::instance().save();
+			++saves_;
+		}));
+	}
+
+	bool debounced_;
+	asio::io_service ioService_;
+	asio::io_service::strand strand_;
+	asio::steady_timer saveTimer_;
+	bool savePending_;
+	chrono::steady_clock::time_point start_;
+	size_t requests_;
+	size_t saves_;
+	size_t bytes_;
+	uint16_t percent_;
+};
+
+
+/// Volume of the client in server.json, -1 if it can't be read
+int savedPercent(const string& filename)
+{
+	try
+	{
+		ifstream ifs(filename);
+		json j;
+		ifs >> j;
+		for (const auto& group: j["Groups"])
+			for (const auto& client: group["clients"])
+				if (client["id"] == clientId)
+					return client["config"]["volume"]["percent"].get<int>();
+	}
+	catch (const std::exception& e)
+	{
+		printf("Error reading %s: %s\n", filename.c_str(), e.what());
+	}
+	return -1;
+}
+
+}
+
+
+
+int main()
+{
+	char dir[] = "/tmp/snapbench.XXXXXX";
+	if (mkdtemp(dir) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	Config::instance().init(dir);
+	Config::instance().addClientInfo(clientId);
+	string filename = string(dir) + "/.config/snapserver/server.json";
+
+	bool ok = true;
+	printf("%-14s%16s%10s\n", "save", "requests/s", "saves");
+	for (bool debounced: {false, true})
+	{
+		Bench bench(debounced);
+		double requestsPerSecond = bench.run();
+		bool saved = (savedPercent(filename) == bench.percent());
+		ok = ok && saved;
+		printf("%-14s%16.0f%10zu%s\n", debounced ? "debounced" : "per request", requestsPerSecond, bench.saves(), saved ? "" : "  last volume not saved!");
+	}
+
+	if (!ok)
+	{
+		printf("\n! server.json doesn't contain the last change\n");
+		return 1;
+	}
+	return 0;
+}
+
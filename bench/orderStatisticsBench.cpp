@@ -0,0 +1,206 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <vector>
+#include "orderStatistics.h"
+
+using namespace std;
+
+
+/// Time per add + median of the sliding windows that the client sync uses
+/**
+ * Stream adds the age of every played chunk to its windows and takes the
+ * median, ClockModel does the same with the RTTs. "sorted" is the way
+ * DoubleBuffer did it: the window is a deque that is copied and sorted for
+ * every median. "order statistics" is OrderStatistics.
+ * Returns 1 if OrderStatistics doesn't match a sorted reference, checked for
+ * every query over random values with duplicates, while the window is
+ * resized.
+ */
+
+
+namespace
+{
+
+typedef int64_t Age;
+
+const double benchSeconds = 0.2;
+
+
+/// Like DoubleBuffer
+class SortedWindow
+{
+public:
+	SortedWindow(size_t size) : size_(size)
+	{
+	}
+
+	void add(const Age& value)
+	{
+		buffer_.push_back(value);
+		if (buffer_.size() > size_)
+			buffer_.pop_front();
+	}
+
+	Age median() const
+	{
+		if (buffer_.empty())
+			return 0;
+		deque<Age> sorted(buffer_.begin(), buffer_.end());
+		sort(sorted.begin(), sorted.end());
+		return sorted[sorted.size() / 2];
+	}
+
+private:
+	size_t size_;
+	deque<Age> buffer_;
+};
+
+
+/// Checks all queries against the sorted window
+bool check(const OrderStatistics<Age>& statistics, const deque<Age>& window)
+{
+	vector<Age> sorted(window.begin(), window.end());
+	sort(sorted.begin(), sorted.end());
+	size_t count = sorted.size();
+	if (statistics.size() != count)
+		return false;
+	for (size_t k = 0; k < count; ++k)
+		if (statistics.at(k) != sorted[k])
+			return false;
+	if (statistics.median() != sorted[count / 2])
+		return false;
+	if (statistics.median(3) != (sorted[count / 2 - 1] + sorted[count / 2] + sorted[count / 2 + 1]) / 3)
+		return false;
+	for (unsigned int percentile: {0, 10, 50, 90, 99, 100})
+		if (statistics.percentile(percentile) != sorted[min(count * percentile / 100, count - 1)])
+			return false;
+
+	double sum = 0;
+	for (Age value: sorted)
+		sum += value;
+	if (fabs(statistics.mean() - sum / count) > 1e-6)
+		return false;
+	size_t cut = count / 10;
+	double trimmed = 0;
+	for (size_t k = cut; k < count - cut; ++k)
+		trimmed += sorted[k];
+	return (fabs(statistics.trimmedMean(10) - trimmed / (count - 2 * cut)) < 1e-6);
+}
+
+
+/// Random inserts with duplicates, the window is shrunk and grown in between
+bool verify(size_t size)
+{
+	mt19937 random(size);
+	uniform_int_distribution<Age> ages(-500, 500);
+	OrderStatistics<Age> statistics(size);
+	deque<Age> window;
+	size_t windowSize = size;
+	for (size_t resized: {size / 2, size * 2, size / 3, size})
+	{
+		for (size_t n = 0; n < 3 * size; ++n)
+		{
+			Age age = ages(random);
+			statistics.add(age);
+			window.push_back(age);
+			if (window.size() > windowSize)
+				window.pop_front();
+			if ((window.size() >= 3) && !check(statistics, window))
+				return false;
+		}
+
+		/// the newest values are kept
+		windowSize = resized;
+		statistics.setSize(windowSize);
+		while (window.size() > windowSize)
+			window.pop_front();
+		if ((window.size() >= 3) && !check(statistics, window))
+			return false;
+	}
+	return true;
+}
+
+
+/// ns per add + median
+template <class Window>
+double benchmark(Window& window, const vector<Age>& ages)
+{
+	size_t runs = 0;
+	Age sum = 0;
+	auto start = chrono::steady_clock::now();
+	chrono::duration<double> elapsed(0);
+	do
+	{
+		for (Age age: ages)
+		{
+			window.add(age);
+			sum += window.median();
+		}
+		runs += ages.size();
+		elapsed = chrono::steady_clock::now() - start;
+	}
+	while (elapsed.count() < benchSeconds);
+	/// keeps the medians from being optimized away
+	if (sum == 42)
+		printf(" ");
+	return elapsed.count() * 1e9 / runs;
+}
+
+}
+
+
+
+int main()
+{
+	bool ok = true;
+	printf("%-10s%14s%26s%10s\n", "window", "sorted [ns]", "order statistics [ns]", "speedup");
+	/// the window sizes of Stream
+	for (size_t size: {20, 100, 500})
+	{
+		bool match = verify(size);
+		ok = ok && match;
+
+		/// ages around the buffer, jittering by a few ms
+		mt19937 random(4711);
+		normal_distribution<double> jitter(1000000, 2000);
+		vector<Age> ages(10000);
+		for (auto& age: ages)
+			age = (Age)jitter(random);
+
+		SortedWindow sorted(size);
+		OrderStatistics<Age> statistics(size);
+		double sortedNs = benchmark(sorted, ages);
+		double statisticsNs = benchmark(statistics, ages);
+		printf("%-10zu%14.0f%26.0f%9.1fx%s\n", size, sortedNs, statisticsNs, sortedNs / statisticsNs, match ? "" : "  mismatch!");
+	}
+
+	if (!ok)
+	{
+		printf("\n! OrderStatistics doesn't match the sorted reference\n");
+		return 1;
+	}
+	return 0;
+}
+
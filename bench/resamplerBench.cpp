@@ -0,0 +1,151 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "client/resampler.h"
+#include "common/sampleFormat.h"
+
+using namespace std;
+
+
+/// Checks the quality of the Resampler and measures its CPU load
+/**
+ * A sine is resampled period by period, like Stream::getNextPlayerChunk
+ * does it: the ratio changes with every period and the timestamp of the
+ * first output frame is compensated by Resampler::delay(). Every output
+ * frame is compared with the ideal sine at the position that the delay
+ * compensation claims. The error (THD+N) therefore also covers a wrong
+ * delay and discontinuities between the periods.
+ * Returns 1 if the quality is worse than expected.
+ */
+
+
+namespace
+{
+
+const double pi = 3.14159265358979323846;
+const size_t rate = 48000;
+const size_t periodFrames = 480;
+const double seconds = 10.;
+const double amplitude = 0.9 * 32767.;
+
+
+struct Result
+{
+	/// THD+N relative to the sine [dB]
+	double thdN;
+	/// max. error relative to full scale [dB]
+	double maxError;
+	/// Input frames per second of CPU time
+	double framesPerSecond;
+};
+
+
+/// @param ppm base deviation of the ratio, e.g. 100 to play 100ppm faster
+/// @param jitter random deviation per period [ppm], as applied by the sync correction
+Result run(double frequency, double ppm, double jitter)
+{
+	SampleFormat format(rate, 16, 2);
+	Resampler resampler(format);
+	mt19937 random(42);
+	uniform_real_distribution<double> jitterDist(-jitter, jitter);
+
+	size_t totalFrames = static_cast<size_t>(seconds * rate);
+	double omega = 2. * pi * frequency / rate;
+	vector<int16_t> in(2 * (totalFrames + periodFrames * 2));
+	for (size_t n = 0; n < in.size() / 2; ++n)
+		in[2 * n] = in[2 * n + 1] = static_cast<int16_t>(lrint(amplitude * sin(omega * n)));
+
+	vector<int16_t> out(2 * periodFrames);
+	double signal = 0.;
+	double noise = 0.;
+	double maxError = 0.;
+	chrono::duration<double> cpu(0);
+	size_t read = 0;
+	size_t periods = 0;
+	while (read + periodFrames * 2 < totalFrames)
+	{
+		double ratio = 1. + (ppm + jitterDist(random)) * 1e-6;
+		size_t toRead = resampler.inputFrames(periodFrames, ratio);
+		/// position of the first output frame in the input, see Stream::getNextPlayerChunk
+		double first = read - resampler.delay();
+		auto start = chrono::steady_clock::now();
+		resampler.resample(&in[2 * read], toRead, out.data(), periodFrames, ratio);
+		cpu += chrono::steady_clock::now() - start;
+		read += toRead;
+
+		/// skip the filter's warm up from the zeroed history
+		if (++periods < 10)
+			continue;
+		for (size_t n = 0; n < periodFrames; ++n)
+		{
+			double expected = amplitude * sin(omega * (first + n * ratio));
+			for (size_t channel = 0; channel < 2; ++channel)
+			{
+				double error = out[2 * n + channel] - expected;
+				signal += expected * expected;
+				noise += error * error;
+				maxError = max(maxError, fabs(error));
+			}
+		}
+	}
+
+	Result result;
+	result.thdN = 10. * log10(noise / signal);
+	result.maxError = 20. * log10(maxError / 32768.);
+	result.framesPerSecond = read / cpu.count();
+	return result;
+}
+
+}
+
+
+
+int main()
+{
+	/// 16 bit quantization of input and output alone gives about -95dB for this sine. With a ratio other
+	/// than 1, the filter's response varies slightly with the fractional phase, which gives about -80dB
+	const double maxThdN = -75.;
+	bool ok = true;
+	printf("%10s %8s %8s %10s %10s %14s\n", "freq [Hz]", "ppm", "jitter", "THD+N [dB]", "max [dBFS]", "CPU [x real]");
+	for (double frequency: {100., 1000., 10000., 18000.})
+	{
+		for (double ppm: {-100., 0., 100.})
+		{
+			for (double jitter: {0., 5000.})
+			{
+				Result result = run(frequency, ppm, jitter);
+				bool match = (result.thdN < maxThdN);
+				ok = ok && match;
+				printf("%10.0f %8.0f %8.0f %10.1f %10.1f %14.0f%s\n", frequency, ppm, jitter, result.thdN, result.maxError, result.framesPerSecond / rate, match ? "" : " !");
+			}
+		}
+	}
+
+	if (!ok)
+	{
+		printf("\n! THD+N above %.0f dB\n", maxThdN);
+		return 1;
+	}
+	return 0;
+}
+
@@ -0,0 +1,203 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "common/sampleConversion.h"
+#include "common/sampleFormat.h"
+
+using namespace std;
+
+
+/// Checks the vectorized sample conversion kernels against the scalar ones and measures their throughput
+/**
+ * Every kernel runs on the same random input with each instruction set the
+ * host supports. The output must be bitwise identical to the scalar
+ * kernel's output, for buffer sizes that leave every possible remainder to
+ * the scalar tail. Throughput is reported in million samples per second.
+ * Returns 1 if a kernel doesn't match.
+ */
+
+
+namespace
+{
+
+const size_t benchFrames = 48000 + 7;
+const double benchSeconds = 0.2;
+
+
+/// Input for all kernels, stereo
+struct Input
+{
+	Input(size_t frames) : pcm(2 * frames), left(frames), right(frames), leftInt(frames), rightInt(frames)
+	{
+		mt19937 random(42);
+		uniform_int_distribution<int> pcmDist(-32768, 32767);
+		/// beyond full scale, to test the saturation, and exact halves to test the rounding
+		uniform_real_distribution<float> floatDist(-1.2f, 1.2f);
+		uniform_int_distribution<int32_t> intDist(-(1 << 24), 1 << 24);
+		for (auto& sample: pcm)
+			sample = pcmDist(random);
+		for (size_t i = 0; i < frames; ++i)
+		{
+			left[i] = floatDist(random);
+			right[i] = (i % 4 == 0) ? (pcmDist(random) + 0.5f) / 32768.f : floatDist(random);
+			leftInt[i] = intDist(random);
+			rightInt[i] = intDist(random);
+		}
+	}
+
+	vector<int16_t> pcm;
+	vector<float> left;
+	vector<float> right;
+	vector<int32_t> leftInt;
+	vector<int32_t> rightInt;
+};
+
+
+/// A kernel, called through the public API. Writes "frames" frames into "out" and returns the output size in bytes
+struct Kernel
+{
+	string name;
+	function<size_t(const Input& in, size_t frames, vector<char>& out)> run;
+};
+
+
+vector<Kernel> kernels()
+{
+	static const SampleFormat format("48000:16:2");
+	vector<Kernel> result;
+	result.push_back({"toInt32", [](const Input& in, size_t frames, vector<char>& out)
+	{
+		size_t samples = 2 * frames;
+		sample::toInt32(in.pcm.data(), (int32_t*)out.data(), samples, format);
+		return samples * sizeof(int32_t);
+	}});
+	result.push_back({"toFloat", [](const Input& in, size_t frames, vector<char>& out)
+	{
+		size_t samples = 2 * frames;
+		sample::toFloat(in.pcm.data(), (float*)out.data(), samples, format);
+		return samples * sizeof(float);
+	}});
+	result.push_back({"deinterleave", [](const Input& in, size_t frames, vector<char>& out)
+	{
+		float* planes[2] = {(float*)out.data(), (float*)out.data() + frames};
+		sample::deinterleave(in.pcm.data(), planes, frames, format);
+		return 2 * frames * sizeof(float);
+	}});
+	result.push_back({"interleave float", [](const Input& in, size_t frames, vector<char>& out)
+	{
+		const float* planes[2] = {in.left.data(), in.right.data()};
+		sample::interleave(planes, out.data(), frames, format);
+		return 2 * frames * sizeof(int16_t);
+	}});
+	/// FLAC: no shift, the values exceed 16 bit to test the saturation. Tremor: Q24 => shift 9. Negative shifts are scalar only
+	for (int shift: {0, 9, -1})
+	{
+		string name = "interleave int32 " + ((shift >= 0) ? ">> " + to_string(shift) : "<< " + to_string(-shift));
+		result.push_back({name, [shift](const Input& in, size_t frames, vector<char>& out)
+		{
+			const int32_t* planes[2] = {in.leftInt.data(), in.rightInt.data()};
+			sample::interleave(planes, out.data(), frames, format, shift);
+			return 2 * frames * sizeof(int16_t);
+		}});
+	}
+	return result;
+}
+
+
+/// Output of the kernel for all buffer sizes from 0 to 64 frames, followed by the output for benchFrames frames
+vector<char> check(const Kernel& kernel, const Input& in)
+{
+	vector<char> result;
+	vector<char> out(2 * benchFrames * sizeof(int32_t));
+	for (size_t frames = 0; frames <= 64; ++frames)
+	{
+		size_t bytes = kernel.run(in, frames, out);
+		result.insert(result.end(), out.begin(), out.begin() + bytes);
+	}
+	size_t bytes = kernel.run(in, benchFrames, out);
+	result.insert(result.end(), out.begin(), out.begin() + bytes);
+	return result;
+}
+
+
+/// Million samples per second
+double benchmark(const Kernel& kernel, const Input& in)
+{
+	vector<char> out(2 * benchFrames * sizeof(int32_t));
+	size_t runs = 0;
+	auto start = chrono::steady_clock::now();
+	chrono::duration<double> elapsed(0);
+	do
+	{
+		kernel.run(in, benchFrames, out);
+		++runs;
+		elapsed = chrono::steady_clock::now() - start;
+	}
+	while (elapsed.count() < benchSeconds);
+	return runs * 2. * benchFrames / elapsed.count() / 1e6;
+}
+
+}
+
+
+
+int main()
+{
+	Input in(benchFrames);
+	vector<Kernel> all = kernels();
+	vector<string> isas = sample::availableIsas();
+
+	vector<vector<char>> reference;
+	sample::setIsa("scalar");
+	for (const auto& kernel: all)
+		reference.push_back(check(kernel, in));
+
+	bool ok = true;
+	printf("%-24s", "kernel [Msamples/s]");
+	for (const auto& isa: isas)
+		printf("%12s", isa.c_str());
+	printf("\n");
+	for (size_t n = 0; n < all.size(); ++n)
+	{
+		printf("%-24s", all[n].name.c_str());
+		for (const auto& isa: isas)
+		{
+			sample::setIsa(isa);
+			bool match = (check(all[n], in) == reference[n]);
+			ok = ok && match;
+			printf("%11.1f%s", benchmark(all[n], in), match ? " " : "!");
+		}
+		printf("\n");
+	}
+
+	if (!ok)
+	{
+		printf("\n! output differs from the scalar kernel\n");
+		return 1;
+	}
+	return 0;
+}
+
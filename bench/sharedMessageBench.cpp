@@ -0,0 +1,183 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include <asio.hpp>
+#include "message/wireChunk.h"
+#include "sharedMessage.h"
+
+using namespace std;
+
+
+/// Measures the CPU time per client of sending a chunk to many clients
+/**
+ * A 20ms PCM chunk is sent to N sessions, whose sockets are null sinks.
+ * "per session" is the way StreamSession used to send: every session
+ * serializes the message into its own streambuf and writes it. "shared"
+ * serializes the chunk once into a SharedMessage, every session only
+ * fills its header and does a gathered write of header and shared payload.
+ * The copy into the kernel's socket buffer is the same for both and not
+ * part of the measurement.
+ * Returns 1 if the two variants don't put the same bytes on the wire.
+ */
+
+
+namespace
+{
+
+const size_t payloadSize = 48000 * 4 / 50;
+const uint16_t version = 2;
+const double benchSeconds = 0.2;
+
+
+/// SyncWriteStream that discards the data, optionally keeps a copy of it
+struct NullSink
+{
+	NullSink() : bytes(0), capture(nullptr)
+	{
+	}
+
+	template <typename ConstBufferSequence>
+	size_t write_some(const ConstBufferSequence& buffers)
+	{
+		size_t size = asio::buffer_size(buffers);
+		if (capture != nullptr)
+		{
+			size_t offset = capture->size();
+			capture->resize(offset + size);
+			asio::buffer_copy(asio::buffer(capture->data() + offset, size), buffers);
+		}
+		bytes += size;
+		return size;
+	}
+
+	template <typename ConstBufferSequence, typename ErrorCode>
+	size_t write_some(const ConstBufferSequence& buffers, ErrorCode& ec)
+	{
+		ec = ErrorCode();
+		return write_some(buffers);
+	}
+
+	size_t bytes;
+	vector<char>* capture;
+};
+
+
+shared_ptr<msg::WireChunk> makeChunk()
+{
+	auto chunk = make_shared<msg::WireChunk>(payloadSize);
+	for (size_t n = 0; n < payloadSize; ++n)
+		chunk->payload[n] = (char)(n * 7);
+	chunk->sequence = 4711;
+	chunk->timestamp.sec = 1500000000;
+	chunk->timestamp.usec = 20000;
+	/// initialized with the current time, but must be the same for every chunk to compare them
+	chunk->received.sec = 1500000000;
+	chunk->received.usec = 0;
+	return chunk;
+}
+
+
+/// Like StreamSession::send before the chunks were shared
+void sendPerSession(const msg::message_ptr& message, vector<NullSink>& sinks)
+{
+	for (auto& sink: sinks)
+	{
+		asio::streambuf streambuf;
+		std::ostream stream(&streambuf);
+		message->sent = tv();
+		message->serialize(stream, version);
+		asio::write(sink, streambuf);
+	}
+}
+
+
+/// Like StreamServer::onChunkRead and StreamSession::writeNext
+void sendShared(const msg::message_ptr& message, vector<NullSink>& sinks)
+{
+	SharedMessagePtr shared = make_shared<SharedMessage>(message);
+	SharedMessage::Header header;
+	for (auto& sink: sinks)
+		asio::write(sink, shared->buffers(header, version));
+}
+
+
+/// Bytes on the wire, without the "sent" timestamp, that differs with every send
+vector<char> wire(void (*send)(const msg::message_ptr&, vector<NullSink>&))
+{
+	vector<char> result;
+	vector<NullSink> sinks(1);
+	sinks[0].capture = &result;
+	send(makeChunk(), sinks);
+	/// offset of "sent": type, flags, id, refersTo
+	size_t sentOffset = 2*sizeof(uint16_t) + 2*sizeof(uint32_t);
+	if (result.size() >= sentOffset + sizeof(int64_t))
+		memset(result.data() + sentOffset, 0, sizeof(int64_t));
+	return result;
+}
+
+
+/// CPU time per chunk and client [ns]
+double benchmark(void (*send)(const msg::message_ptr&, vector<NullSink>&), size_t clients)
+{
+	vector<NullSink> sinks(clients);
+	size_t runs = 0;
+	auto start = chrono::steady_clock::now();
+	chrono::duration<double> elapsed(0);
+	do
+	{
+		/// a new chunk per run, like the stream reader produces them
+		send(makeChunk(), sinks);
+		++runs;
+		elapsed = chrono::steady_clock::now() - start;
+	}
+	while (elapsed.count() < benchSeconds);
+	return elapsed.count() * 1e9 / runs / clients;
+}
+
+}
+
+
+
+int main()
+{
+	vector<char> perSession = wire(sendPerSession);
+	vector<char> shared = wire(sendShared);
+	bool ok = !perSession.empty() && (perSession == shared);
+
+	printf("%-10s%20s%20s%10s\n", "clients", "per session [ns]", "shared [ns]", "speedup");
+	for (size_t clients: {1, 10, 100, 1000})
+	{
+		double perSessionNs = benchmark(sendPerSession, clients);
+		double sharedNs = benchmark(sendShared, clients);
+		printf("%-10zu%20.1f%20.1f%9.1fx\n", clients, perSessionNs, sharedNs, perSessionNs / sharedNs);
+	}
+
+	if (!ok)
+	{
+		printf("\n! the shared message differs from the per session serialization (%zu vs %zu bytes)\n", shared.size(), perSession.size());
+		return 1;
+	}
+	return 0;
+}
+
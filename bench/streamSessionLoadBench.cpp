@@ -0,0 +1,252 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <asio.hpp>
+#include "message/wireChunk.h"
+#include "streamSession.h"
+
+using namespace std;
+using asio::ip::tcp;
+
+
+/// Load test of StreamSessions on the shared io_service with 10 to 1000 clients
+/**
+ * N clients connect over loopback, the server side of every connection is a
+ * StreamSession on an io_service that is run by one worker per CPU core, like
+ * snapserver does it. Every 20ms a PCM chunk is serialized once and sent to
+ * all sessions, like StreamServer::onChunkRead does it. All clients are read
+ * by a single thread.
+ * Reported are the threads of the process, the context switches per second
+ * and the CPU time per chunk and client of the whole process (server and
+ * clients). Returns 1 if a client doesn't receive all data, or if the number
+ * of threads grows with the number of clients.
+ */
+
+
+namespace
+{
+
+const size_t payloadSize = 48000 * 4 / 50;
+const size_t chunkMs = 20;
+const size_t streamMs = 1000;
+
+
+/// Threads of this process, 0 if unknown
+size_t processThreads()
+{
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+	{
+		if (line.find("Threads:") == 0)
+			return stoul(line.substr(8));
+	}
+	return 0;
+}
+
+
+struct Usage
+{
+	Usage()
+	{
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+		cpuSeconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+		time = chrono::steady_clock::now();
+	}
+
+	long contextSwitches;
+	double cpuSeconds;
+	chrono::steady_clock::time_point time;
+};
+
+
+/// Received messages are ignored
+class NullReceiver : public MessageReceiver
+{
+public:
+	virtual void onMessageReceived(StreamSession* connection, const msg::BaseMessage& baseMessage, char* buffer)
+	{
+	}
+
+	virtual void onDisconnect(StreamSession* connection)
+	{
+	}
+};
+
+
+/// Client side of a connection, reads and discards everything
+class Client
+{
+public:
+	Client(asio::io_service& ioService, atomic<size_t>& received) : socket(ioService), buffer_(64 * 1024), received_(received)
+	{
+	}
+
+	void read()
+	{
+		socket.async_read_some(asio::buffer(buffer_), [this](const std::error_code& ec, std::size_t length)
+		{
+			if (ec)
+				return;
+			received_ += length;
+			read();
+		});
+	}
+
+	tcp::socket socket;
+
+private:
+	vector<char> buffer_;
+	atomic<size_t>& received_;
+};
+
+
+struct Result
+{
+	size_t threads;
+	double contextSwitchesPerSecond;
+	/// CPU time per chunk and client [us]
+	double cpuUs;
+	bool complete;
+};
+
+
+Result run(size_t clients, size_t workers)
+{
+	asio::io_service serverService;
+	asio::io_service clientService;
+	unique_ptr<asio::io_service::work> serverWork(new asio::io_service::work(serverService));
+	unique_ptr<asio::io_service::work> clientWork(new asio::io_service::work(clientService));
+	vector<thread> threads;
+	for (size_t n = 0; n < workers; ++n)
+		threads.emplace_back([&serverService]() { serverService.run(); });
+	threads.emplace_back([&clientService]() { clientService.run(); });
+
+	tcp::acceptor acceptor(serverService, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	NullReceiver receiver;
+	atomic<size_t> received(0);
+	vector<unique_ptr<Client>> clientSockets;
+	vector<shared_ptr<StreamSession>> sessions;
+	for (size_t n = 0; n < clients; ++n)
+	{
+		clientSockets.emplace_back(new Client(clientService, received));
+		clientSockets.back()->socket.connect(acceptor.local_endpoint());
+		auto socket = make_shared<tcp::socket>(serverService);
+		acceptor.accept(*socket);
+		socket->set_option(tcp::no_delay(true));
+		sessions.push_back(make_shared<StreamSession>(serverService, &receiver, socket));
+		sessions.back()->start();
+	}
+	for (auto& client: clientSockets)
+		clientService.post([&client]() { client->read(); });
+
+	Usage start;
+	size_t chunks = streamMs / chunkMs;
+	size_t expected = 0;
+	auto next = chrono::steady_clock::now();
+	for (size_t n = 0; n < chunks; ++n)
+	{
+		auto chunk = make_shared<msg::WireChunk>(payloadSize);
+		SharedMessagePtr message = make_shared<SharedMessage>(chunk);
+		for (auto& session: sessions)
+			session->sendAsync(message);
+		expected += clients * message->size(1);
+		next += chrono::milliseconds(chunkMs);
+		this_thread::sleep_until(next);
+	}
+
+	/// let the clients read the rest
+	auto timeout = chrono::steady_clock::now() + chrono::seconds(5);
+	while ((received < expected) && (chrono::steady_clock::now() < timeout))
+		this_thread::sleep_for(chrono::milliseconds(1));
+	Usage end;
+
+	Result result;
+	result.threads = processThreads();
+	chrono::duration<double> elapsed = end.time - start.time;
+	result.contextSwitchesPerSecond = (end.contextSwitches - start.contextSwitches) / elapsed.count();
+	result.cpuUs = (end.cpuSeconds - start.cpuSeconds) * 1e6 / chunks / clients;
+	result.complete = (received == expected);
+
+	for (auto& session: sessions)
+		session->stop();
+	for (auto& client: clientSockets)
+		clientService.post([&client]() { client->socket.close(); });
+	serverWork.reset();
+	clientWork.reset();
+	/// the io_services run out of work, as soon as all handlers finished with the closed sockets
+	sessions.clear();
+	for (auto& t: threads)
+		t.join();
+	return result;
+}
+
+}
+
+
+
+int main()
+{
+	size_t workers = max(1u, thread::hardware_concurrency());
+
+	/// two sockets per client
+	rlimit files;
+	getrlimit(RLIMIT_NOFILE, &files);
+	files.rlim_cur = files.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &files);
+
+	bool ok = true;
+	size_t firstThreads = 0;
+	printf("%d workers, %zu ms of %zu ms chunks\n", (int)workers, streamMs, chunkMs);
+	printf("%-10s%10s%20s%24s\n", "clients", "threads", "ctx switches [1/s]", "CPU/chunk/client [us]");
+	for (size_t clients: {10, 100, 1000})
+	{
+		if (2 * clients + 64 > files.rlim_cur)
+		{
+			printf("%-10zu skipped, the limit of open files is %zu\n", clients, (size_t)files.rlim_cur);
+			continue;
+		}
+		Result result = run(clients, workers);
+		printf("%-10zu%10zu%20.0f%24.2f%s\n", clients, result.threads, result.contextSwitchesPerSecond, result.cpuUs, result.complete ? "" : "  incomplete!");
+		ok = ok && result.complete;
+		if (firstThreads == 0)
+			firstThreads = result.threads;
+		else if (result.threads > firstThreads)
+			ok = false;
+	}
+
+	if (!ok)
+	{
+		printf("\n! clients didn't receive all data, or the threads grow with the clients\n");
+		return 1;
+	}
+	return 0;
+}
+
@@ -28,7 +28,7 @@
 using namespace std;
 
 
-ClientConnection::ClientConnection(MessageReceiver* receiver, const std::string& host, size_t port) : socket_(nullptr), active_(false), connected_(false), messageReceiver_(receiver), reqId_(1), host_(host), port_(port), readerThread_(NULL), sumTimeout_(chronos::msec(0))
+ClientConnection::ClientConnection(MessageReceiver* receiver, const std::string& host, size_t port) : socket_(nullptr), active_(false), connected_(false), messageReceiver_(receiver), reqId_(1), protocolVersion_(1), host_(host), port_(port), readerThread_(NULL), sumTimeout_(chronos::msec(0))
 {
 }
 
@@ -82,6 +82,7 @@ void ClientConnection::start()
 //	setsockopt(socket->native_handle(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 	socket_->connect(*iterator);
 	connected_ = true;
+	protocolVersion_ = 1;
 	SLOG(NOTICE) << "Connected to " << socket_->remote_endpoint().address().to_string() << endl;
 	active_ = true;
 	sumTimeout_ = chronos::msec(0);
@@ -131,7 +132,7 @@ bool ClientConnection::send(const msg::BaseMessage* message) const
 	std::ostream stream(&streambuf);
 	tv t;
 	message->sent = t;
-	message->serialize(stream);
+	message->serialize(stream, protocolVersion_);
 	asio::write(*socket_.get(), streambuf);
 	return true;
 }
@@ -140,13 +141,13 @@ bool ClientConnection::send(const msg::BaseMessage* message) const
 shared_ptr<msg::SerializedMessage> ClientConnection::sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout)
 {
 	shared_ptr<msg::SerializedMessage> response(NULL);
-	if (++reqId_ >= 10000)
+	std::unique_lock<std::mutex> lock(pendingRequestsMutex_);
+	/// Version 1 ids are 16 bit
+	if (++reqId_ >= ((protocolVersion_ >= 2) ? 0x7fffffff : 10000))
 		reqId_ = 1;
 	message->id = reqId_;
 //	LOG(INFO) << "Req: " << message->id << "\n";
 	shared_ptr<PendingRequest> pendingRequest(new PendingRequest(reqId_));
-
-	std::unique_lock<std::mutex> lock(pendingRequestsMutex_);
 	pendingRequests_.insert(pendingRequest);
 	send(message);
 	if (pendingRequest->cv.wait_for(lock, std::chrono::milliseconds(timeout)) == std::cv_status::no_timeout)
@@ -158,7 +159,7 @@ shared_ptr<msg::SerializedMessage> ClientConnection::sendRequest(const msg::Base
 	else
 	{
 		sumTimeout_ += timeout;
-		LOG(WARNING) << "timeout while waiting for response to: " << reqId_ << ", timeout " << sumTimeout_.count() << "\n";
+		LOG(WARNING) << "timeout while waiting for response to: " << pendingRequest->id << ", timeout " << sumTimeout_.count() << "\n";
 		if (sumTimeout_ > chronos::sec(10))
 			throw SnapException("sum timeout exceeded 10s");
 	}
@@ -167,19 +168,63 @@ shared_ptr<msg::SerializedMessage> ClientConnection::sendRequest(const msg::Base
 }
 
 
+shared_ptr<PendingRequest> ClientConnection::sendRequestAsync(const msg::BaseMessage* message, const ResponseHandler& handler)
+{
+	std::lock_guard<std::mutex> lock(pendingRequestsMutex_);
+	/// Version 1 ids are 16 bit
+	if (++reqId_ >= ((protocolVersion_ >= 2) ? 0x7fffffff : 10000))
+		reqId_ = 1;
+	message->id = reqId_;
+	shared_ptr<PendingRequest> pendingRequest(new PendingRequest(reqId_, handler));
+	pendingRequests_.insert(pendingRequest);
+	send(message);
+	return pendingRequest;
+}
+
+
+bool ClientConnection::cancelRequest(const std::shared_ptr<PendingRequest>& request)
+{
+	std::lock_guard<std::mutex> lock(pendingRequestsMutex_);
+	return (pendingRequests_.erase(request) > 0);
+}
+
+
 void ClientConnection::getNextMessage()
 {
 	msg::BaseMessage baseMessage;
-	size_t baseMsgSize = baseMessage.getSize();
-	vector<char> buffer(baseMsgSize);
-	socketRead(&buffer[0], baseMsgSize);
-	baseMessage.deserialize(&buffer[0]);
+	size_t headerSize = msg::BaseMessage::header_size;
+	socketRead(header_.data(), headerSize);
+	if (msg::BaseMessage::isV2Header(header_.data()))
+		socketRead(header_.data() + headerSize, header_.size() - headerSize);
+	baseMessage.deserialize(header_.data());
 //	LOG(DEBUG) << "getNextMessage: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << "\n";
-	if (baseMessage.size > buffer.size())
-		buffer.resize(baseMessage.size);
+	if (baseMessage.size > msg::max_size)
+		throw SnapException("received message of type " + cpt::to_string(baseMessage.type) + " to large: " + cpt::to_string(baseMessage.size));
+
+	if (baseMessage.type == message_type::kWireChunk)
+	{
+		/// Read the audio data directly into the chunk's payload, no intermediate buffer and no copy
+		std::array<char, msg::WireChunk::chunk_header_v2_size> chunkHeader;
+		std::unique_ptr<msg::PcmChunk> chunk(new msg::PcmChunk());
+		size_t chunkHeaderSize = msg::WireChunk::getChunkHeaderSize(baseMessage.version);
+		if (baseMessage.size < chunkHeaderSize)
+			throw SnapException("received chunk is to small: " + cpt::to_string(baseMessage.size));
+		socketRead(chunkHeader.data(), chunkHeaderSize);
+		if (!chunk->deserializeHeader(baseMessage, chunkHeader.data()))
+			throw SnapException("received chunk with invalid payload size: " + cpt::to_string(chunk->payloadSize));
+		socketRead(chunk->payload, chunk->payloadSize);
+		tv t;
+		chunk->received = t;
+		if (messageReceiver_ != NULL)
+			messageReceiver_->onChunkReceived(this, chunk.release());
+		return;
+	}
+
+	if (baseMessage.size > buffer_.size())
+		buffer_.resize(baseMessage.size);
 //	{
 //		std::lock_guard<std::mutex> socketLock(socketMutex_);
-	socketRead(&buffer[0], baseMessage.size);
+	socketRead(buffer_.data(), baseMessage.size);
 //	}
 	tv t;
 	baseMessage.received = t;
@@ -195,7 +240,14 @@ void ClientConnection::getNextMessage()
 					req->response.reset(new msg::SerializedMessage());
 					req->response->message = baseMessage;
 					req->response->buffer = (char*)malloc(baseMessage.size);
-					memcpy(req->response->buffer, &buffer[0], baseMessage.size);
+					memcpy(req->response->buffer, buffer_.data(), baseMessage.size);
+					if (req->handler)
+					{
+						pendingRequests_.erase(req);
+						lock.unlock();
+						req->handler(req->response);
+						return;
+					}
 					lock.unlock();
 					req->cv.notify_one();
 					return;
@@ -205,7 +257,7 @@ void ClientConnection::getNextMessage()
 	}
 
 	if (messageReceiver_ != NULL)
-		messageReceiver_->onMessageReceived(this, baseMessage, &buffer[0]);
+		messageReceiver_->onMessageReceived(this, baseMessage, buffer_.data());
 }
 
 
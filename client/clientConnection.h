@@ -26,8 +26,12 @@
 #include <memory>
 #include <asio.hpp>
 #include <condition_variable>
+#include <functional>
 #include <set>
+#include <array>
+#include <vector>
 #include "message/message.h"
+#include "message/pcmChunk.h"
 #include "common/timeDefs.h"
 
 
@@ -37,14 +41,18 @@ using asio::ip::tcp;
 class ClientConnection;
 
 
+typedef std::function<void(std::shared_ptr<msg::SerializedMessage>)> ResponseHandler;
+
 /// Used to synchronize server requests (wait for server response)
 struct PendingRequest
 {
-	PendingRequest(uint16_t reqId) : id(reqId), response(NULL) {};
+	PendingRequest(uint32_t reqId, const ResponseHandler& responseHandler = nullptr) : id(reqId), response(NULL), handler(responseHandler) {};
 
-	uint16_t id;
+	uint32_t id;
 	std::shared_ptr<msg::SerializedMessage> response;
 	std::condition_variable cv;
+	/// Async requests: called with the response on the reader thread
+	ResponseHandler handler;
 };
 
 
@@ -58,6 +66,8 @@ class MessageReceiver
 public:
 	virtual ~MessageReceiver() = default;
 	virtual void onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer) = 0;
+	/// Audio chunks are read directly into the chunk's payload. The receiver takes the ownership of the chunk
+	virtual void onChunkReceived(ClientConnection* connection, msg::PcmChunk* chunk) = 0;
 	virtual void onException(ClientConnection* connection, shared_exception_ptr exception) = 0;
 };
 
@@ -67,6 +77,7 @@ public:
  * Server connection endpoint.
  * Messages are sent to the server with the "send" method (async).
  * Messages are sent sync to server with the sendReq method.
+ * Several requests can be in flight with sendRequestAsync, the responses are matched by id.
  */
 class ClientConnection
 {
@@ -81,6 +92,13 @@ public:
 	/// Send request to the server and wait for answer
 	virtual std::shared_ptr<msg::SerializedMessage> sendRequest(const msg::BaseMessage* message, const chronos::msec& timeout = chronos::msec(1000));
 
+	/// Send request to the server without waiting, "handler" is called with the answer on the reader thread
+	/// The request stays pending until it is answered or cancelled
+	virtual std::shared_ptr<PendingRequest> sendRequestAsync(const msg::BaseMessage* message, const ResponseHandler& handler);
+
+	/// Cancel a pending async request, returns false if it has already been answered
+	virtual bool cancelRequest(const std::shared_ptr<PendingRequest>& request);
+
 	/// Send request to the server and wait for answer of type T
 	template <typename T>
 	std::shared_ptr<T> sendReq(const msg::BaseMessage* message, const chronos::msec& timeout = chronos::msec(1000))
@@ -95,6 +113,12 @@ public:
 
 	std::string getMacAddress() const;
 
+	/// Protocol version for sent messages, negotiated with Hello/ServerSettings. Received messages can have either version
+	void setProtocolVersion(uint16_t version)
+	{
+		protocolVersion_ = version;
+	}
+
 	virtual bool active() const
 	{
 		return active_;
@@ -120,11 +144,16 @@ protected:
 	MessageReceiver* messageReceiver_;
 	mutable std::mutex pendingRequestsMutex_;
 	std::set<std::shared_ptr<PendingRequest>> pendingRequests_;
-	uint16_t reqId_;
+	/// Id of the last request, guarded by pendingRequestsMutex_
+	uint32_t reqId_;
+	std::atomic<uint16_t> protocolVersion_;
 	std::string host_;
 	size_t port_;
 	std::thread* readerThread_;
 	chronos::msec sumTimeout_;
+	/// Receive buffers, reused for every message. Only accessed by the reader thread
+	std::array<char, msg::BaseMessage::header_v2_size> header_;
+	std::vector<char> buffer_;
 };
 
 
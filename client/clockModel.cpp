@@ -0,0 +1,118 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "clockModel.h"
+
+
+ClockModel::ClockModel(size_t size) : samples_(size), rtts_(size)
+{
+	clear();
+}
+
+
+void ClockModel::clear()
+{
+	next_ = 0;
+	count_ = 0;
+	rtts_.clear();
+	reference_ = 0;
+	offset_ = 0.;
+	skew_ = 0.;
+	offsetError_ = std::numeric_limits<double>::infinity();
+	offsetUncertainty_ = std::numeric_limits<double>::infinity();
+	skewError_ = std::numeric_limits<double>::infinity();
+}
+
+
+void ClockModel::add(int64_t local, double diff, double rtt)
+{
+	samples_[next_] = {local, diff, rtt};
+	rtts_.add(rtt);
+	next_ = (next_ + 1) % samples_.size();
+	if (count_ < samples_.size())
+		++count_;
+	reference_ = local;
+	update();
+}
+
+
+void ClockModel::update()
+{
+	/// min RTT filter
+	double maxRtt = rtts_.median();
+
+	/// x: [s] relative to the reference, y: diff [us]
+	size_t n = 0;
+	double sumX = 0., sumY = 0., minX = 0., maxX = 0.;
+	for (size_t i = 0; i < count_; ++i)
+	{
+		const Sample& sample = samples_[i];
+		if (sample.rtt > maxRtt)
+			continue;
+		double x = (sample.local - reference_) / 1000000.;
+		sumX += x;
+		sumY += sample.diff;
+		minX = (n == 0) ? x : std::min(minX, x);
+		maxX = (n == 0) ? x : std::max(maxX, x);
+		++n;
+	}
+	double meanX = sumX / n;
+	double meanY = sumY / n;
+
+	double sxx = 0., sxy = 0., syy = 0.;
+	for (size_t i = 0; i < count_; ++i)
+	{
+		const Sample& sample = samples_[i];
+		if (sample.rtt > maxRtt)
+			continue;
+		double dx = (sample.local - reference_) / 1000000. - meanX;
+		double dy = sample.diff - meanY;
+		sxx += dx * dx;
+		sxy += dx * dy;
+		syy += dy * dy;
+	}
+
+	skewError_ = std::numeric_limits<double>::infinity();
+	if ((n >= 4) && (maxX - minX >= minSpan) && (sxx > 0.))
+	{
+		/// slope in [us/s] = [ppm]
+		double slope = sxy / sxx;
+		double residuals = std::max(0., syy - slope * sxy);
+		double offsetError = sqrt(residuals / (n - 2));
+		skewError_ = offsetError / sqrt(sxx) / 1000000.;
+		/// a noisy skew would spoil the extrapolation
+		if (skewError_ <= maxSkewError / 1000000.)
+		{
+			offset_ = meanY - slope * meanX;
+			skew_ = slope / 1000000.;
+			offsetError_ = offsetError;
+			offsetUncertainty_ = offsetError * sqrt(1. / n + meanX * meanX / sxx);
+			return;
+		}
+	}
+
+	offset_ = meanY;
+	skew_ = 0.;
+	offsetError_ = (n > 1) ? sqrt(syy / (n - 1)) : std::numeric_limits<double>::infinity();
+	offsetUncertainty_ = offsetError_ / sqrt(n);
+}
+
@@ -0,0 +1,132 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef CLOCK_MODEL_H
+#define CLOCK_MODEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "orderStatistics.h"
+
+
+/// Offset and skew between the local and the server clock
+/**
+ * Fed with time sync measurements "diff = server - local", each with the
+ * round trip time it was measured with.
+ * Min RTT filter: only the samples with a round trip time below the median
+ * are used, since queuing delays make the measurement asymmetric.
+ * These are fitted with a least squares line "diff = offset + skew * (t - reference)",
+ * i.e. the offset at the newest sample and the drift of the crystals.
+ * The skew is only used if the samples span at least "minSpan" seconds and
+ * its standard error is below "maxSkewError", else the offset is the mean.
+ */
+class ClockModel
+{
+public:
+	ClockModel(size_t size = 200);
+
+	/// Add a measurement [us]: at local time "local" the server is "diff" ahead, measured with round trip time "rtt"
+	void add(int64_t local, double diff, double rtt);
+	void clear();
+
+	size_t size() const
+	{
+		return count_;
+	}
+
+	bool empty() const
+	{
+		return (count_ == 0);
+	}
+
+	/// Local time [us] the offset refers to
+	int64_t reference() const
+	{
+		return reference_;
+	}
+
+	/// server - local [us] at the reference time
+	double offset() const
+	{
+		return offset_;
+	}
+
+	/// server - local [us] at local time "local", extrapolated with the skew
+	double offset(int64_t local) const
+	{
+		return offset_ + skew_ * (local - reference_);
+	}
+
+	/// Drift of the server clock relative to the local clock, e.g. 1e-5 if the server is 10ppm faster
+	double skew() const
+	{
+		return skew_;
+	}
+
+	/// Standard deviation of the used samples around the model [us]
+	double offsetError() const
+	{
+		return offsetError_;
+	}
+
+	/// Standard error of the offset estimation [us], infinity if there are too few samples
+	double offsetUncertainty() const
+	{
+		return offsetUncertainty_;
+	}
+
+	/// Standard error of the skew estimation, infinity if there are too few samples
+	double skewError() const
+	{
+		return skewError_;
+	}
+
+	/// Minimum time span [s] of the samples to estimate the skew
+	static const int minSpan = 10;
+	/// The skew is used once its standard error is below [ppm]
+	static const int maxSkewError = 5;
+
+private:
+	struct Sample
+	{
+		int64_t local;
+		double diff;
+		double rtt;
+	};
+
+	void update();
+
+	std::vector<Sample> samples_;
+	/// Round trip times of the samples, for the min RTT filter
+	OrderStatistics<double> rtts_;
+	size_t next_;
+	size_t count_;
+
+	int64_t reference_;
+	double offset_;
+	double skew_;
+	double offsetError_;
+	double offsetUncertainty_;
+	double skewError_;
+};
+
+
+#endif
+
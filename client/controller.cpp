@@ -19,6 +19,7 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <deque>
 #include "controller.h"
 #include "decoder/pcmDecoder.h"
 #if defined(HAS_OGG) && (defined(HAS_TREMOR) || defined(HAS_VORBIS))
@@ -27,25 +28,36 @@
 #if defined(HAS_FLAC)
 #include "decoder/flacDecoder.h"
 #endif
+#if defined(HAS_OPUS)
+#include "decoder/opusDecoder.h"
+#endif
 #include "timeProvider.h"
 #include "message/time.h"
 #include "message/hello.h"
+#include "common/payloadPool.h"
 #include "common/snapException.h"
 #include "aixlog.hpp"
 
 using namespace std;
 
 
-Controller::Controller(const std::string& hostId, size_t instance, std::shared_ptr<MetadataAdapter> meta) : MessageReceiver(), 
+Controller::Controller(const std::string& hostId, size_t instance, const std::string& codec, std::shared_ptr<MetadataAdapter> meta) : MessageReceiver(), 
 	hostId_(hostId),
 	instance_(instance),
+	codec_(codec),
 	active_(false),
 	latency_(0),
+	syncTarget_(500),
+	maxBufferMs_(10000),
 	stream_(nullptr),
 	decoder_(nullptr),
 	player_(nullptr),
 	meta_(meta),
 	serverSettings_(nullptr),
+	lastChunkSequence_(0),
+	lostChunks_(0),
+	decodeQueue_(128),
+	overruns_(0),
 	async_exception_(nullptr)
 {
 }
@@ -54,31 +66,31 @@ Controller::Controller(const std::string& hostId, size_t instance, std::shared_p
 void Controller::onException(ClientConnection* connection, shared_exception_ptr exception)
 {
 	LOG(ERROR) << "Controller::onException: " << exception->what() << "\n";
+	setAsyncException(exception);
+}
+
+
+void Controller::setAsyncException(const shared_exception_ptr& exception)
+{
+	std::lock_guard<std::mutex> lock(asyncExceptionMutex_);
 	async_exception_ = exception;
 }
 
 
-void Controller::onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer)
+void Controller::throwAsyncException()
 {
-	std::lock_guard<std::mutex> lock(receiveMutex_);
-	if (baseMessage.type == message_type::kWireChunk)
+	std::lock_guard<std::mutex> lock(asyncExceptionMutex_);
+	if (async_exception_)
 	{
-		if (stream_ && decoder_)
-		{
-			msg::PcmChunk* pcmChunk = new msg::PcmChunk(sampleFormat_, 0);
-			pcmChunk->deserialize(baseMessage, buffer);
-//			LOG(DEBUG) << "chunk: " << pcmChunk->payloadSize << ", sampleFormat: " << sampleFormat_.rate << "\n";
-			if (decoder_->decode(pcmChunk))
-			{
-//TODO: do decoding in thread?
-				stream_->addChunk(pcmChunk);
-				//LOG(DEBUG) << ", decoded: " << pcmChunk->payloadSize << ", Duration: " << pcmChunk->getDuration() << ", sec: " << pcmChunk->timestamp.sec << ", usec: " << pcmChunk->timestamp.usec/1000 << ", type: " << pcmChunk->type << "\n";
-			}
-			else
-				delete pcmChunk;
-		}
+		LOG(DEBUG) << "Async exception: " << async_exception_->what() << "\n";
+		throw SnapException(async_exception_->what());
 	}
-	else if (baseMessage.type == message_type::kTime)
+}
+
+
+void Controller::onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer)
+{
+	if (baseMessage.type == message_type::kTime)
 	{
 		msg::Time reply;
 		reply.deserialize(baseMessage, buffer);
@@ -86,9 +98,16 @@ void Controller::onMessageReceived(ClientConnection* connection, const msg::Base
 	}
 	else if (baseMessage.type == message_type::kServerSettings)
 	{
+		std::lock_guard<std::mutex> lock(playerMutex_);
 		serverSettings_.reset(new msg::ServerSettings());
 		serverSettings_->deserialize(baseMessage, buffer);
-		LOG(INFO) << "ServerSettings - buffer: " << serverSettings_->getBufferMs() << ", latency: " << serverSettings_->getLatency() << ", volume: " << serverSettings_->getVolume() << ", muted: " << serverSettings_->isMuted() << "\n";
+		LOG(INFO) << "ServerSettings - buffer: " << serverSettings_->getBufferMs() << ", latency: " << serverSettings_->getLatency() << ", volume: " << serverSettings_->getVolume() << ", muted: " << serverSettings_->isMuted() << ", capabilities: " << serverSettings_->getCapabilities() << "\n";
+		clientConnection_->setProtocolVersion((serverSettings_->getCapabilities() & capability::kCapProtocolV2) ? 2 : 1);
+		/// only the reply to the Hello message carries the time sync port
+		if ((serverSettings_->getTimePort() != 0) && !timeClient_)
+		{
+			timeClient_ = TimeClient::getShared(host_, serverSettings_->getTimePort());
+		}
 		if (stream_ && player_)
 		{
 			player_->setVolume(serverSettings_->getVolume() / 100.);
@@ -98,33 +117,152 @@ void Controller::onMessageReceived(ClientConnection* connection, const msg::Base
 	}
 	else if (baseMessage.type == message_type::kCodecHeader)
 	{
-		headerChunk_.reset(new msg::CodecHeader());
-		headerChunk_->deserialize(baseMessage, buffer);
+		shared_ptr<msg::CodecHeader> header = make_shared<msg::CodecHeader>();
+		header->deserialize(baseMessage, buffer);
+		LOG(INFO) << "Codec: " << header->codec << "\n";
+		/// new stream, new sequence
+		lastChunkSequence_ = 0;
+		enqueue(nullptr, header);
+	}
+	else if (baseMessage.type == message_type::kStreamTags)
+        {
+		streamTags_.reset(new msg::StreamTags());
+		streamTags_->deserialize(baseMessage, buffer);
+		
+		if(meta_)
+			meta_->push(streamTags_->msg);
+        }
+
+	if (baseMessage.type != message_type::kTime)
+		if (sendTimeSyncMessage(1000))
+			LOG(DEBUG) << "time sync onMessageReceived\n";
+}
+
+
+void Controller::onChunkReceived(ClientConnection* connection, msg::PcmChunk* pcmChunk)
+{
+	if (pcmChunk->sequence != 0)
+	{
+		if ((lastChunkSequence_ != 0) && (pcmChunk->sequence != lastChunkSequence_ + 1))
+		{
+			if (pcmChunk->sequence > lastChunkSequence_)
+				lostChunks_ += pcmChunk->sequence - lastChunkSequence_ - 1;
+			LOG(INFO) << "Chunk sequence " << pcmChunk->sequence << " following " << lastChunkSequence_ << ", lost chunks: " << lostChunks_.load() << "\n";
+		}
+		lastChunkSequence_ = pcmChunk->sequence;
+	}
+
+	enqueue(pcmChunk, nullptr);
+
+	if (sendTimeSyncMessage(1000))
+		LOG(DEBUG) << "time sync onChunkReceived\n";
+}
+
+
+void Controller::enqueue(msg::PcmChunk* chunk, const std::shared_ptr<msg::CodecHeader>& header)
+{
+	DecodeItem item;
+	item.chunk = chunk;
+	item.header = header;
+	item.enqueued = chrono::steady_clock::now();
+	while (!decodeQueue_.push(item))
+	{
+		/// The decoder doesn't keep up. Drop the chunk, the stream will fill the gap.
+		/// Codec headers and resets must not get lost, wait for the decoder
+		if (chunk != nullptr)
+		{
+			if (overruns_++ == 0)
+				LOG(WARNING) << "Decoder doesn't keep up, dropping chunks\n";
+			delete chunk;
+			return;
+		}
+		if (!active_)
+			return;
+		chronos::sleep(1);
+	}
+
+	/// take the lock, so that the notification can't get lost between the decoder's check and wait
+	{
+		std::lock_guard<std::mutex> lock(decodeMutex_);
+	}
+	decodeCv_.notify_one();
+}
+
+
+void Controller::decodeWorker()
+{
+	DecodeItem item;
+	while (active_)
+	{
+		if (!decodeQueue_.pop(item))
+		{
+			std::unique_lock<std::mutex> lock(decodeMutex_);
+			decodeCv_.wait(lock, [this] { return !active_ || !decodeQueue_.empty(); });
+			continue;
+		}
+
+		auto start = chrono::steady_clock::now();
+		queueLatency_.add(start - item.enqueued);
+		try
+		{
+			if (item.chunk != nullptr)
+			{
+				decode(item.chunk);
+				decodeLatency_.add(chrono::steady_clock::now() - start);
+			}
+			else if (item.header)
+				setHeader(item.header);
+			else
+				resetPlayer();
+		}
+		catch (const std::exception& e)
+		{
+			/// handled like exceptions of the connection: the worker reconnects
+			LOG(ERROR) << "Exception in Controller::decodeWorker(): " << e.what() << "\n";
+			setAsyncException(make_shared<SnapException>(e.what()));
+		}
+	}
 
-		LOG(INFO) << "Codec: " << headerChunk_->codec << "\n";
-		decoder_.reset(nullptr);
-		stream_ = nullptr;
-		player_.reset(nullptr);
+	while (decodeQueue_.pop(item))
+		delete item.chunk;
+	resetPlayer();
+}
 
-		if (headerChunk_->codec == "pcm")
-			decoder_.reset(new PcmDecoder());
+
+void Controller::setHeader(const std::shared_ptr<msg::CodecHeader>& header)
+{
+	std::lock_guard<std::mutex> lock(playerMutex_);
+	headerChunk_ = header;
+	decoder_.reset(nullptr);
+	stream_ = nullptr;
+	player_.reset(nullptr);
+
+	if (headerChunk_->codec == "pcm")
+		decoder_.reset(new PcmDecoder());
 #if defined(HAS_OGG) && (defined(HAS_TREMOR) || defined(HAS_VORBIS))
-		else if (headerChunk_->codec == "ogg")
-			decoder_.reset(new OggDecoder());
+	else if (headerChunk_->codec == "ogg")
+		decoder_.reset(new OggDecoder());
 #endif
 #if defined(HAS_FLAC)
-		else if (headerChunk_->codec == "flac")
-			decoder_.reset(new FlacDecoder());
+	else if (headerChunk_->codec == "flac")
+		decoder_.reset(new FlacDecoder());
 #endif
-		else
-			throw SnapException("codec not supported: \"" + headerChunk_->codec + "\"");
+#if defined(HAS_OPUS)
+	else if (headerChunk_->codec == "opus")
+		decoder_.reset(new OpusStreamDecoder());
+#endif
+	else
+		throw SnapException("codec not supported: \"" + headerChunk_->codec + "\"");
 
-		sampleFormat_ = decoder_->setHeader(headerChunk_.get());
-		LOG(NOTICE) << TAG("state") << "sampleformat: " << sampleFormat_.rate << ":" << sampleFormat_.bits << ":" << sampleFormat_.channels << "\n";
+	sampleFormat_ = decoder_->setHeader(headerChunk_.get());
+	LOG(NOTICE) << TAG("state") << "sampleformat: " << sampleFormat_.rate << ":" << sampleFormat_.bits << ":" << sampleFormat_.channels << "\n";
 
-		stream_ = make_shared<Stream>(sampleFormat_);
-		stream_->setBufferLen(serverSettings_->getBufferMs() - latency_);
+	stream_ = make_shared<Stream>(sampleFormat_, maxBufferMs_);
+	stream_->setBufferLen(serverSettings_->getBufferMs() - latency_);
 
+	if (FilePlayer::isFilePlayer(pcmDevice_.name))
+		player_.reset(new FilePlayer(pcmDevice_, stream_));
+	else
 #ifdef HAS_ALSA
 		player_.reset(new AlsaPlayer(pcmDevice_, stream_));
 #elif HAS_OPENSL
@@ -132,46 +270,159 @@ void Controller::onMessageReceived(ClientConnection* connection, const msg::Base
 #elif HAS_COREAUDIO
 		player_.reset(new CoreAudioPlayer(pcmDevice_, stream_));
 #else
-		throw SnapException("No audio player support");
+		throw SnapException("No audio player support, use the soundcard \"null\" or \"file:<path>\"");
 #endif
-		player_->setVolume(serverSettings_->getVolume() / 100.);
-		player_->setMute(serverSettings_->isMuted());
-		player_->start();
+	player_->setVolume(serverSettings_->getVolume() / 100.);
+	player_->setMute(serverSettings_->isMuted());
+	player_->start();
+}
+
+
+void Controller::decode(msg::PcmChunk* pcmChunk)
+{
+	/// owned until it's handed over to the stream, also if the decoder throws
+	std::unique_ptr<msg::PcmChunk> chunk(pcmChunk);
+	if (stream_ && decoder_)
+	{
+		chunk->format = sampleFormat_;
+//		LOG(DEBUG) << "chunk: " << chunk->payloadSize << ", sampleFormat: " << sampleFormat_.rate << "\n";
+		if (decoder_->decode(chunk.get()))
+		{
+			stream_->addChunk(chunk.release());
+			//LOG(DEBUG) << ", decoded: " << pcmChunk->payloadSize << ", Duration: " << pcmChunk->getDuration() << ", sec: " << pcmChunk->timestamp.sec << ", usec: " << pcmChunk->timestamp.usec/1000 << ", type: " << pcmChunk->type << "\n";
+		}
 	}
-	else if (baseMessage.type == message_type::kStreamTags)
-        {
-		streamTags_.reset(new msg::StreamTags());
-		streamTags_->deserialize(baseMessage, buffer);
-		
-		if(meta_)
-			meta_->push(streamTags_->msg);
-        }
+}
 
-	if (baseMessage.type != message_type::kTime)
-		if (sendTimeSyncMessage(1000))
-			LOG(DEBUG) << "time sync onMessageReceived\n";
+
+void Controller::resetPlayer()
+{
+	std::lock_guard<std::mutex> lock(playerMutex_);
+	player_.reset();
+	stream_.reset();
+	decoder_.reset();
+}
+
+
+nlohmann::json Controller::getMetrics() const
+{
+	nlohmann::json j;
+	j["queue"] = queueLatency_.toJson();
+	j["decode"] = decodeLatency_.toJson();
+	j["queued"] = decodeQueue_.size();
+	{
+		std::lock_guard<std::mutex> lock(playerMutex_);
+		j["bufferedMs"] = stream_ ? stream_->getBufferedMs() : 0;
+		j["droppedChunks"] = stream_ ? stream_->getDroppedChunks() : 0;
+	}
+	j["overruns"] = overruns_.load();
+	j["lostChunks"] = lostChunks_.load();
+	j["payloads"] = PayloadPool::instance().toJson();
+	return j;
 }
 
 
 bool Controller::sendTimeSyncMessage(long after)
 {
-	static long lastTimeSync(0);
+	/// shared by all zones, the time difference is the same for all of them
+	static std::atomic<long> lastTimeSync(0);
 	long now = chronos::getTickCount();
-	if (lastTimeSync + after > now)
+	long last = lastTimeSync;
+	if ((last + after > now) || !lastTimeSync.compare_exchange_strong(last, now))
 		return false;
 
-	lastTimeSync = now;
 	msg::Time timeReq;
 	clientConnection_->send(&timeReq);
 	return true;
 }
 
 
-void Controller::start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency)
+void Controller::timeSync()
+{
+	/// Keep "pipeline" time requests in flight until the time difference is known within syncTarget_
+	const size_t pipeline = 4;
+	const size_t minReplies = 8;
+	const size_t maxReplies = 50;
+	const chronos::msec requestTimeout(500);
+	const chronos::msec maxDuration(5000);
+
+	/// shared with the response handlers, which might outlive this call
+	struct SyncState
+	{
+		SyncState() : replies(0), inFlight(0) {}
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t replies;
+		size_t inFlight;
+	};
+	shared_ptr<SyncState> state = make_shared<SyncState>();
+	ResponseHandler onReply = [state](shared_ptr<msg::SerializedMessage> response)
+	{
+		msg::Time reply;
+		reply.deserialize(response->message, response->buffer);
+		TimeProvider::getInstance().setDiff(reply.latency, reply.received - reply.sent);
+		std::lock_guard<std::mutex> lock(state->mutex);
+		++state->replies;
+		--state->inFlight;
+		state->cv.notify_one();
+	};
+
+	msg::Time timeReq;
+	std::deque<std::pair<shared_ptr<PendingRequest>, chronos::time_point_clk>> requests;
+	chronos::time_point_clk start = chronos::clk::now();
+	std::unique_lock<std::mutex> lock(state->mutex);
+	while (active_)
+	{
+		throwAsyncException();
+
+		if ((state->replies >= minReplies) && (TimeProvider::getInstance().getOffsetUncertainty() <= syncTarget_))
+			break;
+		chronos::time_point_clk now = chronos::clk::now();
+		if ((state->replies >= maxReplies) || (now - start > maxDuration))
+		{
+			LOG(WARNING) << "Time sync did not converge to " << syncTarget_ << " us\n";
+			break;
+		}
+
+		/// a lost reply does not block the sync: expire the request and send another one
+		while (!requests.empty() && (now - requests.front().second > requestTimeout))
+		{
+			if (clientConnection_->cancelRequest(requests.front().first))
+			{
+				LOG(DEBUG) << "Time sync request " << requests.front().first->id << " timed out\n";
+				--state->inFlight;
+			}
+			requests.pop_front();
+		}
+
+		while (state->inFlight < pipeline)
+		{
+			++state->inFlight;
+			requests.push_back(make_pair(clientConnection_->sendRequestAsync(&timeReq, onReply), now));
+		}
+		state->cv.wait_for(lock, chronos::msec(20));
+	}
+	lock.unlock();
+
+	for (auto& request: requests)
+		clientConnection_->cancelRequest(request.first);
+
+	LOG(INFO) << "diff to server [ms]: " << (float)TimeProvider::getInstance().getDiffToServer<chronos::usec>().count() / 1000.f
+		<< " +/- " << TimeProvider::getInstance().getOffsetUncertainty() / 1000. << ", replies: " << state->replies
+		<< ", duration [ms]: " << chrono::duration_cast<chronos::msec>(chronos::clk::now() - start).count() << "\n";
+}
+
+
+void Controller::start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency, size_t syncTarget, size_t maxBufferMs)
 {
 	pcmDevice_ = pcmDevice;
 	latency_ = latency;
+	syncTarget_ = syncTarget;
+	maxBufferMs_ = maxBufferMs;
+	host_ = host;
 	clientConnection_.reset(new ClientConnection(this, host, port));
+	active_ = true;
+	decodeThread_ = thread(&Controller::decodeWorker, this);
 	controllerThread_ = thread(&Controller::worker, this);
 }
 
@@ -182,6 +433,13 @@ void Controller::stop()
 	active_ = false;
 	controllerThread_.join();
 	clientConnection_->stop();
+	timeClient_.reset();
+	/// after the connection, so that no more chunks are enqueued
+	{
+		std::lock_guard<std::mutex> lock(decodeMutex_);
+	}
+	decodeCv_.notify_one();
+	decodeThread_.join();
 }
 
 
@@ -200,40 +458,26 @@ void Controller::worker()
 				hostId_ = ::getHostId(macAddress);
 
 			/// Say hello to the server
-			msg::Hello hello(macAddress, hostId_, instance_);
+			msg::Hello hello(macAddress, hostId_, instance_, codec_);
 			clientConnection_->send(&hello);
 
-			/// Do initial time sync with the server
-			msg::Time timeReq;
-			for (size_t n=0; n<50 && active_; ++n)
-			{
-				if (async_exception_)
-				{
-					LOG(DEBUG) << "Async exception: " << async_exception_->what() << "\n";
-					throw SnapException(async_exception_->what());
-				}
-
-				shared_ptr<msg::Time> reply = clientConnection_->sendReq<msg::Time>(&timeReq, chronos::msec(2000));
-				if (reply)
-				{
-					TimeProvider::getInstance().setDiff(reply->latency, reply->received - reply->sent);
-					chronos::usleep(100);
-				}
-			}
-			LOG(INFO) << "diff to server [ms]: " << (float)TimeProvider::getInstance().getDiffToServer<chronos::usec>().count() / 1000.f << "\n";
+			/// Do initial time sync with the server, unless another zone keeps it up to date
+			if (TimeProvider::getInstance().isSynced(syncTarget_))
+				LOG(INFO) << "Time is in sync, skipping the initial time sync\n";
+			else
+				timeSync();
 
 			/// Main loop
+			size_t loops(0);
 			while (active_)
 			{
 				LOG(DEBUG) << "Main loop\n";
+				if (++loops % 10 == 0)
+					LOG(DEBUG) << "Decoder metrics: " << getMetrics().dump() << "\n";
 				for (size_t n=0; n<10 && active_; ++n)
 				{
 					chronos::sleep(100);
-					if (async_exception_)
-					{
-						LOG(DEBUG) << "Async exception: " << async_exception_->what() << "\n";
-						throw SnapException(async_exception_->what());
-					}
+					throwAsyncException();
 				}
 
 				if (sendTimeSyncMessage(5000))
@@ -242,12 +486,12 @@ void Controller::worker()
 		}
 		catch (const std::exception& e)
 		{
-			async_exception_ = nullptr;
+			setAsyncException(nullptr);
 			SLOG(ERROR) << "Exception in Controller::worker(): " << e.what() << endl;
 			clientConnection_->stop();
-			player_.reset();
-			stream_.reset();
-			decoder_.reset();
+			timeClient_.reset();
+			/// the decode thread owns the player, it's reset after the pending chunks
+			enqueue(nullptr, nullptr);
 			for (size_t n=0; (n<10) && active_; ++n)
 				chronos::sleep(100);
 		}
@@ -21,11 +21,17 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "decoder/decoder.h"
 #include "message/message.h"
 #include "message/serverSettings.h"
 #include "message/streamTags.h"
 #include "player/pcmDevice.h"
+#include "player/filePlayer.h"
+#include "common/spscQueue.h"
+#include "common/latencyHistogram.h"
 #ifdef HAS_ALSA
 #include "player/alsaPlayer.h"
 #elif HAS_OPENSL
@@ -34,6 +40,7 @@
 #include "player/coreAudioPlayer.h"
 #endif
 #include "clientConnection.h"
+#include "timeClient.h"
 #include "stream.h"
 #include "metadata.h"
 
@@ -44,34 +51,69 @@
  * Sets up the audio decoder and player. 
  * Decodes audio (message_type::kWireChunk) and feeds PCM to the audio stream buffer
  * Does timesync with the server
+ *
+ * Several Controllers (zones) can run in one process, each with its own
+ * connection, instance id and player. They share the TimeProvider: the UDP
+ * time sync runs once per server and the initial time sync is skipped, if
+ * another zone keeps the time difference up to date.
+ *
+ * The connection's reader thread only handles the time and control messages,
+ * codec headers and chunks are passed to the decode thread, so that a slow
+ * decoder doesn't delay reading from the socket and the time sync replies.
  */
 class Controller : public MessageReceiver
 {
 public:
-	Controller(const std::string& clientId, size_t instance, std::shared_ptr<MetadataAdapter> meta);
-	void start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency);
+	/// codec: preferred transport codec, empty for the stream's default
+	Controller(const std::string& clientId, size_t instance, const std::string& codec, std::shared_ptr<MetadataAdapter> meta);
+	/// syncTarget: the initial time sync is done when the time difference to the server is known within [us]
+	/// maxBufferMs: capacity of the stream's jitter buffer
+	void start(const PcmDevice& pcmDevice, const std::string& host, size_t port, int latency, size_t syncTarget = 500, size_t maxBufferMs = 10000);
 	void stop();
 
 	/// Implementation of MessageReceiver.
 	/// ClientConnection passes messages from the server through these callbacks
 	virtual void onMessageReceived(ClientConnection* connection, const msg::BaseMessage& baseMessage, char* buffer);
+	virtual void onChunkReceived(ClientConnection* connection, msg::PcmChunk* chunk);
 
 	/// Implementation of MessageReceiver.
 	/// Used for async exception reporting
 	virtual void onException(ClientConnection* connection, shared_exception_ptr exception);
 
+	/// Decode stage: queue depth, queue and decode latency, dropped chunks and the audio buffered for playback
+	nlohmann::json getMetrics() const;
+
 private:
 	void worker();
+	/// Decodes the enqueued chunks, runs in decodeThread_
+	void decodeWorker();
+	/// Passes a chunk, codec header or (both empty) a reset of the player to the decode thread
+	void enqueue(msg::PcmChunk* chunk, const std::shared_ptr<msg::CodecHeader>& header);
+	/// Sets up decoder, stream and player for a new codec header. Only called by the decode thread
+	void setHeader(const std::shared_ptr<msg::CodecHeader>& header);
+	void decode(msg::PcmChunk* chunk);
+	void resetPlayer();
+	void timeSync();
 	bool sendTimeSyncMessage(long after = 1000);
+	/// Exceptions of the connection's reader thread and of the decode thread, handled by the worker
+	void setAsyncException(const shared_exception_ptr& exception);
+	/// Throws the pending async exception, if there is one
+	void throwAsyncException();
 	std::string hostId_;
 	std::string meta_callback_;
 	size_t instance_;
+	std::string codec_;
 	std::atomic<bool> active_;
 	std::thread controllerThread_;
 	SampleFormat sampleFormat_;
 	PcmDevice pcmDevice_;
 	int latency_;
+	size_t syncTarget_;
+	size_t maxBufferMs_;
+	std::string host_;
 	std::unique_ptr<ClientConnection> clientConnection_;
+	/// Time sync over the server's UDP time sync port, if the server has one. Shared with the other zones
+	std::shared_ptr<TimeClient> timeClient_;
 	std::shared_ptr<Stream> stream_;
 	std::unique_ptr<Decoder> decoder_;
 	std::unique_ptr<Player> player_;
@@ -79,8 +121,34 @@ private:
 	std::shared_ptr<msg::ServerSettings> serverSettings_;
 	std::shared_ptr<msg::StreamTags> streamTags_;
 	std::shared_ptr<msg::CodecHeader> headerChunk_;
-	std::mutex receiveMutex_;
+	/// Sequence number of the last received chunk, to detect lost or reordered chunks (protocol version 2)
+	uint64_t lastChunkSequence_;
+	std::atomic<uint64_t> lostChunks_;
+	/// Guards serverSettings_, and stream_ and player_ against their replacement by the decode thread
+	mutable std::mutex playerMutex_;
+
+	/// A received chunk or codec header that waits to be decoded
+	struct DecodeItem
+	{
+		msg::PcmChunk* chunk;
+		std::shared_ptr<msg::CodecHeader> header;
+		std::chrono::steady_clock::time_point enqueued;
+	};
+
+	/// Reader => decoder. decoder_ and headerChunk_ are only accessed by the decode thread
+	/// The worker thread enqueues the player reset, when the reader thread has been stopped
+	SpscQueue<DecodeItem> decodeQueue_;
+	/// Only to wake up the decode thread, the queue is lock-free
+	std::mutex decodeMutex_;
+	std::condition_variable decodeCv_;
+	std::thread decodeThread_;
+	/// Queue: wait for the decoder, decode: decoding and adding the chunk to the stream
+	LatencyHistogram queueLatency_;
+	LatencyHistogram decodeLatency_;
+	/// Chunks dropped, because the decoder didn't keep up
+	std::atomic<uint64_t> overruns_;
 
+	std::mutex asyncExceptionMutex_;
 	shared_exception_ptr async_exception_;
 };
 
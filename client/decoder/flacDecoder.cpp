@@ -16,12 +16,14 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cmath>
 #include "flacDecoder.h"
+#include "common/payloadPool.h"
 #include "common/snapException.h"
-#include "common/endian.hpp"
+#include "common/sampleConversion.h"
 #include "aixlog.hpp"
 
 
@@ -34,25 +36,22 @@ static void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__St
 static void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
 
 
-static msg::CodecHeader* flacHeader = NULL;
-static msg::PcmChunk* flacChunk = NULL;
-static msg::PcmChunk* pcmChunk = NULL;
-static SampleFormat sampleFormat;
-static FLAC__StreamDecoder *decoder = NULL;
 
-
-
-FlacDecoder::FlacDecoder() : Decoder(), lastError_(nullptr)
+FlacDecoder::FlacDecoder() : Decoder(), decoder_(NULL), flacHeader_(NULL), flacChunkPos_(0), pcmChunk_(NULL), lastError_(nullptr)
 {
-	flacChunk = new msg::PcmChunk();
+	flacChunk_ = new msg::PcmChunk();
 }
 
 
 FlacDecoder::~FlacDecoder()
 {
 	std::lock_guard<std::mutex> lock(mutex_);
-	delete flacChunk;
-	delete decoder;
+	if (decoder_ != NULL)
+	{
+		FLAC__stream_decoder_finish(decoder_);
+		FLAC__stream_decoder_delete(decoder_);
+	}
+	delete flacChunk_;
 }
 
 
@@ -60,16 +59,17 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 	cacheInfo_.reset();
-	pcmChunk = chunk;
-	flacChunk->payload = (char*)realloc(flacChunk->payload, chunk->payloadSize);
-	memcpy(flacChunk->payload, chunk->payload, chunk->payloadSize);
-	flacChunk->payloadSize = chunk->payloadSize;
-
-	pcmChunk->payload = (char*)realloc(pcmChunk->payload, 0);
-	pcmChunk->payloadSize = 0;
-	while (flacChunk->payloadSize > 0)
+	pcmChunk_ = chunk;
+	/// Take over the encoded payload instead of copying it. The decoded chunk gets
+	/// the consumed buffer of the previous chunk, which is usually large enough
+	std::swap(flacChunk_->payload, chunk->payload);
+	flacChunk_->payloadSize = chunk->payloadSize;
+	flacChunkPos_ = 0;
+
+	pcmChunk_->payloadSize = 0;
+	while (flacChunkPos_ < flacChunk_->payloadSize)
 	{
-		if (!FLAC__stream_decoder_process_single(decoder))
+		if (!FLAC__stream_decoder_process_single(decoder_))
 		{
 			return false;
 		}
@@ -97,109 +97,85 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 
 SampleFormat FlacDecoder::setHeader(msg::CodecHeader* chunk)
 {
-	flacHeader = chunk;
+	flacHeader_ = chunk;
 	FLAC__StreamDecoderInitStatus init_status;
 
-	if ((decoder = FLAC__stream_decoder_new()) == NULL)
+	if ((decoder_ = FLAC__stream_decoder_new()) == NULL)
 		throw SnapException("ERROR: allocating decoder");
 
-//	(void)FLAC__stream_decoder_set_md5_checking(decoder, true);
-	init_status = FLAC__stream_decoder_init_stream(decoder, read_callback, NULL, NULL, NULL, NULL, write_callback, metadata_callback, error_callback, this);
+//	(void)FLAC__stream_decoder_set_md5_checking(decoder_, true);
+	init_status = FLAC__stream_decoder_init_stream(decoder_, ::read_callback, NULL, NULL, NULL, NULL, ::write_callback, ::metadata_callback, ::error_callback, this);
 	if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK)
 		throw SnapException("ERROR: initializing decoder: " + string(FLAC__StreamDecoderInitStatusString[init_status]));
 
-	sampleFormat.rate = 0;
-	FLAC__stream_decoder_process_until_end_of_metadata(decoder);
-	if (sampleFormat.rate == 0)
+	sampleFormat_.rate = 0;
+	FLAC__stream_decoder_process_until_end_of_metadata(decoder_);
+	if (sampleFormat_.rate == 0)
 		throw SnapException("Sample format not found");
 
-	return sampleFormat;
+	return sampleFormat_;
 }
 
 
-FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+FLAC__StreamDecoderReadStatus FlacDecoder::read_callback(FLAC__byte buffer[], size_t *bytes)
 {
-	if (flacHeader != NULL)
+	if (flacHeader_ != NULL)
 	{
-		*bytes = flacHeader->payloadSize;
-		memcpy(buffer, flacHeader->payload, *bytes);
-		flacHeader = NULL;
+		*bytes = flacHeader_->payloadSize;
+		memcpy(buffer, flacHeader_->payload, *bytes);
+		flacHeader_ = NULL;
 	}
-	else if (flacChunk != NULL)
+	else
 	{
-//		cerr << "read_callback: " << *bytes << ", avail: " << flacChunk->payloadSize << "\n";
-		static_cast<FlacDecoder*>(client_data)->cacheInfo_.isCachedChunk_ = false;
-		if (*bytes > flacChunk->payloadSize)
-			*bytes = flacChunk->payloadSize;
+//		cerr << "read_callback: " << *bytes << ", avail: " << flacChunk_->payloadSize - flacChunkPos_ << "\n";
+		cacheInfo_.isCachedChunk_ = false;
+		if (*bytes > flacChunk_->payloadSize - flacChunkPos_)
+			*bytes = flacChunk_->payloadSize - flacChunkPos_;
 
 //		if (*bytes == 0)
 //			return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
 
-		memcpy(buffer, flacChunk->payload, *bytes);
-		memmove(flacChunk->payload, flacChunk->payload + *bytes, flacChunk->payloadSize - *bytes);
-		flacChunk->payloadSize = flacChunk->payloadSize - *bytes;
-		flacChunk->payload = (char*)realloc(flacChunk->payload, flacChunk->payloadSize);
+		memcpy(buffer, flacChunk_->payload + flacChunkPos_, *bytes);
+		flacChunkPos_ += *bytes;
 	}
 	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
 
 
-FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+FLAC__StreamDecoderWriteStatus FlacDecoder::write_callback(const FLAC__Frame *frame, const FLAC__int32 * const buffer[])
 {
-	(void)decoder;
-
-	if (pcmChunk != NULL)
+	if (pcmChunk_ != NULL)
 	{
-		size_t bytes = frame->header.blocksize * sampleFormat.frameSize;
+		size_t bytes = frame->header.blocksize * sampleFormat_.frameSize;
 
-		FlacDecoder* flacDecoder = static_cast<FlacDecoder*>(client_data);
-		if (flacDecoder->cacheInfo_.isCachedChunk_)
-			flacDecoder->cacheInfo_.cachedBlocks_ += frame->header.blocksize;
+		if (cacheInfo_.isCachedChunk_)
+			cacheInfo_.cachedBlocks_ += frame->header.blocksize;
 
-		pcmChunk->payload = (char*)realloc(pcmChunk->payload, pcmChunk->payloadSize + bytes);
+		pcmChunk_->payload = PayloadPool::instance().reallocate(pcmChunk_->payload, pcmChunk_->payloadSize + bytes);
 
-		for (size_t channel = 0; channel < sampleFormat.channels; ++channel)
+		for (size_t channel = 0; channel < sampleFormat_.channels; ++channel)
 		{
 			if (buffer[channel] == NULL)
 			{
 				SLOG(ERROR) << "ERROR: buffer[" << channel << "] is NULL\n";
 				return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 			}
-			
-			if (sampleFormat.sampleSize == 1)
-			{
-				int8_t* chunkBuffer = (int8_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = (int8_t)(buffer[channel][i]);
-			}
-			else if (sampleFormat.sampleSize == 2)
-			{
-				int16_t* chunkBuffer = (int16_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = SWAP_16((int16_t)(buffer[channel][i]));
-			}
-			else if (sampleFormat.sampleSize == 4)
-			{
-				int32_t* chunkBuffer = (int32_t*)(pcmChunk->payload + pcmChunk->payloadSize);
-				for (size_t i = 0; i < frame->header.blocksize; i++)
-					chunkBuffer[sampleFormat.channels*i + channel] = SWAP_32((int32_t)(buffer[channel][i]));
-			}
 		}
-		pcmChunk->payloadSize += bytes;
+		sample::interleave(buffer, pcmChunk_->payload + pcmChunk_->payloadSize, frame->header.blocksize, sampleFormat_);
+		pcmChunk_->payloadSize += bytes;
 	}
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
 
-void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
+void FlacDecoder::metadata_callback(const FLAC__StreamMetadata *metadata)
 {
-	(void)decoder;
 	/* print some stats */
 	if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
 	{
-		static_cast<FlacDecoder*>(client_data)->cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
-		sampleFormat.setFormat(
+		cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
+		sampleFormat_.setFormat(
 			metadata->data.stream_info.sample_rate,
 			metadata->data.stream_info.bits_per_sample,
 			metadata->data.stream_info.channels);
@@ -207,11 +183,10 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 }
 
 
-void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+void FlacDecoder::error_callback(FLAC__StreamDecoderErrorStatus status)
 {
-	(void)decoder, (void)client_data;
 	SLOG(ERROR) << "Got error callback: " << FLAC__StreamDecoderErrorStatusString[status] << "\n";
-	static_cast<FlacDecoder*>(client_data)->lastError_ = std::unique_ptr<FLAC__StreamDecoderErrorStatus>(new FLAC__StreamDecoderErrorStatus(status));
+	lastError_ = std::unique_ptr<FLAC__StreamDecoderErrorStatus>(new FLAC__StreamDecoderErrorStatus(status));
 
 	/// TODO, see issue #120:
 	// Thu Nov 10 07:26:44 2016 daemon.warn dnsmasq-dhcp[1194]: no address range available for DHCP request via wlan0
@@ -225,6 +200,32 @@ void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderError
 }
 
 
+FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+	(void)decoder;
+	return static_cast<FlacDecoder*>(client_data)->read_callback(buffer, bytes);
+}
+
+
+FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
+{
+	(void)decoder;
+	return static_cast<FlacDecoder*>(client_data)->write_callback(frame, buffer);
+}
+
+
+void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
+{
+	(void)decoder;
+	static_cast<FlacDecoder*>(client_data)->metadata_callback(metadata);
+}
+
+
+void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+	(void)decoder;
+	static_cast<FlacDecoder*>(client_data)->error_callback(status);
+}
 
 
 
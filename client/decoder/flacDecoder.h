@@ -46,6 +46,12 @@ struct CacheInfo
 };
 
 
+/// FLAC decoder
+/**
+ * All decoding state is per instance, the libFLAC callbacks are forwarded to
+ * the instance passed as client data, so that several decoders can be used in
+ * one process (e.g. one per zone).
+ */
 class FlacDecoder : public Decoder
 {
 public:
@@ -54,6 +60,22 @@ public:
 	virtual bool decode(msg::PcmChunk* chunk);
 	virtual SampleFormat setHeader(msg::CodecHeader* chunk);
 
+	/// libFLAC callbacks
+	FLAC__StreamDecoderReadStatus read_callback(FLAC__byte buffer[], size_t *bytes);
+	FLAC__StreamDecoderWriteStatus write_callback(const FLAC__Frame *frame, const FLAC__int32 * const buffer[]);
+	void metadata_callback(const FLAC__StreamMetadata *metadata);
+	void error_callback(FLAC__StreamDecoderErrorStatus status);
+
+private:
+	FLAC__StreamDecoder* decoder_;
+	SampleFormat sampleFormat_;
+	/// Codec header, until it has been read by the decoder
+	msg::CodecHeader* flacHeader_;
+	/// The encoded chunk and the read position in it
+	msg::PcmChunk* flacChunk_;
+	size_t flacChunkPos_;
+	/// The chunk that is being decoded
+	msg::PcmChunk* pcmChunk_;
 	CacheInfo cacheInfo_;
 	std::unique_ptr<FLAC__StreamDecoderErrorStatus> lastError_;
 };
@@ -21,8 +21,9 @@
 #include <cmath>
 
 #include "oggDecoder.h"
+#include "common/payloadPool.h"
 #include "common/snapException.h"
-#include "common/endian.hpp"
+#include "common/sampleConversion.h"
 #include "aixlog.hpp"
 
 
@@ -103,49 +104,13 @@ bool OggDecoder::decode(msg::PcmChunk* chunk)
 			while ((samples = vorbis_synthesis_pcmout(&vd, &pcm)) > 0)
 			{
 				size_t bytes = sampleFormat_.sampleSize * vi.channels * samples;
-				chunk->payload = (char*)realloc(chunk->payload, chunk->payloadSize + bytes);
-				for (int channel = 0; channel < vi.channels; ++channel)
-				{
-					if (sampleFormat_.sampleSize == 1)
-					{
-						int8_t* chunkBuffer = (int8_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int8_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
-#ifdef HAS_TREMOR
-							val = clip<int8_t>(pcm[channel][i], -128, 127);
-#else
-							val = clip<int8_t>(floor(pcm[channel][i]*127.f + .5f), -128, 127);
-#endif
-						}
-					}
-					else if (sampleFormat_.sampleSize == 2)
-					{
-						int16_t* chunkBuffer = (int16_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int16_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
+				chunk->payload = PayloadPool::instance().reallocate(chunk->payload, chunk->payloadSize + bytes);
 #ifdef HAS_TREMOR
-							val = SWAP_16(clip<int16_t>(pcm[channel][i] >> 9, -32768, 32767));
+				/// Tremor's samples are fixed point with 24 fractional bits
+				sample::interleave(pcm, chunk->payload + chunk->payloadSize, samples, sampleFormat_, 25 - sampleFormat_.bits);
 #else
-							val = SWAP_16(clip<int16_t>(floor(pcm[channel][i]*32767.f + .5f), -32768, 32767));
+				sample::interleave(pcm, chunk->payload + chunk->payloadSize, samples, sampleFormat_);
 #endif
-						}
-					}
-					else if (sampleFormat_.sampleSize == 4)
-					{
-						int32_t* chunkBuffer = (int32_t*)(chunk->payload + chunk->payloadSize);
-						for (int i = 0; i < samples; i++)
-						{
-							int32_t& val = chunkBuffer[sampleFormat_.channels*i + channel];
-#ifdef HAS_TREMOR
-							val = SWAP_32(clip<int32_t>(pcm[channel][i] << 7, -2147483648, 2147483647));
-#else
-							val = SWAP_32(clip<int32_t>(floor(pcm[channel][i]*2147483647.f + .5f), -2147483648, 2147483647));
-#endif
-						}
-					}
-				}
 
 				chunk->payloadSize += bytes;
 				vorbis_synthesis_read(&vd, samples);
@@ -36,13 +36,6 @@ public:
 
 private:
 	bool decodePayload(msg::PcmChunk* chunk);
-	template <typename T>
-	T clip(const T& value, const T& lower, const T& upper) const
-	{
-		if (value > upper) return upper;
-		if (value < lower) return lower;
-		return value;
-	}
 
 	ogg_sync_state   oy; /// sync and verify incoming physical bitstream
 	ogg_stream_state os; /// take physical pages, weld into a logical stream of packets
@@ -0,0 +1,98 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <cstring>
+
+#include "opusDecoder.h"
+#include "common/payloadPool.h"
+#include "common/snapException.h"
+#include "common/sampleConversion.h"
+#include "aixlog.hpp"
+
+
+using namespace std;
+
+
+OpusStreamDecoder::OpusStreamDecoder() : Decoder(), decoder_(NULL)
+{
+}
+
+
+OpusStreamDecoder::~OpusStreamDecoder()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (decoder_ != NULL)
+		opus_decoder_destroy(decoder_);
+}
+
+
+bool OpusStreamDecoder::decode(msg::PcmChunk* chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	packet_.assign(chunk->payload, chunk->payload + chunk->payloadSize);
+	int frames = opus_packet_get_nb_samples(packet_.data(), packet_.size(), sampleFormat_.rate);
+	if (frames < 0)
+	{
+		LOG(ERROR) << "Invalid opus packet: " << opus_strerror(frames) << "\n";
+		return false;
+	}
+
+	/// decode into the chunk's payload
+	chunk->payload = PayloadPool::instance().reallocate(chunk->payload, frames * sampleFormat_.frameSize);
+	int16_t* pcm = (int16_t*)chunk->payload;
+	int decoded = opus_decode(decoder_, packet_.data(), packet_.size(), pcm, frames, 0);
+	if (decoded < 0)
+	{
+		LOG(ERROR) << "Failed to decode opus packet: " << opus_strerror(decoded) << "\n";
+		chunk->payloadSize = 0;
+		return false;
+	}
+
+	sample::toLittleEndian(pcm, decoded * sampleFormat_.channels, sizeof(int16_t));
+	chunk->payloadSize = decoded * sampleFormat_.frameSize;
+	chunk->timestamp = chunk->timestamp - preSkip_;
+	return true;
+}
+
+
+SampleFormat OpusStreamDecoder::setHeader(msg::CodecHeader* chunk)
+{
+	/// "OpusHead" identification header (RFC 7845, 5.1), little endian
+	if ((chunk->payloadSize < 19) || (memcmp(chunk->payload, "OpusHead", 8) != 0))
+		throw SnapException("Not an opus header");
+
+	const unsigned char* head = (const unsigned char*)chunk->payload;
+	uint16_t channels = head[9];
+	uint16_t preSkip = head[10] | (head[11] << 8);
+	uint32_t rate = head[12] | (head[13] << 8) | (head[14] << 16) | ((uint32_t)head[15] << 24);
+
+	/// always decoded to 16 bit
+	sampleFormat_ = SampleFormat(rate, 16, channels);
+
+	int error;
+	decoder_ = opus_decoder_create(sampleFormat_.rate, sampleFormat_.channels, &error);
+	if (error != OPUS_OK)
+		throw SnapException("failed to init opus decoder: " + string(opus_strerror(error)));
+
+	double diffMs = preSkip / ((double)sampleFormat_.rate / 1000.);
+	preSkip_ = tv(0, diffMs * 1000);
+	LOG(DEBUG) << "Opus rate: " << rate << ", channels: " << channels << ", pre-skip: " << preSkip << " frames (" << diffMs << "ms)\n";
+	return sampleFormat_;
+}
+
@@ -0,0 +1,50 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef OPUS_DECODER_H
+#define OPUS_DECODER_H
+#include "decoder.h"
+#include <vector>
+#include <opus/opus.h>
+
+
+/// Decodes the Opus packets of OpusStreamEncoder
+/**
+ * Named OpusStreamDecoder, as libopus already defines "OpusDecoder".
+ * One chunk is one Opus packet. The decoded audio is delayed by the encoder's
+ * lookahead (the "pre-skip" of the header), the chunk's timestamp is shifted
+ * accordingly.
+ */
+class OpusStreamDecoder : public Decoder
+{
+public:
+	OpusStreamDecoder();
+	virtual ~OpusStreamDecoder();
+	virtual bool decode(msg::PcmChunk* chunk);
+	virtual SampleFormat setHeader(msg::CodecHeader* chunk);
+
+private:
+	OpusDecoder* decoder_;
+	std::vector<unsigned char> packet_;
+	SampleFormat sampleFormat_;
+	tv preSkip_;
+};
+
+
+#endif
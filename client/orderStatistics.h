@@ -0,0 +1,309 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef ORDER_STATISTICS_H
+#define ORDER_STATISTICS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/// Sliding window with order statistics
+/**
+ * Keeps the last "size" values, the oldest value is evicted when a new one is added.
+ * Basic statistic functions: median, percentile, mean and trimmed mean.
+ * The values are additionally kept sorted in an indexable skiplist, i.e. every
+ * link knows how many values it skips, so that adding, evicting and looking
+ * up the k-th smallest value are O(log n) instead of sorting the window per query.
+ * The nodes are preallocated, adding a value does not allocate.
+ */
+template <class T>
+class OrderStatistics
+{
+public:
+	OrderStatistics(size_t size = 10) : first_(0), count_(0), sum_(0.), levels_(0), random_(0x9e3779b9)
+	{
+		setSize(size);
+	}
+
+	void add(const T& value)
+	{
+		if (count_ == ring_.size())
+		{
+			remove(ring_[first_]);
+			first_ = (first_ + 1) % ring_.size();
+			--count_;
+		}
+		ring_[(first_ + count_) % ring_.size()] = value;
+		++count_;
+		insert(value);
+	}
+
+	/// Median as mean over "mean" values around the median
+	T median(unsigned int mean = 1) const
+	{
+		if (count_ == 0)
+			return 0;
+		if ((mean <= 1) || (count_ < mean))
+			return at(count_ / 2);
+		return sum(count_ / 2 - mean / 2, mean) / mean;
+	}
+
+	double mean() const
+	{
+		if (count_ == 0)
+			return 0;
+		return sum_ / count_;
+	}
+
+	/// Mean without the "trim" percent smallest and the "trim" percent largest values
+	double trimmedMean(unsigned int trim) const
+	{
+		if (count_ == 0)
+			return 0;
+		size_t cut = count_ * trim / 100;
+		if (2 * cut >= count_)
+			return median();
+		return (double)sum(cut, count_ - 2 * cut) / (count_ - 2 * cut);
+	}
+
+	T percentile(unsigned int percentile) const
+	{
+		if (count_ == 0)
+			return 0;
+		size_t index = count_ * percentile / 100;
+		return at((index < count_) ? index : count_ - 1);
+	}
+
+	/// k-th smallest value, k < size()
+	T at(size_t k) const
+	{
+		return value_[find(k)];
+	}
+
+	inline bool full() const
+	{
+		return (count_ == ring_.size());
+	}
+
+	void clear()
+	{
+		first_ = 0;
+		count_ = 0;
+		sum_ = 0.;
+		free_.clear();
+		for (uint32_t node = (uint32_t)ring_.size(); node > kHead; --node)
+			free_.push_back(node);
+		for (size_t level = 0; level < levels_; ++level)
+		{
+			next(kHead, level) = kNil;
+			width(kHead, level) = 1;
+		}
+	}
+
+	inline size_t size() const
+	{
+		return count_;
+	}
+
+	inline bool empty() const
+	{
+		return (count_ == 0);
+	}
+
+	/// The newest values are kept
+	void setSize(size_t size)
+	{
+		if (size == 0)
+			size = 1;
+		std::vector<T> values;
+		values.reserve(count_);
+		for (size_t n = 0; n < count_; ++n)
+			values.push_back(ring_[(first_ + n) % ring_.size()]);
+
+		levels_ = 1;
+		while ((levels_ < 32) && ((size_t)1 << levels_) <= size)
+			++levels_;
+		ring_.assign(size, T());
+		value_.assign(size + 1, T());
+		level_.assign(size + 1, 0);
+		/// the links of a node are set when it is inserted, the head's by clear()
+		next_.assign((size + 1) * levels_, 0);
+		width_.assign((size + 1) * levels_, 0);
+		free_.reserve(size);
+		clear();
+
+		size_t skip = (values.size() > size) ? values.size() - size : 0;
+		for (size_t n = skip; n < values.size(); ++n)
+			add(values[n]);
+	}
+
+private:
+	static const uint32_t kHead = 0;
+	static const uint32_t kNil = 0xffffffff;
+
+	inline uint32_t& next(uint32_t node, size_t level)
+	{
+		return next_[node * levels_ + level];
+	}
+
+	inline uint32_t next(uint32_t node, size_t level) const
+	{
+		return next_[node * levels_ + level];
+	}
+
+	/// Number of positions from "node" to its successor on "level". For the last node of
+	/// a level it reaches beyond the last value, so that lookups never follow a nil link
+	inline size_t& width(uint32_t node, size_t level)
+	{
+		return width_[node * levels_ + level];
+	}
+
+	inline size_t width(uint32_t node, size_t level) const
+	{
+		return width_[node * levels_ + level];
+	}
+
+	/// Geometric distribution with p = 1/2, xorshift is good enough
+	size_t randomLevel()
+	{
+		random_ ^= random_ << 13;
+		random_ ^= random_ >> 17;
+		random_ ^= random_ << 5;
+		size_t level = 1;
+		uint32_t bits = random_;
+		while ((level < levels_) && (bits & 1))
+		{
+			++level;
+			bits >>= 1;
+		}
+		return level;
+	}
+
+	void insert(const T& value)
+	{
+		uint32_t chain[32];
+		size_t steps[32];
+		uint32_t node = kHead;
+		for (size_t level = levels_; level-- > 0; )
+		{
+			steps[level] = 0;
+			while ((next(node, level) != kNil) && !(value < value_[next(node, level)]))
+			{
+				steps[level] += width(node, level);
+				node = next(node, level);
+			}
+			chain[level] = node;
+		}
+
+		uint32_t newNode = free_.back();
+		free_.pop_back();
+		value_[newNode] = value;
+		level_[newNode] = (uint8_t)randomLevel();
+		size_t distance = 0;
+		for (size_t level = 0; level < level_[newNode]; ++level)
+		{
+			uint32_t prev = chain[level];
+			next(newNode, level) = next(prev, level);
+			next(prev, level) = newNode;
+			width(newNode, level) = width(prev, level) - distance;
+			width(prev, level) = distance + 1;
+			distance += steps[level];
+		}
+		for (size_t level = level_[newNode]; level < levels_; ++level)
+			++width(chain[level], level);
+		sum_ += value;
+	}
+
+	/// Removes one node with "value", all nodes with the same value are interchangeable
+	void remove(const T& value)
+	{
+		uint32_t chain[32];
+		uint32_t node = kHead;
+		for (size_t level = levels_; level-- > 0; )
+		{
+			while ((next(node, level) != kNil) && (value_[next(node, level)] < value))
+				node = next(node, level);
+			chain[level] = node;
+		}
+
+		uint32_t oldNode = next(chain[0], 0);
+		for (size_t level = 0; level < level_[oldNode]; ++level)
+		{
+			uint32_t prev = chain[level];
+			width(prev, level) += width(oldNode, level) - 1;
+			next(prev, level) = next(oldNode, level);
+		}
+		for (size_t level = level_[oldNode]; level < levels_; ++level)
+			--width(chain[level], level);
+		free_.push_back(oldNode);
+		sum_ -= value;
+	}
+
+	/// Node of the k-th smallest value
+	uint32_t find(size_t k) const
+	{
+		/// the head is at position 0
+		uint32_t node = kHead;
+		size_t remaining = k + 1;
+		for (size_t level = levels_; level-- > 0; )
+		{
+			while (width(node, level) <= remaining)
+			{
+				remaining -= width(node, level);
+				node = next(node, level);
+			}
+		}
+		return node;
+	}
+
+	/// Sum of "count" values, starting with the k-th smallest
+	T sum(size_t k, size_t count) const
+	{
+		uint32_t node = find(k);
+		T result((T)0);
+		for (size_t n = 0; n < count; ++n)
+		{
+			result += value_[node];
+			node = next(node, 0);
+		}
+		return result;
+	}
+
+	/// Insertion order, to evict the oldest value
+	std::vector<T> ring_;
+	size_t first_;
+	size_t count_;
+	double sum_;
+
+	/// Skiplist nodes, node 0 is the head. Links and widths are stored per node and level
+	size_t levels_;
+	std::vector<T> value_;
+	std::vector<uint8_t> level_;
+	std::vector<uint32_t> next_;
+	std::vector<size_t> width_;
+	std::vector<uint32_t> free_;
+	uint32_t random_;
+};
+
+
+
+#endif
+
+
@@ -0,0 +1,159 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <cstring>
+#include <cstdlib>
+#include "pcmRing.h"
+
+using namespace std;
+
+
+PcmRing::PcmRing(const SampleFormat& format, size_t capacityMs) :
+	format_(format),
+	capacity_(format.rate * capacityMs / 1000),
+	readIndex_(0),
+	writeIndex_(0),
+	anchors_(anchorCapacity),
+	anchorHead_(0),
+	anchorTail_(0),
+	hasAnchor_(false)
+{
+	if (capacity_ == 0)
+		capacity_ = 1;
+	buffer_.resize(capacity_ * format_.frameSize);
+	lastAnchor_ = {0, 0};
+	anchor_ = {0, 0};
+}
+
+
+int64_t PcmRing::timeOf(const Anchor& anchor, uint64_t frame) const
+{
+	return anchor.time + (int64_t)((double)(frame - anchor.frame) * 1000000000. / format_.rate);
+}
+
+
+bool PcmRing::write(const char* data, size_t frames, const chronos::time_point_clk& start)
+{
+	uint64_t write = writeIndex_.value.load(memory_order_relaxed);
+	if (capacity_ - (write - readIndex_.value.load(memory_order_acquire)) < frames)
+		return false;
+
+	int64_t startNs = chrono::duration_cast<chronos::nsec>(start.time_since_epoch()).count();
+	if (!hasAnchor_ || (llabs(startNs - timeOf(lastAnchor_, write)) > anchorTolerance))
+	{
+		uint64_t tail = anchorTail_.load(memory_order_relaxed);
+		if (tail - anchorHead_.load(memory_order_acquire) >= anchorCapacity)
+			return false;
+		lastAnchor_ = {write, startNs};
+		hasAnchor_ = true;
+		anchors_[tail % anchorCapacity] = lastAnchor_;
+		anchorTail_.store(tail + 1, memory_order_release);
+	}
+
+	size_t pos = write % capacity_;
+	size_t first = (frames < capacity_ - pos) ? frames : capacity_ - pos;
+	memcpy(buffer_.data() + pos * format_.frameSize, data, first * format_.frameSize);
+	memcpy(buffer_.data(), data + first * format_.frameSize, (frames - first) * format_.frameSize);
+	writeIndex_.value.store(write + frames, memory_order_release);
+
+	/// take the lock, so that the notification can't get lost between the consumer's check and wait
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+	}
+	cv_.notify_all();
+	return true;
+}
+
+
+void PcmRing::copy(char* to, uint64_t from, size_t frames) const
+{
+	size_t pos = from % capacity_;
+	size_t first = (frames < capacity_ - pos) ? frames : capacity_ - pos;
+	memcpy(to, buffer_.data() + pos * format_.frameSize, first * format_.frameSize);
+	memcpy(to + first * format_.frameSize, buffer_.data(), (frames - first) * format_.frameSize);
+}
+
+
+size_t PcmRing::read(char* data, size_t frames)
+{
+	uint64_t read = readIndex_.value.load(memory_order_relaxed);
+	size_t available = writeIndex_.value.load(memory_order_acquire) - read;
+	if (frames > available)
+		frames = available;
+	copy(data, read, frames);
+	readIndex_.value.store(read + frames, memory_order_release);
+	return frames;
+}
+
+
+size_t PcmRing::skip(size_t frames)
+{
+	uint64_t read = readIndex_.value.load(memory_order_relaxed);
+	size_t available = writeIndex_.value.load(memory_order_acquire) - read;
+	if (frames > available)
+		frames = available;
+	readIndex_.value.store(read + frames, memory_order_release);
+	return frames;
+}
+
+
+void PcmRing::clear()
+{
+	uint64_t write = writeIndex_.value.load(memory_order_acquire);
+	readIndex_.value.store(write, memory_order_release);
+	adoptAnchors(write);
+}
+
+
+void PcmRing::adoptAnchors(uint64_t frame)
+{
+	uint64_t head = anchorHead_.load(memory_order_relaxed);
+	uint64_t tail = anchorTail_.load(memory_order_acquire);
+	while ((head != tail) && (anchors_[head % anchorCapacity].frame <= frame))
+	{
+		anchor_ = anchors_[head % anchorCapacity];
+		++head;
+	}
+	anchorHead_.store(head, memory_order_release);
+}
+
+
+chronos::time_point_clk PcmRing::time()
+{
+	uint64_t read = readIndex_.value.load(memory_order_relaxed);
+	adoptAnchors(read);
+	return chronos::time_point_clk(chrono::duration_cast<chronos::clk::duration>(chronos::nsec(timeOf(anchor_, read))));
+}
+
+
+size_t PcmRing::available() const
+{
+	uint64_t read = readIndex_.value.load(memory_order_acquire);
+	return writeIndex_.value.load(memory_order_acquire) - read;
+}
+
+
+bool PcmRing::waitFor(size_t frames, const chronos::msec& timeout) const
+{
+	if (frames > capacity_)
+		frames = capacity_;
+	std::unique_lock<std::mutex> lock(mutex_);
+	return cv_.wait_for(lock, timeout, [this, frames] { return (available() >= frames); });
+}
+
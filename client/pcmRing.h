@@ -0,0 +1,132 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "common/paddedAtomic.h"
+#include "common/sampleFormat.h"
+#include "common/timeDefs.h"
+
+
+/// Lock-free jitter buffer of decoded PCM frames
+/**
+ * Preallocated ring of "capacityMs" worth of frames for a single producer (the
+ * decoder) and a single consumer (the player). Frames are addressed by a
+ * continuous frame index, the consumer reads and skips arbitrary frame counts
+ * without waiting and without locks.
+ *
+ * Instead of a timestamp per chunk, the server time is kept as anchors
+ * "frame index => server time" in a small side ring. The time of a frame is
+ * extrapolated from the last anchor at or before it. A new anchor is only
+ * added if a chunk's timestamp doesn't continue the previous one, e.g. after
+ * a lost chunk or a resync of the server's stream.
+ * The read and write index are kept on separate cache lines by padding.
+ */
+class PcmRing
+{
+public:
+	PcmRing(const SampleFormat& format, size_t capacityMs);
+
+	/// Producer: appends "frames" frames, the first one is due at server time "start"
+	/// @return false if they don't fit, nothing is written then
+	bool write(const char* data, size_t frames, const chronos::time_point_clk& start);
+
+	/// Consumer: copies up to "frames" frames
+	/// @return number of frames read
+	size_t read(char* data, size_t frames);
+
+	/// Consumer: drops up to "frames" frames
+	/// @return number of frames dropped
+	size_t skip(size_t frames);
+
+	/// Consumer: drops all frames
+	void clear();
+
+	/// Consumer: server time of the next frame to read. Only valid if there is one
+	chronos::time_point_clk time();
+
+	/// Number of frames to read. A snapshot, can be called by any thread
+	size_t available() const;
+
+	bool empty() const
+	{
+		return (available() == 0);
+	}
+
+	/// Capacity in frames
+	size_t capacity() const
+	{
+		return capacity_;
+	}
+
+	/// Blocks up to "timeout" until at least "frames" frames are available
+	bool waitFor(size_t frames, const chronos::msec& timeout) const;
+
+private:
+	struct Anchor
+	{
+		uint64_t frame;
+		/// server time [ns since epoch]
+		int64_t time;
+	};
+
+	static const size_t anchorCapacity = 256;
+	/// A chunk starts a new anchor if its timestamp is off by more than [ns]
+	static const int64_t anchorTolerance = 50000;
+
+	/// Server time [ns] of "frame", extrapolated from "anchor"
+	int64_t timeOf(const Anchor& anchor, uint64_t frame) const;
+	/// Consumer: moves to the last anchor at or before "frame"
+	void adoptAnchors(uint64_t frame);
+	void copy(char* to, uint64_t from, size_t frames) const;
+
+	SampleFormat format_;
+	size_t capacity_;
+	std::vector<char> buffer_;
+	/// Next frame to read, written by the consumer
+	PaddedAtomic<uint64_t> readIndex_;
+	/// Next frame to write, written by the producer
+	PaddedAtomic<uint64_t> writeIndex_;
+
+	std::vector<Anchor> anchors_;
+	/// Next anchor to adopt, written by the consumer
+	std::atomic<uint64_t> anchorHead_;
+	/// Next anchor to write, written by the producer
+	std::atomic<uint64_t> anchorTail_;
+	/// Only accessed by the producer: the last written anchor
+	Anchor lastAnchor_;
+	bool hasAnchor_;
+	/// Only accessed by the consumer: the anchor of the next frame to read
+	Anchor anchor_;
+
+	/// Only to wake up a waiting consumer, reading and writing is lock-free
+	mutable std::mutex mutex_;
+	mutable std::condition_variable cv_;
+};
+
+
+#endif
+
+
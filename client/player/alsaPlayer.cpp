@@ -27,7 +27,7 @@
 using namespace std;
 
 AlsaPlayer::AlsaPlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream) : 
-	Player(pcmDevice, stream), handle_(NULL), buff_(NULL)
+	Player(pcmDevice, stream), handle_(NULL), buff_(NULL), mmap_(false)
 {
 }
 
@@ -59,7 +59,10 @@ void AlsaPlayer::initAlsa()
 		throw SnapException("Can't fill params: " + string(snd_strerror(pcm)));
 
 	/* Set parameters */
-	if ((pcm = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+	mmap_ = pcmDevice_.mmap && (snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
+	if (pcmDevice_.mmap && !mmap_)
+		LOG(WARNING) << "Device " << pcmDevice_.name << " doesn't support mmap access, using read/write access\n";
+	if (!mmap_ && ((pcm = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0))
 		throw SnapException("Can't set interleaved mode: " + string(snd_strerror(pcm)));
 
 	snd_pcm_format_t snd_pcm_format;
@@ -138,10 +141,14 @@ void AlsaPlayer::initAlsa()
 
 	/* Allocate buffer to hold single period */
 	snd_pcm_hw_params_get_period_size(params, &frames_, 0);
-	LOG(INFO) << "frames: " << frames_ << "\n";
+	LOG(INFO) << "frames: " << frames_ << ", mmap: " << mmap_ << "\n";
 
-	buff_size = frames_ * format.frameSize; //channels * 2 /* 2 -> sample size */;
-	buff_ = (char *) malloc(buff_size);
+	/// with mmap access the stream renders directly into the device's buffer
+	if (!mmap_)
+	{
+		buff_size = frames_ * format.frameSize; //channels * 2 /* 2 -> sample size */;
+		buff_ = (char *) malloc(buff_size);
+	}
 
 	snd_pcm_hw_params_get_period_time(params, &tmp, NULL);
 	LOG(DEBUG) << "period time: " << tmp << "\n";
@@ -194,10 +201,98 @@ void AlsaPlayer::stop()
 }
 
 
-void AlsaPlayer::worker()
+void AlsaPlayer::recover(int err)
+{
+	if (err == -EPIPE)
+		LOG(ERROR) << "XRUN\n";
+	if ((err = snd_pcm_recover(handle_, err, 1)) < 0)
+	{
+		LOG(ERROR) << "ERROR. Can't recover PCM device: " << snd_strerror(err) << "\n";
+		uninitAlsa();
+	}
+}
+
+
+bool AlsaPlayer::writeRw()
 {
 	snd_pcm_sframes_t pcm;
 	snd_pcm_sframes_t framesDelay;
+
+//	snd_pcm_avail_delay(handle_, &framesAvail, &framesDelay);
+	snd_pcm_delay(handle_, &framesDelay);
+	chronos::usec delay((chronos::usec::rep) (1000 * (double) framesDelay / stream_->getFormat().msRate()));
+//	LOG(INFO) << "delay: " << framesDelay << ", delay[ms]: " << delay.count() / 1000 << "\n";
+
+	if (!stream_->getPlayerChunk(buff_, delay, frames_))
+		return false;
+
+	adjustVolume(buff_, frames_);
+	if ((pcm = snd_pcm_writei(handle_, buff_, frames_)) == -EPIPE)
+	{
+		LOG(ERROR) << "XRUN\n";
+		snd_pcm_prepare(handle_);
+	}
+	else if (pcm < 0)
+	{
+		LOG(ERROR) << "ERROR. Can't write to PCM device: " << snd_strerror(pcm) << "\n";
+		uninitAlsa();
+	}
+	return true;
+}
+
+
+bool AlsaPlayer::writeMmap()
+{
+	snd_pcm_sframes_t framesAvail;
+	snd_pcm_sframes_t framesDelay;
+	int err;
+
+	if ((err = snd_pcm_avail_delay(handle_, &framesAvail, &framesDelay)) < 0)
+	{
+		recover(err);
+		return true;
+	}
+
+	if ((snd_pcm_uframes_t)framesAvail < frames_)
+	{
+		/// The buffer is filled: start playback, resp. sleep until the next period is played
+		if (snd_pcm_state(handle_) == SND_PCM_STATE_PREPARED)
+			err = snd_pcm_start(handle_);
+		else
+			err = snd_pcm_wait(handle_, 100);
+		if (err < 0)
+			recover(err);
+		return true;
+	}
+
+	const snd_pcm_channel_area_t* areas;
+	snd_pcm_uframes_t offset;
+	/// might be less than a period at the end of the ring buffer
+	snd_pcm_uframes_t frames = frames_;
+	if ((err = snd_pcm_mmap_begin(handle_, &areas, &offset, &frames)) < 0)
+	{
+		recover(err);
+		return true;
+	}
+
+	/// interleaved: all channels are in the first area, "first" and "step" are in bits
+	char* buffer = (char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+	chronos::usec delay((chronos::usec::rep) (1000 * (double) framesDelay / stream_->getFormat().msRate()));
+	bool played = stream_->getPlayerChunk(buffer, delay, frames);
+	if (played)
+		adjustVolume(buffer, frames);
+	else
+		frames = 0;
+
+	snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle_, offset, frames);
+	if ((committed < 0) || ((snd_pcm_uframes_t)committed != frames))
+		recover((committed < 0) ? (int)committed : -EPIPE);
+	return played;
+}
+
+
+void AlsaPlayer::worker()
+{
 	long lastChunkTick = chronos::getTickCount();
 
 	while (active_)
@@ -212,28 +307,13 @@ void AlsaPlayer::worker()
 			{
 				LOG(ERROR) << "Exception in initAlsa: " << e.what() << endl;
 				chronos::sleep(100);
+				continue;
 			}
 		}
 
-//		snd_pcm_avail_delay(handle_, &framesAvail, &framesDelay);
-		snd_pcm_delay(handle_, &framesDelay);
-		chronos::usec delay((chronos::usec::rep) (1000 * (double) framesDelay / stream_->getFormat().msRate()));
-//		LOG(INFO) << "delay: " << framesDelay << ", delay[ms]: " << delay.count() / 1000 << "\n";
-
-		if (stream_->getPlayerChunk(buff_, delay, frames_))
+		if (mmap_ ? writeMmap() : writeRw())
 		{
 			lastChunkTick = chronos::getTickCount();
-			adjustVolume(buff_, frames_);
-			if ((pcm = snd_pcm_writei(handle_, buff_, frames_)) == -EPIPE)
-			{
-				LOG(ERROR) << "XRUN\n";
-				snd_pcm_prepare(handle_);
-			}
-			else if (pcm < 0)
-			{
-				LOG(ERROR) << "ERROR. Can't write to PCM device: " << snd_strerror(pcm) << "\n";
-				uninitAlsa();
-			}
 		}
 		else
 		{
@@ -26,6 +26,12 @@
 /// Audio Player
 /**
  * Audio player implementation using Alsa
+ *
+ * With PcmDevice::mmap the stream renders directly into the device's ring
+ * buffer (snd_pcm_mmap_begin/commit) instead of into an intermediate period
+ * buffer, that is copied by snd_pcm_writei. The worker wakes up on period
+ * boundaries (snd_pcm_wait) and reads the delay together with the free space
+ * (snd_pcm_avail_delay) right before rendering.
  */
 class AlsaPlayer : public Player
 {
@@ -46,10 +52,17 @@ protected:
 private:
 	void initAlsa();
 	void uninitAlsa();
+	/// Play one period, false if the stream had no data
+	bool writeRw();
+	bool writeMmap();
+	/// Recovers from xruns and suspends, closes the device if this fails
+	void recover(int err);
 
 	snd_pcm_t* handle_;
 	snd_pcm_uframes_t frames_;
 	char *buff_;
+	/// mmap access is used, i.e. requested and supported by the device
+	bool mmap_;
 };
 
 
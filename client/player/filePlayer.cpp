@@ -0,0 +1,168 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <cerrno>
+#include <cstring>
+#include "filePlayer.h"
+#include "aixlog.hpp"
+#include "common/endian.hpp"
+#include "common/snapException.h"
+#include "common/strCompat.h"
+#include "common/utils/string_utils.h"
+
+using namespace std;
+
+
+FilePlayer::FilePlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream) :
+	Player(pcmDevice, stream), file_(NULL), periodMs_(20), driftPpm_(0.), delayMs_(0), xruns_(0)
+{
+	string name = pcmDevice.name;
+	string options;
+	size_t pos = name.find('?');
+	if (pos != string::npos)
+	{
+		options = name.substr(pos + 1);
+		name = name.substr(0, pos);
+	}
+
+	for (const auto& option: utils::string::split(options, '&'))
+	{
+		vector<string> keyValue = utils::string::split(option, '=');
+		if (keyValue.size() != 2)
+			throw SnapException("Invalid player option: \"" + option + "\"");
+		if (keyValue[0] == "period")
+			periodMs_ = cpt::stoul(keyValue[1]);
+		else if (keyValue[0] == "drift")
+			driftPpm_ = cpt::stod(keyValue[1]);
+		else if (keyValue[0] == "delay")
+			delayMs_ = cpt::stoul(keyValue[1]);
+		else
+			throw SnapException("Unknown player option: \"" + keyValue[0] + "\"");
+	}
+	if (periodMs_ == 0)
+		throw SnapException("Player period must be > 0");
+
+	if (name.find("file:") == 0)
+	{
+		string path = name.substr(5);
+		if ((file_ = fopen(path.c_str(), "wb")) == NULL)
+			throw SnapException("Can't open \"" + path + "\": " + strerror(errno));
+	}
+	LOG(INFO) << "Simulated DAC: " << name << ", period: " << periodMs_ << " ms, drift: " << driftPpm_ << " ppm, delay: " << delayMs_ << " ms\n";
+}
+
+
+FilePlayer::~FilePlayer()
+{
+	stop();
+	if (file_ != NULL)
+		fclose(file_);
+}
+
+
+bool FilePlayer::isFilePlayer(const std::string& name)
+{
+	return (name == "null") || (name.find("null?") == 0) || (name.find("file:") == 0);
+}
+
+
+void FilePlayer::write(const chronos::time_point_clk& dacTime, size_t frames)
+{
+	if (file_ == NULL)
+		return;
+
+	char header[kHeaderSize];
+	uint64_t u64 = SWAP_64((uint64_t)std::chrono::duration_cast<chronos::nsec>(dacTime.time_since_epoch()).count());
+	memcpy(header, &u64, sizeof(u64));
+	u64 = SWAP_64((uint64_t)std::chrono::duration_cast<chronos::nsec>(stream_->getPlayedTime().time_since_epoch()).count());
+	memcpy(header + sizeof(u64), &u64, sizeof(u64));
+	uint32_t u32 = SWAP_32((uint32_t)frames);
+	memcpy(header + 2 * sizeof(u64), &u32, sizeof(u32));
+
+	if ((fwrite(header, kHeaderSize, 1, file_) != 1) || (fwrite(buffer_.data(), frames * stream_->getFormat().frameSize, 1, file_) != 1))
+	{
+		LOG(ERROR) << "Failed to write audio: " << strerror(errno) << ", discarding from now on\n";
+		fclose(file_);
+		file_ = NULL;
+		return;
+	}
+	/// pipes are read while playing
+	fflush(file_);
+}
+
+
+void FilePlayer::worker()
+{
+	const SampleFormat& format = stream_->getFormat();
+	const size_t periodFrames = format.rate * periodMs_ / 1000;
+	const size_t bufferFrames = kPeriods * periodFrames;
+	/// frames per second of the simulated DAC
+	const double dacRate = format.rate * (1. + driftPpm_ / 1000000.);
+	const chronos::usec delay = chronos::msec(delayMs_);
+	buffer_.resize(periodFrames * format.frameSize);
+
+	/// Local time when the DAC started playing frame 0, and the number of frames written since then
+	chronos::time_point_clk dacStart;
+	uint64_t written = 0;
+	bool running = false;
+
+	while (active_)
+	{
+		chronos::time_point_clk now = chronos::clk::now();
+		double queued = 0.;
+		if (running)
+		{
+			queued = written - std::chrono::duration<double>(now - dacStart).count() * dacRate;
+			if (queued < 0.)
+			{
+				LOG(ERROR) << "XRUN, xruns: " << ++xruns_ << "\n";
+				running = false;
+				queued = 0.;
+			}
+		}
+
+		/// block until there is room for a period, like a write to a sound card
+		if (queued + periodFrames > bufferFrames)
+		{
+			chronos::sleep(chronos::usec((chronos::usec::rep)((queued + periodFrames - bufferFrames) / dacRate * 1000000.) + 1));
+			continue;
+		}
+
+		chronos::usec dacDelay = chronos::usec((chronos::usec::rep)(queued / dacRate * 1000000.)) + delay;
+		if (stream_->getPlayerChunk(buffer_.data(), dacDelay, periodFrames))
+		{
+			if (!running)
+			{
+				dacStart = now;
+				written = 0;
+				running = true;
+			}
+			adjustVolume(buffer_.data(), periodFrames);
+			write(dacStart + chronos::nsec((chronos::nsec::rep)(written / dacRate * 1000000000.)) + delay, periodFrames);
+			written += periodFrames;
+		}
+		else
+		{
+			LOG(INFO) << "Failed to get chunk\n";
+			while (active_ && !stream_->waitForChunk(100))
+				LOG(DEBUG) << "Waiting for chunk\n";
+		}
+	}
+}
+
+
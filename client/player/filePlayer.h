@@ -0,0 +1,79 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef FILE_PLAYER_H
+#define FILE_PLAYER_H
+
+#include <cstdio>
+#include <vector>
+#include "player.h"
+
+
+/// Audio player without sound card
+/**
+ * Plays on a simulated DAC, for benchmarks and tests on machines without a
+ * sound card, e.g. many virtual clients on one host.
+ * The DAC consumes "period" ms per period from a buffer of kPeriods periods.
+ * Its clock runs "drift" ppm faster (or slower, if negative) than the local
+ * system clock and it adds "delay" ms of output latency, which is included
+ * in the reported delay. Like a sound card it runs dry (xrun), if the stream
+ * doesn't deliver in time.
+ *
+ * Device names:
+ *   null[?options]          discard the audio
+ *   file:<path>[?options]   write the audio to the file or named pipe
+ * options: period=<ms>&drift=<ppm>&delay=<ms>
+ *
+ * The file is a sequence of periods, each one is a header followed by the
+ * period's PCM frames. Header (little endian):
+ *   int64 local system time when the first frame leaves the DAC [ns since epoch]
+ *   int64 recording (server) time of the first frame [ns since epoch], 0 for silence
+ *   uint32 number of frames
+ * The sync error between two clients on the same host is the difference of
+ * their "DAC time - recording time".
+ */
+class FilePlayer : public Player
+{
+public:
+	FilePlayer(const PcmDevice& pcmDevice, std::shared_ptr<Stream> stream);
+	virtual ~FilePlayer();
+
+	/// Device name of a FilePlayer, i.e. "null" or "file:..."
+	static bool isFilePlayer(const std::string& name);
+
+protected:
+	virtual void worker();
+
+private:
+	void write(const chronos::time_point_clk& dacTime, size_t frames);
+
+	static const size_t kPeriods = 4;
+	static const size_t kHeaderSize = 2 * sizeof(int64_t) + sizeof(uint32_t);
+
+	FILE* file_;
+	size_t periodMs_;
+	double driftPpm_;
+	size_t delayMs_;
+	std::vector<char> buffer_;
+	size_t xruns_;
+};
+
+
+#endif
+
+
@@ -25,18 +25,20 @@
 struct PcmDevice
 {
 	PcmDevice() : 
-		idx(-1), name("default")
+		idx(-1), name("default"), mmap(false)
 	{
 	};
 	
 	PcmDevice(int idx, const std::string& name, const std::string& description = "") : 
-		idx(idx), name(name), description(description) 
+		idx(idx), name(name), description(description), mmap(false)
 	{
 	};
 
 	int idx;
 	std::string name;
 	std::string description;
+	/// Render directly into the device's buffer (ALSA mmap access), if supported
+	bool mmap;
 };
 
 
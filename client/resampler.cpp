@@ -0,0 +1,176 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "resampler.h"
+#include "common/sampleConversion.h"
+
+
+namespace
+{
+
+/// Modified Bessel function of the first kind, order 0, for the Kaiser window
+double besselI0(double x)
+{
+	double sum = 1.;
+	double term = 1.;
+	for (int k = 1; k < 50; ++k)
+	{
+		term *= (x / (2. * k)) * (x / (2. * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+
+/// Dot product with independent partial sums, so that the compiler can vectorize it
+inline float dot(const float* a, const float* b, size_t n)
+{
+	float sum[8] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+	for (size_t k = 0; k < n; k += 8)
+		for (size_t i = 0; i < 8; ++i)
+			sum[i] += a[k + i] * b[k + i];
+	return ((sum[0] + sum[4]) + (sum[1] + sum[5])) + ((sum[2] + sum[6]) + (sum[3] + sum[7]));
+}
+
+}
+
+
+
+Resampler::Resampler(const SampleFormat& format) :
+	format_(format),
+	filter_((phases + 1) * taps),
+	in_(format.channels),
+	out_(format.channels),
+	inPtr_(format.channels),
+	outPtr_(format.channels),
+	phase_(0.)
+{
+	/// cutoff at 95% of Nyquist, the Kaiser window (beta 8) gives ~80dB stopband attenuation
+	const double pi = 3.14159265358979323846;
+	const double cutoff = 0.95;
+	const double beta = 8.;
+	const double half = taps / 2;
+	for (size_t p = 0; p <= phases; ++p)
+	{
+		float* row = &filter_[p * taps];
+		double sum = 0.;
+		for (size_t k = 0; k < taps; ++k)
+		{
+			/// distance of tap k from the interpolated position
+			double t = k - (half - 1.) - (double)p / phases;
+			double x = pi * cutoff * t;
+			double sinc = (x == 0.) ? 1. : sin(x) / x;
+			double r = t / half;
+			double window = (fabs(r) < 1.) ? besselI0(beta * sqrt(1. - r * r)) / besselI0(beta) : 0.;
+			row[k] = sinc * window;
+			sum += row[k];
+		}
+		/// unity gain at DC
+		for (size_t k = 0; k < taps; ++k)
+			row[k] /= sum;
+	}
+	reset();
+}
+
+
+size_t Resampler::inputFrames(size_t frames, double ratio) const
+{
+	return static_cast<size_t>(floor(phase_ + frames * ratio));
+}
+
+
+double Resampler::delay() const
+{
+	return (taps / 2 + 1) - phase_;
+}
+
+
+void Resampler::reset()
+{
+	phase_ = 0.;
+	for (auto& channel: in_)
+	{
+		if (channel.size() < taps)
+			channel.resize(taps);
+		std::fill(channel.begin(), channel.begin() + taps, 0.f);
+	}
+}
+
+
+void Resampler::reserve(size_t inFrames, size_t outFrames)
+{
+	for (size_t channel = 0; channel < format_.channels; ++channel)
+	{
+		if (in_[channel].size() < taps + inFrames)
+			in_[channel].resize(taps + inFrames);
+		if (out_[channel].size() < outFrames)
+			out_[channel].resize(outFrames);
+		inPtr_[channel] = in_[channel].data() + taps;
+		outPtr_[channel] = out_[channel].data();
+	}
+}
+
+
+void Resampler::resample(const void* in, size_t inFrames, void* out, size_t outFrames, double ratio)
+{
+	reserve(inFrames, outFrames);
+	sample::deinterleave(in, inPtr_.data(), inFrames, format_);
+
+	/// Output frame n is interpolated at position "offset + n * ratio" of the input
+	/// (relative to the first new frame). The history covers the "taps" frames before.
+	const double offset = phase_ - (taps / 2 + 1);
+	if ((ratio == 1.) && (phase_ == 0.))
+	{
+		/// integer positions: the history shifted by the filter's delay
+		for (size_t channel = 0; channel < format_.channels; ++channel)
+			outPtr_[channel] = in_[channel].data() + taps / 2 - 1;
+	}
+	else
+	{
+		for (size_t n = 0; n < outFrames; ++n)
+		{
+			double position = offset + n * ratio;
+			double index = floor(position);
+			double fraction = (position - index) * phases;
+			size_t phase = static_cast<size_t>(fraction);
+			float weight = fraction - phase;
+			const float* filter = &filter_[phase * taps];
+			/// first tap is "taps / 2 - 1" frames before "index"
+			size_t first = static_cast<size_t>(static_cast<long>(index) + taps / 2 + 1);
+			for (size_t channel = 0; channel < format_.channels; ++channel)
+			{
+				const float* samples = &in_[channel][first];
+				float value = dot(filter, samples, taps);
+				float next = dot(filter + taps, samples, taps);
+				out_[channel][n] = value + weight * (next - value);
+			}
+		}
+	}
+	sample::interleave(outPtr_.data(), out, outFrames, format_);
+
+	phase_ += outFrames * ratio - inFrames;
+	for (auto& channel: in_)
+		memmove(channel.data(), channel.data() + inFrames, taps * sizeof(float));
+}
+
@@ -0,0 +1,80 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <vector>
+#include "common/sampleFormat.h"
+
+
+/// Band limited resampler with a continuously adjustable ratio
+/**
+ * Used to play a stream slightly faster or slower to keep it in sync,
+ * e.g. by some ppm to follow the DAC's real sample rate, instead of
+ * dropping or repeating whole frames.
+ *
+ * Polyphase windowed sinc (Kaiser) FIR with "taps" taps and "phases"
+ * phases, linearly interpolated between adjacent phases. The filter
+ * only looks back, i.e. the output is delayed by delay() frames. The
+ * fractional read position is carried over from one call to the next,
+ * so consecutive buffers are seamless for any sequence of ratios.
+ *
+ * Samples are processed as float planes, buffers only grow if a larger
+ * period is requested, nothing is allocated in steady state.
+ */
+class Resampler
+{
+public:
+	Resampler(const SampleFormat& format);
+
+	/// Input frames needed to produce "frames" output frames
+	/// @param ratio input rate / output rate, e.g. 1.0001 to play 100ppm faster
+	size_t inputFrames(size_t frames, double ratio) const;
+
+	/// Resample "inFrames" (as returned by inputFrames) into "outFrames" frames
+	void resample(const void* in, size_t inFrames, void* out, size_t outFrames, double ratio);
+
+	/// Delay in frames between the next input frame and the next output frame
+	double delay() const;
+
+	/// Forget the history, e.g. after a discontinuity
+	void reset();
+
+private:
+	static const size_t taps = 32;
+	static const size_t phases = 256;
+
+	void reserve(size_t inFrames, size_t outFrames);
+
+	SampleFormat format_;
+	/// (phases + 1) x taps coefficients, row p is the filter for a fractional position of p / phases
+	std::vector<float> filter_;
+	/// per channel: "taps" frames history, followed by the current input
+	std::vector<std::vector<float>> in_;
+	std::vector<std::vector<float>> out_;
+	std::vector<float*> inPtr_;
+	std::vector<float*> outPtr_;
+	/// position of the next output frame, relative to the next input frame
+	double phase_;
+};
+
+
+#endif
+
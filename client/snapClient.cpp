@@ -21,6 +21,7 @@
 
 #include "popl.hpp"
 #include "controller.h"
+#include "player/filePlayer.h"
 #include "browseZeroConf/browsemDNS.h"
 
 #ifdef HAS_ALSA
@@ -43,6 +44,9 @@ volatile sig_atomic_t g_terminated = false;
 
 PcmDevice getPcmDevice(const std::string& soundcard)
 {
+	if (FilePlayer::isFilePlayer(soundcard))
+		return PcmDevice(0, soundcard, "simulated DAC");
+
 #ifdef HAS_ALSA
 	vector<PcmDevice> pcmDevices = AlsaPlayer::pcm_list();
 
@@ -75,11 +79,17 @@ int main (int argc, char **argv)
 	try
 	{
 		string meta_script("");
+#if defined(HAS_ALSA) || defined(HAS_OPENSL) || defined(HAS_COREAUDIO)
 		string soundcard("default");
+#else
+		string soundcard("null");
+#endif
 		string host("");
 		size_t port(1704);
 		int latency(0);
 		size_t instance(1);
+		size_t syncTarget(500);
+		size_t maxBuffer(10000);
 
 		OptionParser op("Allowed options");
 		auto helpSwitch =     op.add<Switch>("", "help", "produce help message");
@@ -88,7 +98,10 @@ int main (int argc, char **argv)
 		auto versionSwitch =  op.add<Switch>("v", "version", "show version number");
 #if defined(HAS_ALSA)
 		auto listSwitch =     op.add<Switch>("l", "list", "list pcm devices");
-		/*auto soundcardValue =*/ op.add<Value<string>>("s", "soundcard", "index or name of the soundcard", "default", &soundcard);
+		auto soundcardValue = op.add<Value<string>>("s", "soundcard", "index or name of the soundcard, null or file:<path> for a simulated DAC, repeat to play on several soundcards (zones)", soundcard, &soundcard);
+		auto mmapSwitch =     op.add<Switch>("", "mmap", "render directly into the soundcard's buffer (mmap access), if supported");
+#else
+		auto soundcardValue = op.add<Value<string>>("s", "soundcard", "null or file:<path> for a simulated DAC, repeat for several zones", soundcard, &soundcard);
 #endif
 		auto metaStderr =     op.add<Switch>("e", "mstderr", "send metadata to stderr");
 		//auto metaHook =       op.add<Value<string>>("m", "mhook", "script to call on meta tags", "", &meta_script);
@@ -99,9 +112,12 @@ int main (int argc, char **argv)
 		auto daemonOption =   op.add<Implicit<int>>("d", "daemon", "daemonize, optional process priority [-20..19]", -3, &processPriority);
 		auto userValue =      op.add<Value<string>>("", "user", "the user[:group] to run snapclient as when daemonized");
 #endif
-		/*auto latencyValue =*/   op.add<Value<int>>("", "latency", "latency of the soundcard", 0, &latency);
-		/*auto instanceValue =*/  op.add<Value<size_t>>("i", "instance", "instance id", 1, &instance);
+		auto latencyValue =   op.add<Value<int>>("", "latency", "latency of the soundcard, repeat per zone", 0, &latency);
+		/*auto instanceValue =*/  op.add<Value<size_t>>("i", "instance", "instance id, zones get consecutive ids", 1, &instance);
 		auto hostIdValue =    op.add<Value<string>>("", "hostID", "unique host id", "");
+		auto codecValue =     op.add<Value<string>>("", "codec", "preferred transport codec (flac|ogg|opus|pcm), if offered by the stream", "");
+		/*auto syncTargetValue =*/ op.add<Value<size_t>>("", "syncTarget", "initial time sync is done when the server time is known within [us]", 500, &syncTarget);
+		/*auto maxBufferValue =*/ op.add<Value<size_t>>("", "maxBuffer", "maximum of buffered audio [ms]", 10000, &maxBuffer);
 
 		try
 		{
@@ -206,14 +222,27 @@ int main (int argc, char **argv)
 		}
 #endif
 
-		PcmDevice pcmDevice = getPcmDevice(soundcard);
-#if defined(HAS_ALSA)
-		if (pcmDevice.idx == -1)
+		/// One zone per soundcard. The zones are independent clients with consecutive instance ids
+		vector<string> soundcards;
+		for (size_t n = 0; n < soundcardValue->count(); ++n)
+			soundcards.push_back(soundcardValue->value(n));
+		if (soundcards.empty())
+			soundcards.push_back(soundcard);
+
+		vector<PcmDevice> pcmDevices;
+		for (const auto& card: soundcards)
 		{
-			cout << "soundcard \"" << soundcard << "\" not found\n";
-//			exit(EXIT_FAILURE);
-		}
+			PcmDevice pcmDevice = getPcmDevice(card);
+#if defined(HAS_ALSA)
+			pcmDevice.mmap = mmapSwitch->is_set();
+			if (pcmDevice.idx == -1)
+			{
+				cout << "soundcard \"" << card << "\" not found\n";
+//				exit(EXIT_FAILURE);
+			}
 #endif
+			pcmDevices.push_back(pcmDevice);
+		}
 
 		if (host.empty())
 		{
@@ -243,21 +272,25 @@ int main (int argc, char **argv)
 #endif
 		}
 
-		// Setup metadata handling
-		std::shared_ptr<MetadataAdapter> meta;
-		meta.reset(new MetadataAdapter);
-		if(metaStderr)
-			meta.reset(new MetaStderrAdapter);
-
-		std::unique_ptr<Controller> controller(new Controller(hostIdValue->value(), instance, meta));
-		if (!g_terminated)
+		vector<std::unique_ptr<Controller>> controllers;
+		for (size_t n = 0; (n < pcmDevices.size()) && !g_terminated; ++n)
 		{
-			LOG(INFO) << "Latency: " << latency << "\n";
-			controller->start(pcmDevice, host, port, latency);
-			while(!g_terminated)
-				chronos::sleep(100);
-			controller->stop();
+			// Setup metadata handling, per zone, the adapters are not thread safe
+			std::shared_ptr<MetadataAdapter> meta;
+			meta.reset(new MetadataAdapter);
+			if(metaStderr)
+				meta.reset(new MetaStderrAdapter);
+
+			/// the last latency is used for the remaining zones
+			int zoneLatency = (n < latencyValue->count()) ? latencyValue->value(n) : latency;
+			LOG(INFO) << "Instance: " << instance + n << ", soundcard: " << soundcards[n] << ", latency: " << zoneLatency << "\n";
+			controllers.emplace_back(new Controller(hostIdValue->value(), instance + n, codecValue->value(), meta));
+			controllers.back()->start(pcmDevices[n], host, port, zoneLatency, syncTarget, maxBuffer);
 		}
+		while(!g_terminated)
+			chronos::sleep(100);
+		for (auto& controller: controllers)
+			controller->stop();
 	}
 	catch (const std::exception& e)
 	{
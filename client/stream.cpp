@@ -28,31 +28,26 @@ using namespace std;
 namespace cs = chronos;
 
 
-Stream::Stream(const SampleFormat& sampleFormat) : format_(sampleFormat), sleep_(0), median_(0), shortMedian_(0), lastUpdate_(0), playedFrames_(0), bufferMs_(cs::msec(500))
+Stream::Stream(const SampleFormat& sampleFormat, size_t capacityMs) : format_(sampleFormat), sleep_(0), ring_(sampleFormat, capacityMs), missingFrames_(0), droppedChunks_(0), overflowChunks_(0), resampler_(sampleFormat), median_(0), shortMedian_(0), lastUpdate_(0), lastSleepAge_(0), rateRatio_(1.), bufferMs_(cs::msec(500))
 {
 	buffer_.setSize(500);
 	shortBuffer_.setSize(100);
 	miniBuffer_.setSize(20);
 //	cardBuffer_.setSize(50);
-
-/*
-48000     x
-------- = -----
-47999,2   x - 1
-
-x = 1,000016667 / (1,000016667 - 1)
-*/
 	setRealSampleRate(format_.rate);
 }
 
 
 void Stream::setRealSampleRate(double sampleRate)
 {
-	if (sampleRate == format_.rate)
-		correctAfterXFrames_ = 0;
-	else
-		correctAfterXFrames_ = round((format_.rate / sampleRate) / (format_.rate / sampleRate - 1.));
-//	LOG(DEBUG) << "Correct after X: " << correctAfterXFrames_ << " (Real rate: " << sampleRate << ", rate: " << format_.rate << ")\n";
+	/// e.g. 48000 / 47999.2: the DAC is slower, play 16.7ppm faster
+	rateRatio_ = format_.rate / sampleRate;
+	/// The server produces "rate" frames per server second. Assuming that the DAC
+	/// follows the local clock, compensate the clock skew once it is known to 1ppm
+	TimeProvider& timeProvider = TimeProvider::getInstance();
+	if (timeProvider.getSkewError() < 0.000001)
+		rateRatio_ *= 1. + timeProvider.getSkew();
+//	LOG(DEBUG) << "Rate ratio: " << rateRatio_ << " (Real rate: " << sampleRate << ", rate: " << format_.rate << ")\n";
 }
 
 
@@ -65,115 +60,78 @@ void Stream::setBufferLen(size_t bufferLenMs)
 
 void Stream::clearChunks()
 {
-	while (chunks_.size() > 0)
-		chunks_.pop();
+	ring_.clear();
+	missingFrames_ = 0;
 	resetBuffers();
+	resampler_.reset();
 }
 
 
 void Stream::addChunk(msg::PcmChunk* chunk)
 {
-	while (chunks_.size() * chunk->duration<cs::msec>().count() > 10000)
-		chunks_.pop();
-	chunks_.push(shared_ptr<msg::PcmChunk>(chunk));
-//	LOG(DEBUG) << "new chunk: " << chunk->duration<cs::msec>().count() << ", Chunks: " << chunks_.size() << "\n";
+	std::unique_ptr<msg::PcmChunk> pcmChunk(chunk);
+	if (!ring_.write(pcmChunk->payload, pcmChunk->getFrameCount(), pcmChunk->start()))
+	{
+		/// logged once per overflow, not for every chunk
+		if (overflowChunks_++ == 0)
+			LOG(INFO) << "Buffer full, dropping chunks\n";
+		++droppedChunks_;
+	}
+	else if (overflowChunks_ > 0)
+	{
+		LOG(INFO) << "Buffer accepts chunks again, dropped " << overflowChunks_ << " chunks\n";
+		overflowChunks_ = 0;
+	}
+//	LOG(DEBUG) << "new chunk: " << chunk->duration<cs::msec>().count() << ", buffered: " << getBufferedMs() << "\n";
 }
 
 
 bool Stream::waitForChunk(size_t ms) const
 {
-	return chunks_.wait_for(std::chrono::milliseconds(ms));
+	return ring_.waitFor((missingFrames_ > 0) ? missingFrames_ : 1, std::chrono::milliseconds(ms));
 }
 
 
 
 cs::time_point_clk Stream::getSilentPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer)
 {
-	if (!chunk_)
-		chunk_ = chunks_.pop();
-	cs::time_point_clk tp = chunk_->start();
+	cs::time_point_clk tp = ring_.time();
 	memset(outputBuffer, 0, framesPerBuffer * format_.frameSize);
+	resampler_.reset();
+	playedTime_ = cs::time_point_clk();
 	return tp;
 }
 
 
-/*
-time_point_ms Stream::seekTo(const time_point_ms& to)
-{
-	if (!chunk)
-		chunk_ = chunks_.pop();
-//	time_point_ms tp = chunk_->timePoint();
-	while (to > chunk_->timePoint())// + std::chrono::milliseconds((long int)chunk_->getDuration()))//
-	{
-		chunk_ = chunks_.pop();
-		LOG(DEBUG) << "\nto: " << Chunk::getAge(to) << "\t chunk: " << Chunk::getAge(chunk_->timePoint()) << "\n";
-		LOG(DEBUG) << "diff: " << std::chrono::duration_cast<std::chrono::milliseconds>((to - chunk_->timePoint())).count() << "\n";
-	}
-	chunk_->seek(std::chrono::duration_cast<std::chrono::milliseconds>(to - chunk_->timePoint()).count() * format_.msRate());
-	return chunk_->timePoint();
-}
-*/
-
-/*
-time_point_clk Stream::seek(long ms)
+cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer)
 {
-	if (!chunk)
-		chunk_ = chunks_.pop();
-
-	if (ms <= 0)
-		return chunk_->start();
-
-//	time_point_ms tp = chunk_->timePoint();
-	while (ms > chunk_->duration<cs::msec>().count())
+	if (ring_.available() < framesPerBuffer)
 	{
-		chunk_ = chunks_.pop();
-		ms -= min(ms, (long)chunk_->durationLeft<cs::msec>().count());
-	}
-	chunk_->seek(ms * format_.msRate());
-	return chunk_->start();
-}
-*/
-
-
-cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, const cs::usec& timeout, unsigned long framesPerBuffer)
-{
-	if (!chunk_ && !chunks_.try_pop(chunk_, timeout))
+		missingFrames_ = framesPerBuffer;
 		throw 0;
-
-	cs::time_point_clk tp = chunk_->start();
-	char* buffer = (char*)outputBuffer;
-	unsigned long read = 0;
-	while (read < framesPerBuffer)
-	{
-		read += chunk_->readFrames(buffer + read*format_.frameSize, framesPerBuffer - read);
-		if (chunk_->isEndOfChunk() && !chunks_.try_pop(chunk_, timeout))
-			throw 0;
 	}
+
+	cs::time_point_clk tp = ring_.time();
+	ring_.read((char*)outputBuffer, framesPerBuffer);
 	return tp;
 }
 
 
-cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, const cs::usec& timeout, unsigned long framesPerBuffer, long framesCorrection)
+cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer, double framesCorrection)
 {
-	if (framesCorrection == 0)
-		return getNextPlayerChunk(outputBuffer, timeout, framesPerBuffer);
-
-	long toRead = framesPerBuffer + framesCorrection;
-	char* buffer = (char*)malloc(toRead * format_.frameSize);
-	cs::time_point_clk tp = getNextPlayerChunk(buffer, timeout, toRead);
-
-	float factor = (float)toRead / framesPerBuffer;//(float)(framesPerBuffer*channels_);
-//	if (abs(framesCorrection) > 1)
-//		LOG(INFO) << "correction: " << framesCorrection << ", factor: " << factor << "\n";
-	float idx = 0;
-	for (size_t n=0; n<framesPerBuffer; ++n)
-	{
-		size_t index(floor(idx));// = (int)(ceil(n*factor));
-		memcpy((char*)outputBuffer + n*format_.frameSize, buffer + index*format_.frameSize, format_.frameSize);
-		idx += factor;
-	}
-	free(buffer);
-
+	/// Always resample, even with a ratio of 1, to keep the resampler's delay constant
+	double ratio = rateRatio_ + framesCorrection / framesPerBuffer;
+//	if (fabs(framesCorrection) > 1)
+//		LOG(INFO) << "correction: " << framesCorrection << ", ratio: " << ratio << "\n";
+	size_t toRead = resampler_.inputFrames(framesPerBuffer, ratio);
+	if (readBuffer_.size() < toRead * format_.frameSize)
+		readBuffer_.resize(toRead * format_.frameSize);
+	cs::time_point_clk tp = getNextPlayerChunk(readBuffer_.data(), toRead);
+
+	/// the first output frame is "delay" frames older than the first frame read
+	tp -= cs::nsec(cs::nsec::rep(resampler_.delay() / format_.nsRate()));
+	resampler_.resample(readBuffer_.data(), toRead, outputBuffer, framesPerBuffer, ratio);
+	playedTime_ = tp;
 	return tp;
 }
 
@@ -205,21 +163,21 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 		return false;
 	}
 
-	if (!chunk_ && !chunks_.try_pop(chunk_, outputBufferDacTime))
+	if (ring_.empty())
 	{
 		//LOG(INFO) << "no chunks available\n";
+		missingFrames_ = 0;
 		sleep_ = cs::usec(0);
 		return false;
 	}
+	missingFrames_ = 0;
 
-	playedFrames_ += framesPerBuffer;
-
-	/// we have a chunk
-	/// age = chunk age (server now - rec time: some positive value) - buffer (e.g. 1000ms) + time to DAC
+	/// we have PCM data
+	/// age = age of the next frame (server now - rec time: some positive value) - buffer (e.g. 1000ms) + time to DAC
 	/// age = 0 => play now
 	/// age < 0 => play in -age
 	/// age > 0 => too old
-	cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start()) - bufferMs_ + outputBufferDacTime;
+	cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - ring_.time()) - bufferMs_ + outputBufferDacTime;
 //	LOG(INFO) << "age: " << age.count() / 1000 << "\n";
 	if ((sleep_.count() == 0) && (cs::abs(age) > cs::msec(200)))
 	{
@@ -241,7 +199,7 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 			if (sleep_ < -bufferDuration/2)
 			{
 				LOG(INFO) << "sleep < -bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " < " << -cs::duration<cs::msec>(bufferDuration)/2 << ", ";
-				// We're early: not enough chunks_. play silence. Reference chunk_ is the oldest (front) one
+				// We're early: not enough chunks. play silence. Reference is the next frame to read
 				sleep_ = chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getSilentPlayerChunk(outputBuffer, framesPerBuffer) - bufferMs_ + outputBufferDacTime);
 				LOG(INFO) << "sleep: " << cs::duration<cs::msec>(sleep_) << "\n";
 				if (sleep_ < -bufferDuration/2)
@@ -250,19 +208,18 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 			else if (sleep_ > bufferDuration/2)
 			{
 				LOG(INFO) << "sleep > bufferDuration/2: " << cs::duration<cs::msec>(sleep_) << " > " << cs::duration<cs::msec>(bufferDuration)/2 << "\n";
-				// We're late: discard oldest chunks
-				while (sleep_ > chunk_->duration<cs::usec>())
+				// We're late: discard the oldest frames
+				size_t frames = (size_t)(sleep_.count() * format_.usRate());
+				size_t skipped = ring_.skip(frames);
+				LOG(INFO) << "skipped frames: " << skipped << " of " << frames << ", buffered: " << getBufferedMs() << " ms, out: " << cs::duration<cs::msec>(outputBufferDacTime) << ", needed: " << cs::duration<cs::msec>(bufferDuration) << "\n";
+				if (ring_.empty())
 				{
-					LOG(INFO) << "sleep > chunkDuration: " << cs::duration<cs::msec>(sleep_) << " > " << chunk_->duration<cs::msec>().count() << ", chunks: " << chunks_.size() << ", out: " << cs::duration<cs::msec>(outputBufferDacTime) << ", needed: " << cs::duration<cs::msec>(bufferDuration) << "\n";
-					sleep_ = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start() - bufferMs_ + outputBufferDacTime);
-					if (!chunks_.try_pop(chunk_, outputBufferDacTime))
-					{
-						LOG(INFO) << "no chunks available\n";
-						chunk_ = NULL;
-						sleep_ = cs::usec(0);
-						return false;
-					}
+					LOG(INFO) << "no chunks available\n";
+					sleep_ = cs::usec(0);
+					return false;
 				}
+				sleep_ = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - ring_.time() - bufferMs_ + outputBufferDacTime);
+				resampler_.reset();
 			}
 
 			// out of sync, can be corrected by playing faster/slower
@@ -285,16 +242,9 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 		}
 
 		// framesCorrection = number of frames to be read more or less to get in-sync
-		long framesCorrection = correction.count()*format_.usRate();
-
-		// sample rate correction
-		if ((correctAfterXFrames_ != 0) && (playedFrames_ >= (unsigned long)abs(correctAfterXFrames_)))
-		{
-			framesCorrection += (correctAfterXFrames_ > 0)?1:-1;
-			playedFrames_ -= abs(correctAfterXFrames_);
-		}
+		double framesCorrection = correction.count()*format_.usRate();
 
-		age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getNextPlayerChunk(outputBuffer, outputBufferDacTime, framesPerBuffer, framesCorrection) - bufferMs_ + outputBufferDacTime);
+		age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getNextPlayerChunk(outputBuffer, framesPerBuffer, framesCorrection) - bufferMs_ + outputBufferDacTime);
 
 		setRealSampleRate(format_.rate);
 		if (sleep_.count() == 0)
@@ -336,11 +286,10 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 
 		if (sleep_.count() != 0)
 		{
-			static int lastAge(0);
 			int msAge = cs::duration<cs::msec>(age);
-			if (lastAge != msAge) 
+			if (lastSleepAge_ != msAge)
 			{
-				lastAge = msAge;
+				lastSleepAge_ = msAge;
 				LOG(INFO) << "Sleep " << cs::duration<cs::msec>(sleep_) << ", age: " << msAge << ", bufferDuration: " << cs::duration<cs::msec>(bufferDuration) << "\n";
 			}
 		}
@@ -25,26 +25,30 @@
 //#include <chrono>
 //#include "common/timeUtils.h"
 
+#include <atomic>
 #include <deque>
 #include <memory>
-#include "doubleBuffer.h"
+#include <vector>
+#include "orderStatistics.h"
+#include "resampler.h"
+#include "pcmRing.h"
 #include "message/message.h"
 #include "message/pcmChunk.h"
 #include "common/sampleFormat.h"
-#include "common/queue.h"
 
 
 /// Time synchronized audio stream
 /**
- * Queue with PCM data.
+ * Jitter buffer with PCM data (see PcmRing).
  * Returns "online" server-time-synchronized PCM data
  */
 class Stream
 {
 public:
-	Stream(const SampleFormat& format);
+	/// capacityMs: the stream buffers at most this much audio, newer chunks are dropped if it's full
+	Stream(const SampleFormat& format, size_t capacityMs = 10000);
 
-	/// Adds PCM data to the queue
+	/// Adds PCM data to the buffer, takes ownership of the chunk
 	void addChunk(msg::PcmChunk* chunk);
 	void clearChunks();
 
@@ -60,14 +64,32 @@ public:
 		return format_;
 	}
 
+	/// Waits up to "ms" for enough PCM data to retry a failed getPlayerChunk
 	bool waitForChunk(size_t ms) const;
 
+	/// Chunks dropped because the buffer was full
+	uint64_t getDroppedChunks() const
+	{
+		return droppedChunks_;
+	}
+
+	/// Buffered PCM data [ms]
+	size_t getBufferedMs() const
+	{
+		return ring_.available() * 1000 / format_.rate;
+	}
+
+	/// Recording (server) time of the first frame returned by the last successful getPlayerChunk,
+	/// the epoch if it was silence
+	const chronos::time_point_clk& getPlayedTime() const
+	{
+		return playedTime_;
+	}
+
 private:
-	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, const chronos::usec& timeout, unsigned long framesPerBuffer);
-	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, const chronos::usec& timeout, unsigned long framesPerBuffer, long framesCorrection);
+	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer);
+	chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer, double framesCorrection);
 	chronos::time_point_clk getSilentPlayerChunk(void* outputBuffer, unsigned long framesPerBuffer);
-	chronos::time_point_clk seek(long ms);
-//	time_point_ms seekTo(const time_point_ms& to);
 	void updateBuffers(int age);
 	void resetBuffers();
 	void setRealSampleRate(double sampleRate);
@@ -76,18 +98,27 @@ private:
 
 	chronos::usec sleep_;
 
-	Queue<std::shared_ptr<msg::PcmChunk>> chunks_;
-//	DoubleBuffer<chronos::usec::rep> cardBuffer;
-	DoubleBuffer<chronos::usec::rep> miniBuffer_;
-	DoubleBuffer<chronos::usec::rep> buffer_;
-	DoubleBuffer<chronos::usec::rep> shortBuffer_;
-	std::shared_ptr<msg::PcmChunk> chunk_;
+	PcmRing ring_;
+	/// Frames that were missing in the last getPlayerChunk
+	size_t missingFrames_;
+	std::atomic<uint64_t> droppedChunks_;
+	/// Only accessed by the producer: chunks dropped since the buffer became full
+	uint64_t overflowChunks_;
+	chronos::time_point_clk playedTime_;
+//	OrderStatistics<chronos::usec::rep> cardBuffer;
+	OrderStatistics<chronos::usec::rep> miniBuffer_;
+	OrderStatistics<chronos::usec::rep> buffer_;
+	OrderStatistics<chronos::usec::rep> shortBuffer_;
+	Resampler resampler_;
+	std::vector<char> readBuffer_;
 
 	int median_;
 	int shortMedian_;
 	time_t lastUpdate_;
-	unsigned long playedFrames_;
-	long correctAfterXFrames_;
+	/// Age of the last logged sleep [ms]
+	int lastSleepAge_;
+	/// input rate / output rate to compensate the DAC's real sample rate
+	double rateRatio_;
 	chronos::msec bufferMs_;
 };
 
@@ -0,0 +1,181 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include "timeClient.h"
+#include "timeProvider.h"
+#include "common/timeSync.h"
+#include "common/strCompat.h"
+#include "aixlog.hpp"
+
+
+using namespace std;
+using asio::ip::udp;
+
+
+TimeClient::TimeClient(const std::string& host, size_t port) : host_(host), port_(port), active_(false), id_(0), replies_(0)
+{
+}
+
+
+TimeClient::~TimeClient()
+{
+	stop();
+}
+
+
+void TimeClient::start()
+{
+	active_ = true;
+	thread_ = thread(&TimeClient::worker, this);
+}
+
+
+void TimeClient::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		active_ = false;
+	}
+	cv_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+}
+
+
+std::shared_ptr<TimeClient> TimeClient::getShared(const std::string& host, size_t port)
+{
+	static std::mutex mutex;
+	static std::map<std::string, std::weak_ptr<TimeClient>> timeClients;
+	std::lock_guard<std::mutex> lock(mutex);
+	std::weak_ptr<TimeClient>& entry = timeClients[host + ":" + cpt::to_string(port)];
+	shared_ptr<TimeClient> timeClient = entry.lock();
+	if (!timeClient)
+	{
+		timeClient = make_shared<TimeClient>(host, port);
+		timeClient->start();
+		entry = timeClient;
+	}
+	return timeClient;
+}
+
+
+void TimeClient::worker()
+{
+	/// number of requests sent in a burst after start, and the interval of the requests in and after the burst
+	const size_t burst = 20;
+	const chronos::msec burstInterval(20);
+	const chronos::msec interval(1000);
+	const chronos::msec timeout(500);
+
+	asio::io_service io_service;
+	udp::socket socket(io_service);
+	try
+	{
+		udp::resolver resolver(io_service);
+		udp::resolver::query query(host_, cpt::to_string(port_), asio::ip::resolver_query_base::numeric_service);
+		udp::endpoint endpoint = *resolver.resolve(query);
+		socket.open(endpoint.protocol());
+		socket.connect(endpoint);
+		if (!time_sync::enableTimestamps(socket.native_handle()))
+			LOG(WARNING) << "Kernel receive timestamps not supported, using the less accurate user space timestamps\n";
+		LOG(INFO) << "UDP time sync with " << endpoint.address().to_string() << ":" << port_ << "\n";
+	}
+	catch (const std::exception& e)
+	{
+		LOG(ERROR) << "Failed to start the UDP time sync: " << e.what() << "\n";
+		return;
+	}
+
+	size_t sent(0);
+	while (active_)
+	{
+		if (sync(socket, timeout))
+			++replies_;
+		++sent;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait_for(lock, (sent < burst) ? burstInterval : interval, [this]{ return !active_; });
+	}
+}
+
+
+bool TimeClient::sync(udp::socket& socket, const chronos::msec& timeout)
+{
+	char buffer[time_sync::Packet::kSize + 1];
+	time_sync::Packet request;
+	request.id = ++id_;
+	request.clientSent = time_sync::now();
+	request.serialize(buffer);
+	error_code ec;
+	socket.send(asio::buffer(buffer, time_sync::Packet::kSize), 0, ec);
+	if (ec)
+	{
+		LOG(DEBUG) << "Error sending time sync request: " << ec.message() << "\n";
+		return false;
+	}
+
+	chronos::time_point_clk deadline = chronos::clk::now() + timeout;
+	while (active_)
+	{
+		long remaining = chrono::duration_cast<chronos::msec>(deadline - chronos::clk::now()).count();
+		if (remaining <= 0)
+			return false;
+
+		pollfd fd;
+		fd.fd = socket.native_handle();
+		fd.events = POLLIN;
+		fd.revents = 0;
+		int result = poll(&fd, 1, remaining);
+		if (result < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			LOG(DEBUG) << "Error waiting for time sync reply: " << strerror(errno) << "\n";
+			return false;
+		}
+		else if (result == 0)
+			return false;
+
+		int64_t received;
+		ssize_t bytes = time_sync::receive(socket.native_handle(), buffer, sizeof(buffer), received);
+		if (bytes < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+				continue;
+			/// e.g. ECONNREFUSED, if the server's time sync port is not reachable
+			LOG(DEBUG) << "Error receiving time sync reply: " << strerror(errno) << "\n";
+			return false;
+		}
+
+		/// stale replies of timed out requests are dropped
+		time_sync::Packet reply;
+		if (!reply.deserialize(buffer, bytes) || (reply.type != time_sync::kResponse) || (reply.id != request.id))
+			continue;
+
+		double diffMs = ((reply.serverReceived - reply.clientSent) + (reply.serverSent - received)) / 2000000.;
+		double rttMs = ((received - reply.clientSent) - (reply.serverSent - reply.serverReceived)) / 1000000.;
+		TimeProvider::getInstance().setDiffToServer(diffMs, rttMs, TimeProvider::kUdp);
+		return true;
+	}
+	return false;
+}
+
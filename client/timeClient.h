@@ -0,0 +1,80 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef TIME_CLIENT_H
+#define TIME_CLIENT_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <asio.hpp>
+#include "common/timeDefs.h"
+
+
+/// Time sync over the server's UDP time sync port
+/**
+ * Sends NTP like time sync requests (see time_sync::Packet) and feeds the
+ * measurements into the TimeProvider, which prefers them over the ones
+ * taken over the stream connection.
+ * A burst of requests is sent after start, followed by one request per second.
+ * All zones of a multi zone client share the TimeProvider and thus one
+ * TimeClient per server, see getShared().
+ */
+class TimeClient
+{
+public:
+	TimeClient(const std::string& host, size_t port);
+	virtual ~TimeClient();
+
+	void start();
+	void stop();
+
+	/// Started TimeClient for the server, shared by all callers. It is stopped when the last reference is gone
+	static std::shared_ptr<TimeClient> getShared(const std::string& host, size_t port);
+
+	/// Number of received replies
+	size_t getReplies() const
+	{
+		return replies_;
+	}
+
+private:
+	void worker();
+	/// Sends a request and waits up to "timeout" for the reply
+	bool sync(asio::ip::udp::socket& socket, const chronos::msec& timeout);
+
+	std::string host_;
+	size_t port_;
+	std::atomic<bool> active_;
+	std::thread thread_;
+	/// Wakes the worker up on stop
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	uint32_t id_;
+	std::atomic<size_t> replies_;
+};
+
+
+#endif
+
+
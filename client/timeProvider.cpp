@@ -16,43 +16,111 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <cmath>
+#include <limits>
 #include "timeProvider.h"
 #include "aixlog.hpp"
 
 
-TimeProvider::TimeProvider() : diffToServer_(0)
+TimeProvider::TimeProvider() : clockModel_(200), lastTimeSync_(0), lastUdpTimeSync_(0), sequence_(0), reference_(0), offset_(0.), skew_(0.),
+	skewError_(std::numeric_limits<double>::infinity()), offsetError_(std::numeric_limits<double>::infinity()),
+	offsetUncertainty_(std::numeric_limits<double>::infinity())
 {
-	diffBuffer_.setSize(200);
 }
 
 
-void TimeProvider::setDiff(const tv& c2s, const tv& s2c)
+void TimeProvider::setDiff(const tv& c2s, const tv& s2c, Source source)
 {
 //	tv latency = c2s - s2c;
 //	double diff = (latency.sec * 1000. + latency.usec / 1000.) / 2.;
 	double diff = ((double)c2s.sec / 2. - (double)s2c.sec / 2.) * 1000. + ((double)c2s.usec / 2. - (double)s2c.usec / 2.) / 1000.;
-	setDiffToServer(diff);
+	double rtt = ((double)c2s.sec + (double)s2c.sec) * 1000. + ((double)c2s.usec + (double)s2c.usec) / 1000.;
+	setDiffToServer(diff, rtt, source);
 }
 
 
-void TimeProvider::setDiffToServer(double ms)
+void TimeProvider::setDiffToServer(double ms, double rttMs, Source source)
 {
-	static int32_t lastTimeSync = 0;
-	timeval now;
-	chronos::systemtimeofday(&now);
+	std::lock_guard<std::mutex> lock(mutex_);
+	int64_t now = sinceEpoche<chronos::usec>(chronos::clk::now()).count();
 
-	/// clear diffBuffer if last update is older than a minute
-	if (!diffBuffer_.empty() && (std::abs(now.tv_sec - lastTimeSync) > 60))
+	/// UDP time sync is alive if there was a measurement within the last 10s, otherwise fall back to the stream connection
+	bool udpAlive = (lastUdpTimeSync_ != 0) && (std::abs(now - lastUdpTimeSync_) < 10 * 1000000ll);
+	if (source == kUdp)
+	{
+		/// don't mix the less accurate measurements into the model
+		if (!udpAlive && !clockModel_.empty())
+		{
+			LOG(INFO) << "Switching to UDP time sync. Clearing time buffer\n";
+			clockModel_.clear();
+		}
+		lastUdpTimeSync_ = now;
+	}
+	else if (udpAlive)
+		return;
+
+	/// clear the model if last update is older than a minute
+	if (!clockModel_.empty() && (std::abs(now - lastTimeSync_) > 60 * 1000000ll))
 	{
 		LOG(INFO) << "Last time sync older than a minute. Clearing time buffer\n";
-		diffToServer_ = ms*1000;
-		diffBuffer_.clear();
+		clockModel_.clear();
+	}
+	/// or if the local (or server) clock has been set
+	else if (!clockModel_.empty() && (std::fabs(ms * 1000. - clockModel_.offset(now)) > 100000. + rttMs * 500.))
+	{
+		LOG(INFO) << "Time sync off by " << (ms - clockModel_.offset(now) / 1000.) << " ms. Clearing time buffer\n";
+		clockModel_.clear();
 	}
-	lastTimeSync = now.tv_sec;
+	lastTimeSync_ = now;
 
-	diffBuffer_.add(ms*1000);
-	diffToServer_ = diffBuffer_.median(3);
-//	LOG(INFO) << "setDiffToServer: " << ms << ", diff: " << diffToServer_ / 1000.f << "\n";
+	clockModel_.add(now, ms * 1000., rttMs * 1000.);
+	publish();
+//	LOG(INFO) << "setDiffToServer: " << ms << ", diff: " << clockModel_.offset() / 1000. << ", skew: " << clockModel_.skew() * 1000000. << " ppm\n";
+}
+
+
+bool TimeProvider::isSynced(double uncertaintyUs, size_t maxAgeMs) const
+{
+	if (getOffsetUncertainty() > uncertaintyUs)
+		return false;
+	std::lock_guard<std::mutex> lock(mutex_);
+	int64_t now = sinceEpoche<chronos::usec>(chronos::clk::now()).count();
+	return (lastTimeSync_ != 0) && (std::abs(now - lastTimeSync_) < (int64_t)maxAgeMs * 1000);
+}
+
+
+void TimeProvider::publish()
+{
+	sequence_.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	reference_.store(clockModel_.reference(), std::memory_order_relaxed);
+	offset_.store(clockModel_.offset(), std::memory_order_relaxed);
+	skew_.store(clockModel_.skew(), std::memory_order_relaxed);
+	skewError_.store(clockModel_.skewError(), std::memory_order_relaxed);
+	offsetError_.store(clockModel_.offsetError(), std::memory_order_relaxed);
+	offsetUncertainty_.store(clockModel_.offsetUncertainty(), std::memory_order_relaxed);
+	sequence_.fetch_add(1, std::memory_order_release);
+}
+
+
+chronos::usec::rep TimeProvider::diffToServer(const chronos::time_point_clk& local) const
+{
+	int64_t reference;
+	double offset, skew;
+	while (true)
+	{
+		uint32_t sequence = sequence_.load(std::memory_order_acquire);
+		if (sequence & 1)
+			continue;
+		reference = reference_.load(std::memory_order_relaxed);
+		offset = offset_.load(std::memory_order_relaxed);
+		skew = skew_.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence_.load(std::memory_order_relaxed) == sequence)
+			break;
+	}
+	int64_t now = sinceEpoche<chronos::usec>(local).count();
+	return llround(offset + skew * (now - reference));
 }
 
 /*
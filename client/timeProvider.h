@@ -21,7 +21,8 @@
 
 #include <atomic>
 #include <chrono>
-#include "doubleBuffer.h"
+#include <mutex>
+#include "clockModel.h"
 #include "message/message.h"
 #include "common/timeDefs.h"
 
@@ -31,6 +32,10 @@
  * Stores time difference to the server
  * Returns server's local system time.
  * Clients are using the server time to play audio in sync, independent of the client's system time
+ *
+ * The time difference is modeled as offset and skew (see ClockModel), so
+ * that the server time is extrapolated between the time syncs.
+ * The model is published with a sequence lock, reading it is lock free.
  */
 class TimeProvider
 {
@@ -41,15 +46,53 @@ public:
 		return instance;
 	}
 
-	void setDiffToServer(double ms);
-	void setDiff(const tv& c2s, const tv& s2c);
+	/// Channel of a time sync measurement
+	/// The kernel timestamped UDP time sync is more accurate, while its measurements
+	/// are arriving, the measurements over the stream connection are ignored
+	enum Source
+	{
+		kStream = 0,
+		kUdp = 1
+	};
+
+	/// Time sync measurement: server is "ms" ahead, measured with a round trip time of "rttMs"
+	void setDiffToServer(double ms, double rttMs, Source source = kStream);
+	void setDiff(const tv& c2s, const tv& s2c, Source source = kStream);
 
 	template<typename T>
 	inline T getDiffToServer() const
 	{
-		return std::chrono::duration_cast<T>(chronos::usec(diffToServer_));
+		return std::chrono::duration_cast<T>(chronos::usec(diffToServer(now())));
+	}
+
+	/// Drift of the server clock relative to the local clock, e.g. 1e-5 if the server is 10ppm faster
+	double getSkew() const
+	{
+		return skew_.load(std::memory_order_relaxed);
+	}
+
+	/// Standard error of getSkew(), infinity as long as the skew is unknown
+	double getSkewError() const
+	{
+		return skewError_.load(std::memory_order_relaxed);
 	}
 
+	/// Standard deviation of the time sync measurements around the model [us]
+	double getOffsetError() const
+	{
+		return offsetError_.load(std::memory_order_relaxed);
+	}
+
+	/// Standard error of the estimated time difference [us]
+	double getOffsetUncertainty() const
+	{
+		return offsetUncertainty_.load(std::memory_order_relaxed);
+	}
+
+	/// The time difference is known within "uncertaintyUs" and is kept up to date, i.e.
+	/// there was a time sync measurement within the last "maxAgeMs", from any connection
+	bool isSynced(double uncertaintyUs, size_t maxAgeMs = 2000) const;
+
 /*	chronos::usec::rep getDiffToServer();
 	chronos::usec::rep getPercentileDiffToServer(size_t percentile);
 	long getDiffToServerMs();
@@ -73,7 +116,8 @@ public:
 
 	inline static chronos::time_point_clk serverNow()
 	{
-		return chronos::clk::now() + TimeProvider::getInstance().getDiffToServer<chronos::usec>();
+		chronos::time_point_clk now = chronos::clk::now();
+		return now + chronos::usec(TimeProvider::getInstance().diffToServer(now));
 	}
 
 private:
@@ -81,8 +125,24 @@ private:
 	TimeProvider(TimeProvider const&);   // Don't Implement
 	void operator=(TimeProvider const&); // Don't implement
 
-	DoubleBuffer<chronos::usec::rep> diffBuffer_;
-	std::atomic<chronos::usec::rep> diffToServer_;
+	/// server - local [us] at local time "local"
+	chronos::usec::rep diffToServer(const chronos::time_point_clk& local) const;
+	void publish();
+
+	mutable std::mutex mutex_;
+	ClockModel clockModel_;
+	int64_t lastTimeSync_;
+	/// Local time of the last UDP time sync measurement [us], 0 if there was none
+	int64_t lastUdpTimeSync_;
+
+	/// Published clock model, odd sequence numbers while it is written
+	std::atomic<uint32_t> sequence_;
+	std::atomic<int64_t> reference_;
+	std::atomic<double> offset_;
+	std::atomic<double> skew_;
+	std::atomic<double> skewError_;
+	std::atomic<double> offsetError_;
+	std::atomic<double> offsetUncertainty_;
 };
 
 
@@ -0,0 +1,109 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include "common/json.hpp"
+
+
+/// Histogram of latencies with power of two microsecond buckets
+/**
+ * Bucket n counts latencies below 2^n us (and not below 2^(n-1) us), the
+ * last bucket counts everything above.
+ * add is wait free and can be called by one thread, while others read it.
+ */
+class LatencyHistogram
+{
+public:
+	static const size_t buckets = 25;
+
+	LatencyHistogram() : count_(0), sumUs_(0), maxUs_(0)
+	{
+		for (auto& bucket: buckets_)
+			bucket = 0;
+	}
+
+	void add(const std::chrono::nanoseconds& latency)
+	{
+		uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+		size_t bucket = 0;
+		while ((bucket + 1 < buckets) && (us >= (1ull << bucket)))
+			++bucket;
+		buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sumUs_.fetch_add(us, std::memory_order_relaxed);
+		if (us > maxUs_.load(std::memory_order_relaxed))
+			maxUs_.store(us, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const
+	{
+		return count_;
+	}
+
+	/// Upper bound (in us) of the bucket that contains the percentile p [0..1]
+	uint64_t percentileUs(double p) const
+	{
+		uint64_t count = count_;
+		if (count == 0)
+			return 0;
+		uint64_t rank = p * count;
+		uint64_t sum = 0;
+		for (size_t n = 0; n < buckets; ++n)
+		{
+			sum += buckets_[n];
+			if (sum > rank)
+				return (1ull << n);
+		}
+		return maxUs_;
+	}
+
+	/// count, mean, max, p50, p99 and the non empty buckets as {"ltUs": upper bound, "count": n}
+	nlohmann::json toJson() const
+	{
+		nlohmann::json j;
+		uint64_t count = count_;
+		j["count"] = count;
+		j["meanUs"] = (count == 0) ? 0. : (double)sumUs_ / count;
+		j["maxUs"] = maxUs_.load();
+		j["p50Us"] = percentileUs(0.5);
+		j["p99Us"] = percentileUs(0.99);
+		nlohmann::json jBuckets = nlohmann::json::array();
+		for (size_t n = 0; n < buckets; ++n)
+		{
+			if (buckets_[n] > 0)
+				jBuckets.push_back({{"ltUs", (1ull << n)}, {"count", buckets_[n].load()}});
+		}
+		j["buckets"] = jBuckets;
+		return j;
+	}
+
+private:
+	std::atomic<uint64_t> buckets_[buckets];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sumUs_;
+	std::atomic<uint64_t> maxUs_;
+};
+
+
+#endif
+
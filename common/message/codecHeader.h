@@ -32,12 +32,12 @@ class CodecHeader : public BaseMessage
 public:
 	CodecHeader(const std::string& codecName = "", size_t size = 0) : BaseMessage(message_type::kCodecHeader), payloadSize(size), codec(codecName)
 	{
-		payload = (char*)malloc(size);
+		payload = PayloadPool::instance().allocate(size);
 	}
 
 	virtual ~CodecHeader()
 	{
-		free(payload);
+		PayloadPool::instance().release(payload);
 	}
 
 	virtual void read(std::istream& stream)
@@ -46,7 +46,7 @@ public:
 		readVal(stream, &payload, payloadSize);
 	}
 
-	virtual uint32_t getSize() const
+	virtual uint32_t getSize(uint16_t version) const
 	{
 		return sizeof(uint32_t) + codec.size() + sizeof(uint32_t) + payloadSize;
 	}
@@ -56,7 +56,7 @@ public:
 	std::string codec;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t version) const
 	{
 		writeVal(stream, codec);
 		writeVal(stream, payload, payloadSize);
@@ -35,7 +35,7 @@ public:
 	{
 	}
 
-	Hello(const std::string& macAddress, const std::string& id, size_t instance) : JsonMessage(message_type::kHello)
+	Hello(const std::string& macAddress, const std::string& id, size_t instance, const std::string& codec = "") : JsonMessage(message_type::kHello)
 	{
 		msg["MAC"] = macAddress;
 		msg["HostName"] = ::getHostName();
@@ -46,6 +46,8 @@ public:
 		msg["Instance"] = instance;
 		msg["ID"] = id;
 		msg["SnapStreamProtocolVersion"] = 2;
+		msg["Capabilities"] = capability::kCapProtocolV2;
+		msg["Codec"] = codec;
 	}
 
 	virtual ~Hello()
@@ -92,6 +94,18 @@ public:
 		return get("SnapStreamProtocolVersion", 1);
 	}
 
+	/// Bitmask of "capability" flags, supported by the client
+	uint32_t getCapabilities() const
+	{
+		return get("Capabilities", 0);
+	}
+
+	/// Preferred codec, empty if the client has no preference
+	std::string getCodec() const
+	{
+		return get("Codec", std::string(""));
+	}
+
 	std::string getId() const
 	{
 		return get("ID", getMacAddress());
@@ -47,7 +47,7 @@ public:
 		msg = json::parse(s);
 	}
 
-	virtual uint32_t getSize() const
+	virtual uint32_t getSize(uint16_t version) const
 	{
 		return sizeof(uint32_t) + msg.dump().size();
 	}
@@ -56,7 +56,7 @@ public:
 
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t version) const
 	{
 		writeVal(stream, msg.dump());
 	}
@@ -26,6 +26,7 @@
 #include <vector>
 #include <sys/time.h>
 #include "common/endian.hpp"
+#include "common/payloadPool.h"
 #include "common/timeDefs.h"
 
 /*
@@ -49,6 +50,21 @@ struct membuf : public std::basic_streambuf<char>
 };
 
 
+/// Output counterpart of membuf, writes into a fixed size buffer
+struct omembuf : public std::basic_streambuf<char>
+{
+	omembuf(char* begin, char* end)
+	{
+		this->setp(begin, end);
+	}
+
+	size_t written() const
+	{
+		return this->pptr() - this->pbase();
+	}
+};
+
+
 enum message_type
 {
 	kBase = 0,
@@ -64,6 +80,14 @@ enum message_type
 };
 
 
+/// Capabilities, announced by the client in Hello. ServerSettings contains the negotiated subset
+enum capability
+{
+	/// Protocol version 2: 32 bit ids, 64 bit nanosecond timestamps, sequence numbered chunks
+	kCapProtocolV2 = 0x01
+};
+
+
 
 struct tv
 {
@@ -77,6 +101,22 @@ struct tv
 	tv(timeval tv) : sec(tv.tv_sec), usec(tv.tv_usec) {};
 	tv(int32_t _sec, int32_t _usec) : sec(_sec), usec(_usec) {};
 
+	static tv fromNs(int64_t ns)
+	{
+		tv result(ns / 1000000000, (ns % 1000000000) / 1000);
+		if (result.usec < 0)
+		{
+			result.sec -= 1;
+			result.usec += 1000000;
+		}
+		return result;
+	}
+
+	int64_t toNs() const
+	{
+		return (int64_t)sec * 1000000000 + (int64_t)usec * 1000;
+	}
+
 	int32_t sec;
 	int32_t usec;
 
@@ -112,17 +152,20 @@ namespace msg
 
 const size_t max_size = 1000000;
 
+/// Version 2 headers are marked in the type field, so that both header versions can be read at any time
+const uint16_t protocol_v2_flag = 0x8000;
+
 struct BaseMessage;
 
 using message_ptr = std::shared_ptr<msg::BaseMessage>;
 
 struct BaseMessage
 {
-	BaseMessage() : type(kBase), id(0), refersTo(0)
+	BaseMessage() : type(kBase), id(0), refersTo(0), version(1)
 	{
 	}
 
-	BaseMessage(message_type type_) : type(type_), id(0), refersTo(0)
+	BaseMessage(message_type type_) : type(type_), id(0), refersTo(0), version(1)
 	{
 	}
 
@@ -132,63 +175,131 @@ struct BaseMessage
 
 	virtual void read(std::istream& stream)
 	{
-		readVal(stream, type);
-		readVal(stream, id);
-		readVal(stream, refersTo);
-		readVal(stream, sent.sec);
-		readVal(stream, sent.usec);
-		readVal(stream, received.sec);
-		readVal(stream, received.usec);
-		readVal(stream, size);
+		char header[header_v2_size];
+		stream.read(header, header_size);
+		if (isV2Header(header))
+			stream.read(header + header_size, header_v2_size - header_size);
+		deserialize(header);
 	}
 
-	void deserialize(char* payload)
+	/// Version 2 header? Needs the first 2 bytes of the header
+	static bool isV2Header(const char* header)
 	{
-		membuf databuf(payload, payload + BaseMessage::getSize());
-		std::istream is(&databuf);
-		read(is);
+		uint16_t type;
+		memcpy(&type, header, sizeof(uint16_t));
+		return (SWAP_16(type) & protocol_v2_flag) != 0;
+	}
+
+	/// Decodes the fixed size header directly from the bytes.
+	/// A version 1 header has header_size bytes, a version 2 header (see isV2Header) header_v2_size bytes
+	void deserialize(const char* payload)
+	{
+		readVal(payload, type);
+		if (type & protocol_v2_flag)
+		{
+			version = 2;
+			type &= ~protocol_v2_flag;
+			uint16_t flags;
+			readVal(payload, flags);
+			readVal(payload, id);
+			readVal(payload, refersTo);
+			int64_t ns;
+			readVal(payload, ns);
+			sent = tv::fromNs(ns);
+			readVal(payload, ns);
+			received = tv::fromNs(ns);
+		}
+		else
+		{
+			version = 1;
+			uint16_t val;
+			readVal(payload, val);
+			id = val;
+			readVal(payload, val);
+			refersTo = val;
+			readVal(payload, sent.sec);
+			readVal(payload, sent.usec);
+			readVal(payload, received.sec);
+			readVal(payload, received.usec);
+		}
+		readVal(payload, size);
 	}
 
 	void deserialize(const BaseMessage& baseMessage, char* payload)
 	{
-		type = baseMessage.type;
-		id = baseMessage.id;
-		refersTo = baseMessage.refersTo;
-		sent = baseMessage.sent;
-		received = baseMessage.received;
-		size = baseMessage.size;
+		setBaseMessage(baseMessage);
 		membuf databuf(payload, payload + size);
 		std::istream is(&databuf);
 		read(is);
 	}
 
-	virtual void serialize(std::ostream& stream) const
+	/// Serializes the message in protocol "version"
+	/// The message is not modified, so that it can be serialized for several clients in parallel
+	virtual void serialize(std::ostream& stream, uint16_t version) const
 	{
-		writeVal(stream, type);
-		writeVal(stream, id);
-		writeVal(stream, refersTo);
-		writeVal(stream, sent.sec);
-		writeVal(stream, sent.usec);
-		writeVal(stream, received.sec);
-		writeVal(stream, received.usec);
-		size = getSize();
-		writeVal(stream, size);
-		doserialize(stream);
+		if (version >= 2)
+		{
+			writeVal(stream, (uint16_t)(type | protocol_v2_flag));
+			/// flags, reserved for future use
+			writeVal(stream, (uint16_t)0);
+			writeVal(stream, id);
+			writeVal(stream, refersTo);
+			writeVal(stream, sent.toNs());
+			writeVal(stream, received.toNs());
+		}
+		else
+		{
+			writeVal(stream, type);
+			writeVal(stream, (uint16_t)id);
+			writeVal(stream, (uint16_t)refersTo);
+			writeVal(stream, sent.sec);
+			writeVal(stream, sent.usec);
+			writeVal(stream, received.sec);
+			writeVal(stream, received.usec);
+		}
+		writeVal(stream, getSize(version));
+		doserialize(stream, version);
 	}
 
-	virtual uint32_t getSize() const
+	/// Size of the serialized message in protocol "version", without the BaseMessage header
+	virtual uint32_t getSize(uint16_t version) const
 	{
-		return 3*sizeof(uint16_t) + 2*sizeof(tv) + sizeof(uint32_t);
+		return getHeaderSize(version);
 	};
 
+	static uint32_t getHeaderSize(uint16_t version)
+	{
+		if (version >= 2)
+			return header_v2_size;
+		return header_size;
+	}
+
+	/// Size of the serialized version 1 BaseMessage, that preceeds every message
+	static const uint32_t header_size = 3*sizeof(uint16_t) + 2*sizeof(tv) + sizeof(uint32_t);
+	/// Version 2: type, flags, 32 bit id and refersTo, 64 bit nanosecond timestamps, size
+	static const uint32_t header_v2_size = 2*sizeof(uint16_t) + 2*sizeof(uint32_t) + 2*sizeof(int64_t) + sizeof(uint32_t);
+
 	uint16_t type;
-	mutable uint16_t id;
-	uint16_t refersTo;
+	mutable uint32_t id;
+	uint32_t refersTo;
 	tv received;
 	mutable tv sent;
-	mutable uint32_t size;
+	uint32_t size;
+	/// Protocol version of a received message, set when the message is decoded
+	uint16_t version;
 
 protected:
+	void setBaseMessage(const BaseMessage& baseMessage)
+	{
+		type = baseMessage.type;
+		id = baseMessage.id;
+		refersTo = baseMessage.refersTo;
+		sent = baseMessage.sent;
+		received = baseMessage.received;
+		size = baseMessage.size;
+		version = baseMessage.version;
+	}
+
 	void writeVal(std::ostream& stream, const bool& val) const
 	{
 		char c = val?1:0;
@@ -224,6 +335,18 @@ protected:
 		stream.write(reinterpret_cast<const char*>(&v), sizeof(int32_t));
 	}
 
+	void writeVal(std::ostream& stream, const uint64_t& val) const
+	{
+		uint64_t v = SWAP_64(val);
+		stream.write(reinterpret_cast<const char*>(&v), sizeof(uint64_t));
+	}
+
+	void writeVal(std::ostream& stream, const int64_t& val) const
+	{
+		uint64_t v = SWAP_64(val);
+		stream.write(reinterpret_cast<const char*>(&v), sizeof(int64_t));
+	}
+
 	void writeVal(std::ostream& stream, const char* payload, const uint32_t& size) const
 	{
 		writeVal(stream, size);
@@ -274,10 +397,22 @@ protected:
 		val = SWAP_32(val);
 	}
 
+	void readVal(std::istream& stream, uint64_t& val) const
+	{
+		stream.read(reinterpret_cast<char*>(&val), sizeof(uint64_t));
+		val = SWAP_64(val);
+	}
+
+	void readVal(std::istream& stream, int64_t& val) const
+	{
+		stream.read(reinterpret_cast<char*>(&val), sizeof(int64_t));
+		val = SWAP_64(val);
+	}
+
 	void readVal(std::istream& stream, char** payload, uint32_t& size) const
 	{
 		readVal(stream, size);
-		*payload = (char*)realloc(*payload, size);
+		*payload = PayloadPool::instance().reallocate(*payload, size);
 		stream.read(*payload, size);
 	}
 
@@ -290,7 +425,44 @@ protected:
 	}
 
 
-	virtual void doserialize(std::ostream& stream) const
+	/// Decode fixed size fields directly from the bytes and advance the data pointer
+	void readVal(const char*& data, uint16_t& val) const
+	{
+		memcpy(&val, data, sizeof(uint16_t));
+		val = SWAP_16(val);
+		data += sizeof(uint16_t);
+	}
+
+	void readVal(const char*& data, uint32_t& val) const
+	{
+		memcpy(&val, data, sizeof(uint32_t));
+		val = SWAP_32(val);
+		data += sizeof(uint32_t);
+	}
+
+	void readVal(const char*& data, int32_t& val) const
+	{
+		memcpy(&val, data, sizeof(int32_t));
+		val = SWAP_32(val);
+		data += sizeof(int32_t);
+	}
+
+	void readVal(const char*& data, uint64_t& val) const
+	{
+		memcpy(&val, data, sizeof(uint64_t));
+		val = SWAP_64(val);
+		data += sizeof(uint64_t);
+	}
+
+	void readVal(const char*& data, int64_t& val) const
+	{
+		memcpy(&val, data, sizeof(int64_t));
+		val = SWAP_64(val);
+		data += sizeof(int64_t);
+	}
+
+
+	virtual void doserialize(std::ostream& stream, uint16_t version) const
 	{
 	};
 };
@@ -34,6 +34,7 @@ public:
 		setLatency(0);
 		setVolume(100);
 		setMuted(false);
+		setCapabilities(0);
 	}
 
 	virtual ~ServerSettings()
@@ -60,6 +61,18 @@ public:
 		return get("muted", false);
 	}
 
+	/// Negotiated "capability" flags, supported by client and server
+	uint32_t getCapabilities()
+	{
+		return get("capabilities", 0);
+	}
+
+	/// UDP time sync port of the server, 0 if not available
+	size_t getTimePort()
+	{
+		return get("timePort", 0);
+	}
+
 
 
 	void setBufferMs(int32_t bufferMs)
@@ -81,6 +94,16 @@ public:
 	{
 		msg["muted"] = muted;
 	}
+
+	void setCapabilities(uint32_t capabilities)
+	{
+		msg["capabilities"] = capabilities;
+	}
+
+	void setTimePort(size_t timePort)
+	{
+		msg["timePort"] = timePort;
+	}
 };
 
 }
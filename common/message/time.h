@@ -37,22 +37,40 @@ public:
 
 	virtual void read(std::istream& stream)
 	{
-		readVal(stream, latency.sec);
-		readVal(stream, latency.usec);
+		if (version >= 2)
+		{
+			int64_t ns;
+			readVal(stream, ns);
+			latency = tv::fromNs(ns);
+		}
+		else
+		{
+			readVal(stream, latency.sec);
+			readVal(stream, latency.usec);
+		}
 	}
 
-	virtual uint32_t getSize() const
+	virtual uint32_t getSize(uint16_t version) const
 	{
+		if (version >= 2)
+			return sizeof(int64_t);
 		return sizeof(tv);
 	}
 
 	tv latency;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t version) const
 	{
-		writeVal(stream, latency.sec);
-		writeVal(stream, latency.usec);
+		if (version >= 2)
+		{
+			writeVal(stream, latency.toNs());
+		}
+		else
+		{
+			writeVal(stream, latency.sec);
+			writeVal(stream, latency.usec);
+		}
 	}
 };
 
@@ -39,48 +39,106 @@ namespace msg
 class WireChunk : public BaseMessage
 {
 public:
-	WireChunk(size_t size = 0) : BaseMessage(message_type::kWireChunk), payloadSize(size)
+	WireChunk(size_t size = 0) : BaseMessage(message_type::kWireChunk), sequence(0), payloadSize(size)
 	{
-		payload = (char*)malloc(size);
+		payload = PayloadPool::instance().allocate(size);
 	}
 
-	WireChunk(const WireChunk& wireChunk) : BaseMessage(message_type::kWireChunk), timestamp(wireChunk.timestamp), payloadSize(wireChunk.payloadSize)
+	WireChunk(const WireChunk& wireChunk) : BaseMessage(message_type::kWireChunk), timestamp(wireChunk.timestamp), sequence(wireChunk.sequence), payloadSize(wireChunk.payloadSize)
 	{
-		payload = (char*)malloc(payloadSize);
+		payload = PayloadPool::instance().allocate(payloadSize);
 		memcpy(payload, wireChunk.payload, payloadSize);
 	}
 
 	virtual ~WireChunk()
 	{
-		free(payload);
+		PayloadPool::instance().release(payload);
 	}
 
 	virtual void read(std::istream& stream)
 	{
-		readVal(stream, timestamp.sec);
-		readVal(stream, timestamp.usec);
+		if (version >= 2)
+		{
+			int64_t ns;
+			readVal(stream, ns);
+			timestamp = tv::fromNs(ns);
+			readVal(stream, sequence);
+		}
+		else
+		{
+			readVal(stream, timestamp.sec);
+			readVal(stream, timestamp.usec);
+		}
 		readVal(stream, &payload, payloadSize);
 	}
 
-	virtual uint32_t getSize() const
+	/// Decodes timestamp, sequence and payload size (getChunkHeaderSize(version) bytes) directly from data and allocates the payload.
+	/// The payload can then be filled in place, e.g. directly from the socket, without further copying
+	/// @return false if the payload size doesn't match the message size
+	bool deserializeHeader(const BaseMessage& baseMessage, const char* data)
 	{
-		return sizeof(tv) + sizeof(int32_t) + payloadSize;
+		setBaseMessage(baseMessage);
+		if (version >= 2)
+		{
+			int64_t ns;
+			readVal(data, ns);
+			timestamp = tv::fromNs(ns);
+			readVal(data, sequence);
+		}
+		else
+		{
+			readVal(data, timestamp.sec);
+			readVal(data, timestamp.usec);
+		}
+		readVal(data, payloadSize);
+		if (getSize(version) != size)
+			return false;
+		payload = PayloadPool::instance().reallocate(payload, payloadSize);
+		return true;
 	}
 
+	virtual uint32_t getSize(uint16_t version) const
+	{
+		return getChunkHeaderSize(version) + payloadSize;
+	}
+
+	static uint32_t getChunkHeaderSize(uint16_t version)
+	{
+		if (version >= 2)
+			return chunk_header_v2_size;
+		return chunk_header_size;
+	}
+
+	/// Size of the timestamp and payload size, that preceed the payload
+	static const uint32_t chunk_header_size = sizeof(tv) + sizeof(int32_t);
+	/// Version 2: 64 bit nanosecond timestamp, 64 bit sequence number and payload size
+	static const uint32_t chunk_header_v2_size = sizeof(int64_t) + sizeof(uint64_t) + sizeof(int32_t);
+
 	virtual chronos::time_point_clk start() const
 	{
 		return chronos::time_point_clk(chronos::sec(timestamp.sec) + chronos::usec(timestamp.usec));
 	}
 
 	tv timestamp;
+	/// Per stream, monotonically increasing. Only transmitted with protocol version 2, else 0
+	uint64_t sequence;
 	uint32_t payloadSize;
+	/// Allocated from the PayloadPool, resize with PayloadPool::reallocate
 	char* payload;
 
 protected:
-	virtual void doserialize(std::ostream& stream) const
+	virtual void doserialize(std::ostream& stream, uint16_t version) const
 	{
-		writeVal(stream, timestamp.sec);
-		writeVal(stream, timestamp.usec);
+		if (version >= 2)
+		{
+			writeVal(stream, timestamp.toNs());
+			writeVal(stream, sequence);
+		}
+		else
+		{
+			writeVal(stream, timestamp.sec);
+			writeVal(stream, timestamp.usec);
+		}
 		writeVal(stream, payload, payloadSize);
 	}
 };
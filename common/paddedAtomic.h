@@ -0,0 +1,49 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef PADDED_ATOMIC_H
+#define PADDED_ATOMIC_H
+
+#include <atomic>
+#include <cstddef>
+
+
+/// Atomic that never shares a cache line with the members around it
+/**
+ * Separated by padding instead of alignas, because C++11 "new" doesn't
+ * honor extended alignment, and warns for every class that contains an
+ * over-aligned member.
+ */
+template <typename T>
+struct PaddedAtomic
+{
+	static const size_t cacheLine = 64;
+
+	PaddedAtomic(T v) : value(v)
+	{
+	}
+
+	char paddingBefore[cacheLine - sizeof(std::atomic<T>)];
+	std::atomic<T> value;
+	char paddingAfter[cacheLine - sizeof(std::atomic<T>)];
+};
+
+
+#endif
+
@@ -0,0 +1,151 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "common/payloadPool.h"
+
+
+PayloadPool::PayloadPool() : allocations_(0), poolHits_(0), heapAllocations_(0), heapFrees_(0), inUse_(0), cached_(0)
+{
+	for (size_t n = 0; n < kClasses; ++n)
+	{
+		size_t maxBlocks = kMaxCachedBytes / classSize(n);
+		freeLists_[n].maxBlocks = (maxBlocks < 16) ? 16 : maxBlocks;
+		freeLists_[n].blocks.reserve(16);
+	}
+}
+
+
+size_t PayloadPool::classSize(size_t sizeClass)
+{
+	return (size_t)1 << (sizeClass + kMinClassBits);
+}
+
+
+uint32_t PayloadPool::sizeClassOf(size_t size)
+{
+	uint32_t sizeClass = 0;
+	while ((sizeClass < kClasses) && (classSize(sizeClass) < size))
+		++sizeClass;
+	return (sizeClass < kClasses) ? sizeClass : kHeap;
+}
+
+
+PayloadPool::BlockHeader* PayloadPool::header(const char* payload)
+{
+	return reinterpret_cast<BlockHeader*>(const_cast<char*>(payload) - sizeof(BlockHeader));
+}
+
+
+size_t PayloadPool::capacity(const char* payload)
+{
+	if (payload == NULL)
+		return 0;
+	return header(payload)->size;
+}
+
+
+char* PayloadPool::allocate(size_t size)
+{
+	allocations_.fetch_add(1, std::memory_order_relaxed);
+	uint32_t sizeClass = sizeClassOf(size);
+	char* block = NULL;
+	if (sizeClass != kHeap)
+	{
+		FreeList& freeList = freeLists_[sizeClass];
+		std::lock_guard<std::mutex> lock(freeList.mutex);
+		if (!freeList.blocks.empty())
+		{
+			block = freeList.blocks.back();
+			freeList.blocks.pop_back();
+		}
+	}
+
+	if (block != NULL)
+	{
+		poolHits_.fetch_add(1, std::memory_order_relaxed);
+		cached_.fetch_sub(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		size_t blockSize = (sizeClass != kHeap) ? classSize(sizeClass) : size;
+		block = (char*)malloc(sizeof(BlockHeader) + blockSize);
+		if (block == NULL)
+			throw std::bad_alloc();
+		heapAllocations_.fetch_add(1, std::memory_order_relaxed);
+		BlockHeader* blockHeader = reinterpret_cast<BlockHeader*>(block);
+		blockHeader->sizeClass = sizeClass;
+		blockHeader->size = blockSize;
+	}
+	inUse_.fetch_add(1, std::memory_order_relaxed);
+	return block + sizeof(BlockHeader);
+}
+
+
+char* PayloadPool::reallocate(char* payload, size_t size)
+{
+	if (payload == NULL)
+		return allocate(size);
+	if (header(payload)->size >= size)
+		return payload;
+
+	char* result = allocate(size);
+	memcpy(result, payload, header(payload)->size);
+	release(payload);
+	return result;
+}
+
+
+void PayloadPool::release(char* payload)
+{
+	if (payload == NULL)
+		return;
+
+	BlockHeader* blockHeader = header(payload);
+	inUse_.fetch_sub(1, std::memory_order_relaxed);
+	if (blockHeader->sizeClass != kHeap)
+	{
+		FreeList& freeList = freeLists_[blockHeader->sizeClass];
+		std::lock_guard<std::mutex> lock(freeList.mutex);
+		if (freeList.blocks.size() < freeList.maxBlocks)
+		{
+			freeList.blocks.push_back(payload - sizeof(BlockHeader));
+			cached_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	heapFrees_.fetch_add(1, std::memory_order_relaxed);
+	free(blockHeader);
+}
+
+
+nlohmann::json PayloadPool::toJson() const
+{
+	nlohmann::json j;
+	j["allocations"] = allocations_.load();
+	j["poolHits"] = poolHits_.load();
+	j["heapAllocations"] = heapAllocations_.load();
+	j["heapFrees"] = heapFrees_.load();
+	j["inUse"] = inUse_.load();
+	j["cached"] = cached_.load();
+	return j;
+}
+
+
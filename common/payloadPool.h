@@ -0,0 +1,112 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef PAYLOAD_POOL_H
+#define PAYLOAD_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "common/json.hpp"
+
+
+/// Pool for chunk payloads
+/**
+ * Encoded and decoded chunks are created and destroyed at the chunk rate and
+ * their payloads grow while they are filled, which used to be a malloc, some
+ * reallocs and a free per chunk and per thread involved.
+ * Buffers are handed out in power of two size classes (64 bytes to 1 MB). Each
+ * buffer knows its class, so growing it within the class doesn't copy, and
+ * released buffers are kept per class for reuse. In steady state the chunk
+ * sizes don't change and there is no heap traffic at all, what can be
+ * verified with the counters. Larger buffers are plain heap allocations.
+ * All functions are thread safe, a buffer can be released by another thread.
+ */
+class PayloadPool
+{
+public:
+	static PayloadPool& instance()
+	{
+		/// never destroyed, chunks might be released during static destruction
+		static PayloadPool* instance_ = new PayloadPool();
+		return *instance_;
+	}
+
+	/// Buffer for at least "size" bytes
+	char* allocate(size_t size);
+
+	/// Like realloc: returns a buffer for at least "size" bytes with the content of "payload".
+	/// "payload" is returned unchanged if it is large enough, it might be NULL.
+	char* reallocate(char* payload, size_t size);
+
+	/// Returns the buffer to the pool, NULL is ignored
+	void release(char* payload);
+
+	/// Number of bytes that can be used without reallocation
+	static size_t capacity(const char* payload);
+
+	/// allocations, pool hits, heap allocations, heap frees, buffers in use and cached
+	nlohmann::json toJson() const;
+
+private:
+	PayloadPool();
+	PayloadPool(const PayloadPool&) = delete;
+	PayloadPool& operator=(const PayloadPool&) = delete;
+
+	static const size_t kMinClassBits = 6;
+	static const size_t kClasses = 15;
+	/// Class of the heap allocations, that are too large for the pool
+	static const uint32_t kHeap = 0xffffffff;
+	/// Max bytes cached per class
+	static const size_t kMaxCachedBytes = 4 * 1024 * 1024;
+
+	/// Preceeds every buffer, 16 bytes to keep the payload aligned
+	struct BlockHeader
+	{
+		uint64_t sizeClass;
+		uint64_t size;
+	};
+
+	struct FreeList
+	{
+		std::mutex mutex;
+		std::vector<char*> blocks;
+		size_t maxBlocks;
+	};
+
+	static size_t classSize(size_t sizeClass);
+	static uint32_t sizeClassOf(size_t size);
+	static BlockHeader* header(const char* payload);
+
+	FreeList freeLists_[kClasses];
+
+	std::atomic<uint64_t> allocations_;
+	std::atomic<uint64_t> poolHits_;
+	std::atomic<uint64_t> heapAllocations_;
+	std::atomic<uint64_t> heapFrees_;
+	std::atomic<int64_t> inUse_;
+	std::atomic<int64_t> cached_;
+};
+
+
+
+#endif
+
+
@@ -0,0 +1,655 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include "common/sampleConversion.h"
+#include "common/endian.hpp"
+#include "aixlog.hpp"
+
+#if !defined(IS_BIG_ENDIAN) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define SAMPLE_X86
+#	include <cpuid.h>
+#	include <immintrin.h>
+#	define TARGET(isa) __attribute__((target(isa)))
+#elif !defined(IS_BIG_ENDIAN) && defined(__ARM_NEON)
+#	define SAMPLE_NEON
+#	include <arm_neon.h>
+#endif
+
+
+namespace sample
+{
+
+namespace
+{
+
+/// Kernels for 16 bit samples, one set per instruction set
+/**
+ * The vectorized kernels process blocks of 4 to 16 samples and leave the
+ * remainder to the scalar kernels. Input and output are native endian,
+ * so they are only used on little endian hosts.
+ */
+struct Kernels
+{
+	const char* isa;
+	void (*int16ToInt32)(const int16_t* in, int32_t* out, size_t samples);
+	void (*int16ToFloat)(const int16_t* in, float* out, size_t samples, float scale);
+	void (*deinterleave16)(const int16_t* in, float* left, float* right, size_t frames, float scale);
+	void (*interleaveFloat16)(const float* left, const float* right, int16_t* out, size_t frames, float scale);
+	void (*interleaveInt16)(const int32_t* left, const int32_t* right, int16_t* out, size_t frames, int shift);
+};
+
+
+inline int64_t shifted(int64_t value, int shift)
+{
+	if (shift >= 0)
+		return value >> shift;
+	return value * (1ll << -shift);
+}
+
+
+inline int16_t toInt16(float value)
+{
+	return static_cast<int16_t>(std::lrint(std::max(-32768.f, std::min(value, 32767.f))));
+}
+
+
+inline int16_t toInt16(int32_t value, int shift)
+{
+	return static_cast<int16_t>(std::max<int64_t>(-32768, std::min<int64_t>(shifted(value, shift), 32767)));
+}
+
+
+
+/////////////////////////////////// scalar ///////////////////////////////////
+
+void int16ToInt32Scalar(const int16_t* in, int32_t* out, size_t samples)
+{
+	for (size_t i = 0; i < samples; ++i)
+		out[i] = in[i];
+}
+
+
+void int16ToFloatScalar(const int16_t* in, float* out, size_t samples, float scale)
+{
+	for (size_t i = 0; i < samples; ++i)
+		out[i] = in[i] * scale;
+}
+
+
+void deinterleave16Scalar(const int16_t* in, float* left, float* right, size_t frames, float scale)
+{
+	for (size_t i = 0; i < frames; ++i)
+	{
+		left[i] = in[2 * i] * scale;
+		right[i] = in[2 * i + 1] * scale;
+	}
+}
+
+
+void interleaveFloat16Scalar(const float* left, const float* right, int16_t* out, size_t frames, float scale)
+{
+	for (size_t i = 0; i < frames; ++i)
+	{
+		out[2 * i] = toInt16(left[i] * scale);
+		out[2 * i + 1] = toInt16(right[i] * scale);
+	}
+}
+
+
+void interleaveInt16Scalar(const int32_t* left, const int32_t* right, int16_t* out, size_t frames, int shift)
+{
+	for (size_t i = 0; i < frames; ++i)
+	{
+		out[2 * i] = toInt16(left[i], shift);
+		out[2 * i + 1] = toInt16(right[i], shift);
+	}
+}
+
+
+
+//////////////////////////////////// x86 /////////////////////////////////////
+
+#ifdef SAMPLE_X86
+
+TARGET("sse2") void int16ToInt32Sse2(const int16_t* in, int32_t* out, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+		_mm_storeu_si128((__m128i*)(out + i + 4), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+	}
+	int16ToInt32Scalar(in + i, out + i, samples - i);
+}
+
+
+TARGET("sse2") void int16ToFloatSse2(const int16_t* in, float* out, size_t samples, float scale)
+{
+	const __m128 factor = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), factor));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), factor));
+	}
+	int16ToFloatScalar(in + i, out + i, samples - i, scale);
+}
+
+
+TARGET("sse2") void deinterleave16Sse2(const int16_t* in, float* left, float* right, size_t frames, float scale)
+{
+	const __m128 factor = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		/// every 32 bit lane holds one frame: left in the lower, right in the upper half
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+		_mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16)), factor));
+		_mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(v, 16)), factor));
+	}
+	deinterleave16Scalar(in + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+
+TARGET("sse2") void interleaveFloat16Sse2(const float* left, const float* right, int16_t* out, size_t frames, float scale)
+{
+	const __m128 factor = _mm_set1_ps(scale);
+	const __m128 lower = _mm_set1_ps(-32768.f);
+	const __m128 upper = _mm_set1_ps(32767.f);
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128i l = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(left + i), factor), lower), upper));
+		__m128i r = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(right + i), factor), lower), upper));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+	}
+	interleaveFloat16Scalar(left + i, right + i, out + 2 * i, frames - i, scale);
+}
+
+
+TARGET("sse2") void interleaveInt16Sse2(const int32_t* left, const int32_t* right, int16_t* out, size_t frames, int shift)
+{
+	size_t i = 0;
+	if (shift >= 0)
+	{
+		const __m128i count = _mm_cvtsi32_si128(shift);
+		for (; i + 4 <= frames; i += 4)
+		{
+			__m128i l = _mm_sra_epi32(_mm_loadu_si128((const __m128i*)(left + i)), count);
+			__m128i r = _mm_sra_epi32(_mm_loadu_si128((const __m128i*)(right + i)), count);
+			_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+		}
+	}
+	interleaveInt16Scalar(left + i, right + i, out + 2 * i, frames - i, shift);
+}
+
+
+TARGET("avx2") void int16ToInt32Avx2(const int16_t* in, int32_t* out, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i))));
+	int16ToInt32Scalar(in + i, out + i, samples - i);
+}
+
+
+TARGET("avx2") void int16ToFloatAvx2(const int16_t* in, float* out, size_t samples, float scale)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), factor));
+	}
+	int16ToFloatScalar(in + i, out + i, samples - i, scale);
+}
+
+
+TARGET("avx2") void deinterleave16Avx2(const int16_t* in, float* left, float* right, size_t frames, float scale)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= frames; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + 2 * i));
+		_mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16)), factor));
+		_mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16)), factor));
+	}
+	deinterleave16Scalar(in + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+
+/// unpack and pack work on 128 bit lanes, the two lanes hold frames 0-3 and 4-7, in order
+TARGET("avx2") void interleaveFloat16Avx2(const float* left, const float* right, int16_t* out, size_t frames, float scale)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	const __m256 lower = _mm256_set1_ps(-32768.f);
+	const __m256 upper = _mm256_set1_ps(32767.f);
+	size_t i = 0;
+	for (; i + 8 <= frames; i += 8)
+	{
+		__m256i l = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(left + i), factor), lower), upper));
+		__m256i r = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(right + i), factor), lower), upper));
+		_mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_packs_epi32(_mm256_unpacklo_epi32(l, r), _mm256_unpackhi_epi32(l, r)));
+	}
+	interleaveFloat16Scalar(left + i, right + i, out + 2 * i, frames - i, scale);
+}
+
+
+TARGET("avx2") void interleaveInt16Avx2(const int32_t* left, const int32_t* right, int16_t* out, size_t frames, int shift)
+{
+	size_t i = 0;
+	if (shift >= 0)
+	{
+		const __m128i count = _mm_cvtsi32_si128(shift);
+		for (; i + 8 <= frames; i += 8)
+		{
+			__m256i l = _mm256_sra_epi32(_mm256_loadu_si256((const __m256i*)(left + i)), count);
+			__m256i r = _mm256_sra_epi32(_mm256_loadu_si256((const __m256i*)(right + i)), count);
+			_mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_packs_epi32(_mm256_unpacklo_epi32(l, r), _mm256_unpackhi_epi32(l, r)));
+		}
+	}
+	interleaveInt16Scalar(left + i, right + i, out + 2 * i, frames - i, shift);
+}
+
+
+bool hasSse2()
+{
+#ifdef __x86_64__
+	return true;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & bit_SSE2) != 0;
+#endif
+}
+
+
+bool hasAvx2()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return false;
+	/// the OS must save the SSE and AVX registers on context switches
+	unsigned int xcr0, xcr0High;
+	__asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+	if ((xcr0 & 0x6) != 0x6)
+		return false;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & bit_AVX2) != 0;
+}
+
+#endif
+
+
+
+//////////////////////////////////// NEON ////////////////////////////////////
+
+#ifdef SAMPLE_NEON
+
+inline int32x4_t roundNeon(float32x4_t value)
+{
+#ifdef __aarch64__
+	return vcvtnq_s32_f32(value);
+#else
+	/// ARMv7 can only truncate: round half away from zero
+	uint32x4_t negative = vcltq_f32(value, vdupq_n_f32(0.f));
+	return vcvtq_s32_f32(vaddq_f32(value, vbslq_f32(negative, vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f))));
+#endif
+}
+
+
+void int16ToInt32Neon(const int16_t* in, int32_t* out, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		int16x8_t v = vld1q_s16(in + i);
+		vst1q_s32(out + i, vmovl_s16(vget_low_s16(v)));
+		vst1q_s32(out + i + 4, vmovl_s16(vget_high_s16(v)));
+	}
+	int16ToInt32Scalar(in + i, out + i, samples - i);
+}
+
+
+void int16ToFloatNeon(const int16_t* in, float* out, size_t samples, float scale)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		int16x8_t v = vld1q_s16(in + i);
+		vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+	}
+	int16ToFloatScalar(in + i, out + i, samples - i, scale);
+}
+
+
+void deinterleave16Neon(const int16_t* in, float* left, float* right, size_t frames, float scale)
+{
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		int16x4x2_t v = vld2_s16(in + 2 * i);
+		vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), scale));
+		vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), scale));
+	}
+	deinterleave16Scalar(in + 2 * i, left + i, right + i, frames - i, scale);
+}
+
+
+void interleaveFloat16Neon(const float* left, const float* right, int16_t* out, size_t frames, float scale)
+{
+	const float32x4_t lower = vdupq_n_f32(-32768.f);
+	const float32x4_t upper = vdupq_n_f32(32767.f);
+	size_t i = 0;
+	for (; i + 4 <= frames; i += 4)
+	{
+		int16x4x2_t v;
+		v.val[0] = vqmovn_s32(roundNeon(vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(left + i), scale), lower), upper)));
+		v.val[1] = vqmovn_s32(roundNeon(vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(right + i), scale), lower), upper)));
+		vst2_s16(out + 2 * i, v);
+	}
+	interleaveFloat16Scalar(left + i, right + i, out + 2 * i, frames - i, scale);
+}
+
+
+void interleaveInt16Neon(const int32_t* left, const int32_t* right, int16_t* out, size_t frames, int shift)
+{
+	size_t i = 0;
+	if (shift >= 0)
+	{
+		/// vshl shifts right for negative counts
+		const int32x4_t count = vdupq_n_s32(-shift);
+		for (; i + 4 <= frames; i += 4)
+		{
+			int16x4x2_t v;
+			v.val[0] = vqmovn_s32(vshlq_s32(vld1q_s32(left + i), count));
+			v.val[1] = vqmovn_s32(vshlq_s32(vld1q_s32(right + i), count));
+			vst2_s16(out + 2 * i, v);
+		}
+	}
+	interleaveInt16Scalar(left + i, right + i, out + 2 * i, frames - i, shift);
+}
+
+#endif
+
+
+
+/// Kernels of the instruction sets supported by the host, ordered by preference (ascending)
+std::vector<Kernels> detect()
+{
+	std::vector<Kernels> result;
+	result.push_back({"scalar", int16ToInt32Scalar, int16ToFloatScalar, deinterleave16Scalar, interleaveFloat16Scalar, interleaveInt16Scalar});
+#if defined(SAMPLE_X86)
+	if (hasSse2())
+		result.push_back({"sse2", int16ToInt32Sse2, int16ToFloatSse2, deinterleave16Sse2, interleaveFloat16Sse2, interleaveInt16Sse2});
+	if (hasAvx2())
+		result.push_back({"avx2", int16ToInt32Avx2, int16ToFloatAvx2, deinterleave16Avx2, interleaveFloat16Avx2, interleaveInt16Avx2});
+#elif defined(SAMPLE_NEON)
+	result.push_back({"neon", int16ToInt32Neon, int16ToFloatNeon, deinterleave16Neon, interleaveFloat16Neon, interleaveInt16Neon});
+#endif
+	return result;
+}
+
+
+const std::vector<Kernels>& available()
+{
+	static const std::vector<Kernels> instance = detect();
+	return instance;
+}
+
+
+std::atomic<const Kernels*>& active()
+{
+	static std::atomic<const Kernels*> instance([]()
+	{
+		const Kernels* kernels = &available().back();
+		LOG(INFO) << "Sample conversion: " << kernels->isa << "\n";
+		return kernels;
+	}());
+	return instance;
+}
+
+
+inline const Kernels& kernels()
+{
+	return *active().load(std::memory_order_relaxed);
+}
+
+
+
+/////////////////////////// generic sample formats ///////////////////////////
+
+/// Full scale of "bits" bits, e.g. 32768 for 16 bit
+inline double fullScale(uint16_t bits)
+{
+	return static_cast<double>(1ull << (bits - 1));
+}
+
+
+template <typename T>
+void toInt32(const T* in, int32_t* out, size_t samples)
+{
+	for (size_t i = 0; i < samples; ++i)
+		out[i] = endian::swap(in[i]);
+}
+
+
+template <typename T>
+void toFloat(const T* in, float* out, size_t samples, float scale)
+{
+	for (size_t i = 0; i < samples; ++i)
+		out[i] = endian::swap(in[i]) * scale;
+}
+
+
+template <typename T>
+void deinterleave(const T* in, float* const* out, size_t frames, size_t channels, float scale)
+{
+	for (size_t i = 0; i < frames; ++i)
+		for (size_t channel = 0; channel < channels; ++channel)
+			out[channel][i] = endian::swap(in[channels * i + channel]) * scale;
+}
+
+
+template <typename T>
+void interleave(const float* const* in, T* out, size_t frames, size_t channels, uint16_t bits)
+{
+	const double scale = fullScale(bits);
+	for (size_t i = 0; i < frames; ++i)
+	{
+		for (size_t channel = 0; channel < channels; ++channel)
+		{
+			double value = std::max(-scale, std::min(in[channel][i] * scale, scale - 1.));
+			out[channels * i + channel] = endian::swap(static_cast<T>(std::llrint(value)));
+		}
+	}
+}
+
+
+template <typename T>
+void interleave(const int32_t* const* in, T* out, size_t frames, size_t channels, uint16_t bits, int shift)
+{
+	const int64_t upper = (1ll << (bits - 1)) - 1;
+	const int64_t lower = -upper - 1;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		for (size_t channel = 0; channel < channels; ++channel)
+		{
+			int64_t value = std::max(lower, std::min(shifted(in[channel][i], shift), upper));
+			out[channels * i + channel] = endian::swap(static_cast<T>(value));
+		}
+	}
+}
+
+}
+
+
+
+std::string isa()
+{
+	return kernels().isa;
+}
+
+
+std::vector<std::string> availableIsas()
+{
+	std::vector<std::string> result;
+	for (const auto& kernels: available())
+		result.push_back(kernels.isa);
+	return result;
+}
+
+
+bool setIsa(const std::string& isa)
+{
+	for (const auto& kernels: available())
+	{
+		if (kernels.isa == isa)
+		{
+			active() = &kernels;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void toInt32(const void* in, int32_t* out, size_t samples, const SampleFormat& format)
+{
+#ifndef IS_BIG_ENDIAN
+	if (format.sampleSize == 2)
+	{
+		kernels().int16ToInt32((const int16_t*)in, out, samples);
+		return;
+	}
+#endif
+	if (format.sampleSize == 1)
+		toInt32((const int8_t*)in, out, samples);
+	else if (format.sampleSize == 2)
+		toInt32((const int16_t*)in, out, samples);
+	else if (format.sampleSize == 4)
+		toInt32((const int32_t*)in, out, samples);
+}
+
+
+void toFloat(const void* in, float* out, size_t samples, const SampleFormat& format)
+{
+	float scale = 1. / fullScale(format.bits);
+#ifndef IS_BIG_ENDIAN
+	if (format.sampleSize == 2)
+	{
+		kernels().int16ToFloat((const int16_t*)in, out, samples, scale);
+		return;
+	}
+#endif
+	if (format.sampleSize == 1)
+		toFloat((const int8_t*)in, out, samples, scale);
+	else if (format.sampleSize == 2)
+		toFloat((const int16_t*)in, out, samples, scale);
+	else if (format.sampleSize == 4)
+		toFloat((const int32_t*)in, out, samples, scale);
+}
+
+
+void deinterleave(const void* in, float* const* out, size_t frames, const SampleFormat& format)
+{
+	float scale = 1. / fullScale(format.bits);
+#ifndef IS_BIG_ENDIAN
+	if ((format.sampleSize == 2) && (format.channels == 2))
+	{
+		kernels().deinterleave16((const int16_t*)in, out[0], out[1], frames, scale);
+		return;
+	}
+#endif
+	if (format.sampleSize == 1)
+		deinterleave((const int8_t*)in, out, frames, format.channels, scale);
+	else if (format.sampleSize == 2)
+		deinterleave((const int16_t*)in, out, frames, format.channels, scale);
+	else if (format.sampleSize == 4)
+		deinterleave((const int32_t*)in, out, frames, format.channels, scale);
+}
+
+
+void interleave(const float* const* in, void* out, size_t frames, const SampleFormat& format)
+{
+#ifndef IS_BIG_ENDIAN
+	if ((format.sampleSize == 2) && (format.bits == 16) && (format.channels == 2))
+	{
+		kernels().interleaveFloat16(in[0], in[1], (int16_t*)out, frames, 32768.f);
+		return;
+	}
+#endif
+	if (format.sampleSize == 1)
+		interleave(in, (int8_t*)out, frames, format.channels, format.bits);
+	else if (format.sampleSize == 2)
+		interleave(in, (int16_t*)out, frames, format.channels, format.bits);
+	else if (format.sampleSize == 4)
+		interleave(in, (int32_t*)out, frames, format.channels, format.bits);
+}
+
+
+void interleave(const int32_t* const* in, void* out, size_t frames, const SampleFormat& format, int shift)
+{
+#ifndef IS_BIG_ENDIAN
+	if ((format.sampleSize == 2) && (format.bits == 16) && (format.channels == 2))
+	{
+		kernels().interleaveInt16(in[0], in[1], (int16_t*)out, frames, shift);
+		return;
+	}
+#endif
+	if (format.sampleSize == 1)
+		interleave(in, (int8_t*)out, frames, format.channels, format.bits, shift);
+	else if (format.sampleSize == 2)
+		interleave(in, (int16_t*)out, frames, format.channels, format.bits, shift);
+	else if (format.sampleSize == 4)
+		interleave(in, (int32_t*)out, frames, format.channels, format.bits, shift);
+}
+
+
+void swapEndian(void* buffer, size_t samples, size_t sampleSize)
+{
+	if (sampleSize == 2)
+	{
+		uint16_t* samples16 = (uint16_t*)buffer;
+		for (size_t i = 0; i < samples; ++i)
+			samples16[i] = __builtin_bswap16(samples16[i]);
+	}
+	else if (sampleSize == 4)
+	{
+		uint32_t* samples32 = (uint32_t*)buffer;
+		for (size_t i = 0; i < samples; ++i)
+			samples32[i] = __builtin_bswap32(samples32[i]);
+	}
+}
+
+}
+
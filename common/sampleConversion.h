@@ -0,0 +1,92 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "common/sampleFormat.h"
+
+
+/// Conversion kernels between the PCM payload of a chunk and the codecs' buffers
+/**
+ * PCM payloads are interleaved, little endian and use "format.sampleSize"
+ * bytes per sample. 24 bit samples are stored in the lower 24 bits of
+ * 4 bytes ("24-in-32"). Float samples are scaled by the sample format's
+ * bits (not the container size), i.e. [-1, 1) covers the full range.
+ *
+ * The hot paths (16 bit samples, stereo for the (de)interleaving kernels)
+ * are vectorized with SSE2, AVX2 or NEON. The instruction set is detected
+ * once at runtime, everything else uses the scalar kernels.
+ */
+namespace sample
+{
+
+/// Name of the instruction set in use: "scalar", "sse2", "avx2" or "neon"
+std::string isa();
+
+/// Instruction sets supported by the host, the first one is "scalar", the last one is used by default
+std::vector<std::string> availableIsas();
+
+/// Use the kernels of another instruction set, e.g. to compare them in a benchmark
+/// @return false if the instruction set is not available
+bool setIsa(const std::string& isa);
+
+/// interleaved PCM => interleaved int32, e.g. for FLAC
+void toInt32(const void* in, int32_t* out, size_t samples, const SampleFormat& format);
+
+/// interleaved PCM => interleaved float, e.g. for Opus
+void toFloat(const void* in, float* out, size_t samples, const SampleFormat& format);
+
+/// interleaved PCM => one float buffer per channel, e.g. for Vorbis
+void deinterleave(const void* in, float* const* out, size_t frames, const SampleFormat& format);
+
+/// one float buffer per channel => interleaved PCM, rounded and saturated
+void interleave(const float* const* in, void* out, size_t frames, const SampleFormat& format);
+
+/// one int32 buffer per channel => interleaved PCM, saturated
+/**
+ * @param shift the input has "shift" bits more (or less, if negative) than format.bits,
+ *        e.g. 0 for FLAC or 25 - format.bits for Tremor's Q24 fixed point samples
+ */
+void interleave(const int32_t* const* in, void* out, size_t frames, const SampleFormat& format, int shift = 0);
+
+/// Reverse the byte order of "samples" samples with "sampleSize" bytes each
+void swapEndian(void* buffer, size_t samples, size_t sampleSize);
+
+/// Native byte order <=> little endian, does nothing on little endian hosts
+inline void toLittleEndian(void* buffer, size_t samples, size_t sampleSize)
+{
+#ifdef IS_BIG_ENDIAN
+	swapEndian(buffer, samples, sampleSize);
+#else
+	(void)buffer;
+	(void)samples;
+	(void)sampleSize;
+#endif
+}
+
+}
+
+
+#endif
+
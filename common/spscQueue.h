@@ -0,0 +1,98 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include "common/paddedAtomic.h"
+
+
+/// Lock-free queue for a single producer and a single consumer thread
+/**
+ * Fixed capacity ring buffer, push fails if the queue is full.
+ * Head and tail are on separate cache lines, so that producer and consumer
+ * don't invalidate each other's cache line with every operation.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+	/// The capacity is rounded up to the next power of two
+	SpscQueue(size_t capacity) : head_(0), tail_(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		buffer_.resize(size);
+		mask_ = size - 1;
+	}
+
+	/// Producer only. Returns false if the queue is full
+	bool push(const T& value)
+	{
+		size_t tail = tail_.value.load(std::memory_order_relaxed);
+		if (tail - head_.value.load(std::memory_order_acquire) > mask_)
+			return false;
+		buffer_[tail & mask_] = value;
+		tail_.value.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer only. Returns false if the queue is empty
+	bool pop(T& value)
+	{
+		size_t head = head_.value.load(std::memory_order_relaxed);
+		if (head == tail_.value.load(std::memory_order_acquire))
+			return false;
+		value = buffer_[head & mask_];
+		head_.value.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return (size() == 0);
+	}
+
+	/// Snapshot, might be outdated as soon as it's returned
+	size_t size() const
+	{
+		return tail_.value.load(std::memory_order_acquire) - head_.value.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const
+	{
+		return buffer_.size();
+	}
+
+private:
+	std::vector<T> buffer_;
+	size_t mask_;
+	/// Next element to pop, written by the consumer
+	PaddedAtomic<size_t> head_;
+	/// Next element to push, written by the producer
+	PaddedAtomic<size_t> tail_;
+};
+
+
+#endif
+
@@ -0,0 +1,204 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <time.h>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include "common/endian.hpp"
+#include "common/timeDefs.h"
+
+
+/// NTP like time sync over UDP
+/**
+ * The client sends a request with its send time t1, the server replies with
+ * the kernel receive timestamp t2 and its send time t3, the client takes the
+ * kernel receive timestamp t4 of the reply:
+ *   diff to server = ((t2 - t1) + (t3 - t4)) / 2
+ *   round trip time = (t4 - t1) - (t3 - t2)
+ * Kernel receive timestamps don't include the scheduling latency of the
+ * receiving thread, which is the dominating error of the time sync over the
+ * stream connection, where the time messages also queue behind the audio chunks.
+ * Times are in ns since epoch, the packet is little endian.
+ */
+namespace time_sync
+{
+
+/// "SNTS"
+static constexpr uint32_t kMagic = 0x53544e53;
+static constexpr uint16_t kRequest = 0;
+static constexpr uint16_t kResponse = 1;
+
+
+struct Packet
+{
+	Packet() : magic(kMagic), type(kRequest), reserved(0), id(0), clientSent(0), serverReceived(0), serverSent(0)
+	{
+	}
+
+	/// magic, type, reserved, id, clientSent, serverReceived, serverSent
+	static constexpr size_t kSize = 4 + 2 + 2 + 4 + 3 * 8;
+
+	uint32_t magic;
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t id;
+	int64_t clientSent;
+	int64_t serverReceived;
+	int64_t serverSent;
+
+	void serialize(char* buffer) const
+	{
+		uint32_t u32 = SWAP_32(magic);
+		memcpy(buffer, &u32, 4);
+		uint16_t u16 = SWAP_16(type);
+		memcpy(buffer + 4, &u16, 2);
+		u16 = SWAP_16(reserved);
+		memcpy(buffer + 6, &u16, 2);
+		u32 = SWAP_32(id);
+		memcpy(buffer + 8, &u32, 4);
+		writeNs(buffer + 12, clientSent);
+		writeNs(buffer + 20, serverReceived);
+		writeNs(buffer + 28, serverSent);
+	}
+
+	/// false if the buffer does not contain a time sync packet
+	bool deserialize(const char* buffer, size_t size)
+	{
+		if (size != kSize)
+			return false;
+		uint32_t u32;
+		memcpy(&u32, buffer, 4);
+		magic = SWAP_32(u32);
+		uint16_t u16;
+		memcpy(&u16, buffer + 4, 2);
+		type = SWAP_16(u16);
+		memcpy(&u16, buffer + 6, 2);
+		reserved = SWAP_16(u16);
+		memcpy(&u32, buffer + 8, 4);
+		id = SWAP_32(u32);
+		clientSent = readNs(buffer + 12);
+		serverReceived = readNs(buffer + 20);
+		serverSent = readNs(buffer + 28);
+		return (magic == kMagic);
+	}
+
+private:
+	static void writeNs(char* buffer, int64_t ns)
+	{
+		uint64_t u64 = SWAP_64((uint64_t)ns);
+		memcpy(buffer, &u64, 8);
+	}
+
+	static int64_t readNs(const char* buffer)
+	{
+		uint64_t u64;
+		memcpy(&u64, buffer, 8);
+		return (int64_t)SWAP_64(u64);
+	}
+};
+
+
+/// Current system time [ns since epoch], the same clock as the kernel receive timestamps
+inline int64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(chronos::clk::now().time_since_epoch()).count();
+}
+
+
+/// Enables kernel receive timestamps on the socket
+/// @return false if the platform does not support them, receive() will fall back to user space timestamps
+inline bool enableTimestamps(int fd)
+{
+	int on = 1;
+#if defined(SO_TIMESTAMPNS)
+	return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0);
+#elif defined(SO_TIMESTAMP)
+	return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) == 0);
+#else
+	(void)fd;
+	(void)on;
+	return false;
+#endif
+}
+
+
+/// Non blocking receive of a datagram together with its receive timestamp [ns since epoch]
+/// @param from sender's address, might be NULL
+/// @param fromLen in: size of "from", out: length of the sender's address
+/// @return number of received bytes, -1 on error (errno is EAGAIN resp. EWOULDBLOCK if there is no datagram)
+inline ssize_t receive(int fd, char* buffer, size_t size, int64_t& received, void* from = NULL, socklen_t* fromLen = NULL)
+{
+	iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	/// large enough for the timestamp and some unrequested control messages
+	char control[256];
+	msghdr header;
+	memset(&header, 0, sizeof(header));
+	header.msg_name = from;
+	header.msg_namelen = (fromLen != NULL) ? *fromLen : 0;
+	header.msg_iov = &iov;
+	header.msg_iovlen = 1;
+	header.msg_control = control;
+	header.msg_controllen = sizeof(control);
+
+	ssize_t bytes = recvmsg(fd, &header, MSG_DONTWAIT);
+	if (bytes < 0)
+		return bytes;
+
+	/// fallback, if there is no kernel timestamp
+	received = now();
+	if (fromLen != NULL)
+		*fromLen = header.msg_namelen;
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL; cmsg = CMSG_NXTHDR(&header, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+#if defined(SCM_TIMESTAMPNS)
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			received = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		}
+#elif defined(SCM_TIMESTAMP)
+		if (cmsg->cmsg_type == SCM_TIMESTAMP)
+		{
+			timeval tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			received = (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+		}
+#endif
+	}
+	return bytes;
+}
+
+}
+
+
+#endif
+
+
@@ -0,0 +1,94 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include "chunkHistory.h"
+#include "message/wireChunk.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+
+ChunkHistory::ChunkHistory(size_t maxMs) : maxMs_(maxMs), durationMs_(0), bytes_(0), requests_(0), hits_(0), chunksSent_(0)
+{
+}
+
+
+void ChunkHistory::add(const SharedMessagePtr& chunk, double durationMs)
+{
+	const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(chunk->message().get());
+	if (wireChunk == nullptr)
+		return;
+
+	chunks_.push_back({chunk, durationMs, wireChunk->payloadSize});
+	durationMs_ += durationMs;
+	bytes_ += wireChunk->payloadSize;
+
+	while (!chunks_.empty() && (durationMs_ > maxMs_))
+	{
+		durationMs_ -= chunks_.front().durationMs;
+		bytes_ -= chunks_.front().bytes;
+		chunks_.pop_front();
+	}
+}
+
+
+std::vector<SharedMessagePtr> ChunkHistory::getPlayable(size_t bufferMs, size_t marginMs)
+{
+	vector<SharedMessagePtr> result;
+	++requests_;
+	if (bufferMs <= marginMs)
+		return result;
+
+	/// The client will play a chunk bufferMs after its timestamp
+	chronos::time_point_clk oldest = chronos::clk::now() - chronos::msec(bufferMs - marginMs);
+	for (const auto& entry: chunks_)
+	{
+		const msg::WireChunk* wireChunk = static_cast<const msg::WireChunk*>(entry.chunk->message().get());
+		if (wireChunk->start() >= oldest)
+			result.push_back(entry.chunk);
+	}
+
+	if (!result.empty())
+		++hits_;
+	chunksSent_ += result.size();
+	return result;
+}
+
+
+void ChunkHistory::clear()
+{
+	chunks_.clear();
+	durationMs_ = 0;
+	bytes_ = 0;
+}
+
+
+json ChunkHistory::getMetrics() const
+{
+	json j = {
+		{"chunks", chunks_.size()},
+		{"durationMs", durationMs_},
+		{"bytes", bytes_},
+		{"requests", requests_},
+		{"hits", hits_},
+		{"hitRate", (requests_ > 0) ? (double)hits_ / (double)requests_ : 0.},
+		{"chunksSent", chunksSent_}
+	};
+	return j;
+}
@@ -0,0 +1,75 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef CHUNK_HISTORY_H
+#define CHUNK_HISTORY_H
+
+#include <deque>
+#include <vector>
+#include "sharedMessage.h"
+#include "common/json.hpp"
+
+
+/// Recently encoded chunks of a stream
+/**
+ * Keeps the serialized chunks of the last maxMs milliseconds.
+ * A session that is attached to the stream gets the chunks that are still
+ * playable, so that the client can start playback right away, instead of
+ * waiting for its buffer to be filled with live chunks.
+ * Not thread safe, must be guarded by the owner.
+ */
+class ChunkHistory
+{
+public:
+	ChunkHistory(size_t maxMs);
+
+	/// Adds a chunk to the history, drops the oldest chunks if more than maxMs are stored
+	void add(const SharedMessagePtr& chunk, double durationMs);
+
+	/// Chunks that are not older than bufferMs - marginMs, oldest first
+	std::vector<SharedMessagePtr> getPlayable(size_t bufferMs, size_t marginMs);
+
+	void clear();
+
+	/// Size (payload bytes) and hit rate
+	nlohmann::json getMetrics() const;
+
+private:
+	struct Entry
+	{
+		SharedMessagePtr chunk;
+		double durationMs;
+		size_t bytes;
+	};
+
+	std::deque<Entry> chunks_;
+	size_t maxMs_;
+	double durationMs_;
+	size_t bytes_;
+
+	/// Calls to getPlayable
+	uint64_t requests_;
+	/// Calls to getPlayable, that returned at least one chunk
+	uint64_t hits_;
+	/// Chunks returned by getPlayable
+	uint64_t chunksSent_;
+};
+
+
+#endif
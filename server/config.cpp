@@ -20,8 +20,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <fstream>
 #include <cerrno>
+#include <cstdio>
 #include "common/snapException.h"
 #include "common/strCompat.h"
 #include "common/utils/file_utils.h"
@@ -30,7 +32,7 @@
 using namespace std;
 
 
-Config::Config()
+Config::Config() : hasPendingSave_(false), saving_(false), saveActive_(true)
 {
 }
 
@@ -38,6 +40,14 @@ Config::Config()
 Config::~Config()
 {
 	save();
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(saveMutex_);
+		saveActive_ = false;
+	}
+	saveCondition_.notify_all();
+	if (saveThread_.joinable())
+		saveThread_.join();
 }
 
 
@@ -112,6 +122,24 @@ void Config::init(const std::string& root_directory, const std::string& user, co
 	{
 		LOG(ERROR) << "Error reading config: " << e.what() << "\n";
 	}
+	updateIndex();
+}
+
+
+void Config::updateIndex()
+{
+	clientIndex_.clear();
+	clientGroupIndex_.clear();
+	groupIndex_.clear();
+	for (auto group: groups)
+	{
+		groupIndex_[group->id] = group;
+		for (auto client: group->clients)
+		{
+			clientIndex_[client->id] = client;
+			clientGroupIndex_[client->id] = group;
+		}
+	}
 }
 
 
@@ -119,29 +147,103 @@ void Config::save()
 {
 	if (filename_.empty())
 		init();
-	std::ofstream ofs(filename_.c_str(), std::ofstream::out|std::ofstream::trunc);
 	json clients = {
 		{"ConfigVersion", 2},
 		{"Groups", getGroups()}
 	};
-	ofs << std::setw(4) << clients;
-	ofs.close();
+	std::string data = clients.dump(4);
+
+	std::lock_guard<std::mutex> lock(saveMutex_);
+	pendingSave_.swap(data);
+	hasPendingSave_ = true;
+	/// started lazily, the process might be forked (daemonized) after init
+	if (!saveThread_.joinable())
+		saveThread_ = std::thread(&Config::saveWorker, this);
+	saveCondition_.notify_all();
 }
 
 
-ClientInfoPtr Config::getClientInfo(const std::string& clientId) const
+void Config::flush()
 {
-	if (clientId.empty())
-		return nullptr;
+	std::unique_lock<std::mutex> lock(saveMutex_);
+	if (!saveThread_.joinable())
+		return;
+	saveCondition_.wait(lock, [this]{ return !hasPendingSave_ && !saving_; });
+}
 
-	for (auto group: groups)
+
+void Config::saveWorker()
+{
+	std::unique_lock<std::mutex> lock(saveMutex_);
+	while (true)
 	{
-		for (auto client: group->clients)
+		saveCondition_.wait(lock, [this]{ return hasPendingSave_ || !saveActive_; });
+		if (!hasPendingSave_)
+			break;
+
+		std::string data;
+		data.swap(pendingSave_);
+		hasPendingSave_ = false;
+		saving_ = true;
+		lock.unlock();
+		try
+		{
+			writeFile(data);
+		}
+		catch (const std::exception& e)
+		{
+			SLOG(ERROR) << "Error saving config: " << e.what() << "\n";
+		}
+		lock.lock();
+		saving_ = false;
+		saveCondition_.notify_all();
+	}
+}
+
+
+void Config::writeFile(const std::string& data) const
+{
+	string tmpFilename = filename_ + ".tmp";
+	int fd;
+	if ((fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+		throw SnapException("failed to open file \"" + tmpFilename + "\", error " + cpt::to_string(errno));
+
+	size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t count = write(fd, data.data() + written, data.size() - written);
+		if (count < 0)
 		{
-			if (client->id == clientId)
-				return client;
+			if (errno == EINTR)
+				continue;
+			int error = errno;
+			close(fd);
+			throw SnapException("failed to write file \"" + tmpFilename + "\", error " + cpt::to_string(error));
 		}
+		written += count;
+	}
+
+	if (fsync(fd) != 0)
+	{
+		int error = errno;
+		close(fd);
+		throw SnapException("failed to sync file \"" + tmpFilename + "\", error " + cpt::to_string(error));
 	}
+	close(fd);
+
+	if (rename(tmpFilename.c_str(), filename_.c_str()) != 0)
+		throw SnapException("failed to rename \"" + tmpFilename + "\" to \"" + filename_ + "\", error " + cpt::to_string(errno));
+}
+
+
+ClientInfoPtr Config::getClientInfo(const std::string& clientId) const
+{
+	if (clientId.empty())
+		return nullptr;
+
+	auto iter = clientIndex_.find(clientId);
+	if (iter != clientIndex_.end())
+		return iter->second;
 
 	return nullptr;
 }
@@ -155,6 +257,7 @@ GroupPtr Config::addClientInfo(ClientInfoPtr client)
 		group = std::make_shared<Group>();
 		group->addClient(client);
 		groups.push_back(group);
+		updateIndex();
 	}
 	return group;
 }
@@ -171,11 +274,9 @@ GroupPtr Config::addClientInfo(const std::string& clientId)
 
 GroupPtr Config::getGroup(const std::string& groupId) const
 {
-	for (auto group: groups)
-	{
-		if (group->id == groupId)
-			return group;
-	}
+	auto iter = groupIndex_.find(groupId);
+	if (iter != groupIndex_.end())
+		return iter->second;
 
 	return nullptr;
 }
@@ -183,14 +284,10 @@ GroupPtr Config::getGroup(const std::string& groupId) const
 
 GroupPtr Config::getGroupFromClient(const std::string& clientId)
 {
-	for (auto group: groups)
-	{
-		for (auto c: group->clients)
-		{
-			if (c->id == clientId)
-				return group;
-		}
-	}
+	auto iter = clientGroupIndex_.find(clientId);
+	if (iter != clientGroupIndex_.end())
+		return iter->second;
+
 	return nullptr;
 }
 
@@ -238,6 +335,7 @@ void Config::remove(ClientInfoPtr client)
 	group->removeClient(client);
 	if (group->empty())
 		remove(group);
+	updateIndex();
 }
 
 
@@ -248,6 +346,7 @@ void Config::remove(GroupPtr group, bool force)
 
 	if (group->empty() || force)
 		groups.erase(std::remove(groups.begin(), groups.end(), group), groups.end());
+	updateIndex();
 }
 
 /*
@@ -22,6 +22,10 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/time.h>
 
 #include "common/json.hpp"
@@ -124,7 +128,7 @@ struct Host
 
 struct ClientConfig
 {
-	ClientConfig() : name(""), volume(100), latency(0), instance(1)
+	ClientConfig() : name(""), volume(100), latency(0), instance(1), codec("")
 	{
 	}
 
@@ -134,6 +138,7 @@ struct ClientConfig
 		volume.fromJson(j["volume"]);
 		latency = jGet<int32_t>(j, "latency", 0);
 		instance = jGet<size_t>(j, "instance", 1);
+		codec = jGet<std::string>(j, "codec", "");
 	}
 	
 	json toJson()
@@ -143,6 +148,7 @@ struct ClientConfig
 		j["volume"] = volume.toJson();
 		j["latency"] = latency;
 		j["instance"] = instance;
+		j["codec"] = codec;
 		return j;
 	}
 
@@ -150,6 +156,8 @@ struct ClientConfig
 	Volume volume;
 	int32_t latency;
 	size_t instance;
+	/// Preferred codec, empty for the stream's default codec
+	std::string codec;
 };
 
 
@@ -390,16 +398,43 @@ public:
 	json getGroups() const;
 	json getServerStatus(const json& streams) const;
 
+	/// Serializes the config and writes it asynchronously to disk.
+	/// The file is replaced atomically (write temp file, fsync, rename).
+	/// If save is called again before the last write completed, only the latest version is written.
 	void save();
 
+	/// Blocks until all pending writes are on disk
+	void flush();
+
 	void init(const std::string& root_directory = "", const std::string& user = "", const std::string& group = "");
 
+	/// Rebuilds the lookup tables
+	/// Must be called after clients or groups have been added or removed without using Config
+	void updateIndex();
+
 	std::vector<GroupPtr> groups;
 
 private:
 	Config();
 	~Config();
+	void saveWorker();
+	void writeFile(const std::string& data) const;
+
 	std::string filename_;
+
+	/// Background writer
+	std::thread saveThread_;
+	std::mutex saveMutex_;
+	std::condition_variable saveCondition_;
+	std::string pendingSave_;
+	bool hasPendingSave_;
+	bool saving_;
+	bool saveActive_;
+
+	/// Lookup tables for groups. Client id => client, client id => group, group id => group
+	std::unordered_map<std::string, ClientInfoPtr> clientIndex_;
+	std::unordered_map<std::string, GroupPtr> clientGroupIndex_;
+	std::unordered_map<std::string, GroupPtr> groupIndex_;
 };
 
 
@@ -24,16 +24,21 @@
 #include "common/snapException.h"
 #include "config.h"
 #include <iostream>
+#include <map>
 
 using namespace std;
 
 using json = nlohmann::json;
 
+const size_t ControlServer::notificationDelayMs;
+
 
 ControlServer::ControlServer(asio::io_service* io_service, size_t port, ControlMessageReceiver* controlMessageReceiver) : 
 	acceptor_v4_(nullptr),
 	acceptor_v6_(nullptr),
 	io_service_(io_service),
+	strand_(*io_service),
+	notificationTimer_(*io_service),
 	port_(port),
 	controlMessageReceiver_(controlMessageReceiver)
 {
@@ -48,17 +53,13 @@ ControlServer::~ControlServer()
 
 void ControlServer::cleanup()
 {
-	std::lock_guard<std::recursive_mutex> mlock(mutex_);
 	for (auto it = sessions_.begin(); it != sessions_.end(); )
 	{
 		if (!(*it)->active())
 		{
 			SLOG(ERROR) << "Session inactive. Removing\n";
-			// don't block: remove ClientSession in a thread
-			auto func = [](shared_ptr<ControlSession> s)->void{s->stop();};
-			std::thread t(func, *it);
-			t.detach();
-			//(*it)->stop();
+			// doesn't block: the session is closed asynchronously
+			(*it)->stop();
 			sessions_.erase(it++);
 		}
 		else
@@ -67,34 +68,101 @@ void ControlServer::cleanup()
 }
 
 
-void ControlServer::send(const std::string& message, const ControlSession* excludeSession)
+void ControlServer::send(const std::string& method, const std::vector<std::string>& objects, const std::string& message, const ControlSession* excludeSession)
+{
+	send(method, objects, message, "", excludeSession);
+}
+
+
+void ControlServer::send(const std::string& method, const std::vector<std::string>& objects, const std::string& message, const std::string& deltaMessage, const ControlSession* excludeSession)
+{
+	Notification notification{method, objects, nullptr, nullptr, excludeSession};
+	if (!message.empty())
+		notification.message = make_shared<const string>(message);
+	if (!deltaMessage.empty())
+		notification.deltaMessage = make_shared<const string>(deltaMessage);
+
+	strand_.post([this, notification]()
+	{
+		pendingNotifications_.push_back(notification);
+		if (pendingNotifications_.size() > 1)
+			return;
+
+		/// Coalesce notifications that are sent in short succession
+		notificationTimer_.expires_from_now(std::chrono::milliseconds(notificationDelayMs));
+		notificationTimer_.async_wait(strand_.wrap([this](const std::error_code& ec)
+		{
+			if (ec)
+				return;
+			if (controlMessageReceiver_ != NULL)
+				controlMessageReceiver_->onNotificationBatch();
+			sendPendingNotifications();
+		}));
+	});
+}
+
+
+void ControlServer::sendPendingNotifications()
 {
 	cleanup();
+	/// Sessions that receive the same notifications share one batch
+	map<vector<shared_ptr<const string>>, shared_ptr<const string>> batches;
+	vector<shared_ptr<const string>> messages;
 	for (auto s : sessions_)
 	{
-		if (s.get() != excludeSession)
-			s->sendAsync(message);
+		messages.clear();
+		SubscriptionPtr subscription = s->subscription();
+		for (const auto& notification: pendingNotifications_)
+		{
+			if (subscription && !subscription->matches(notification.method, notification.objects))
+				continue;
+			/// The delta must be sent also to the excluded session, else it would miss the revision
+			if (s->deltaUpdates() && notification.deltaMessage)
+				messages.push_back(notification.deltaMessage);
+			else if (notification.message && (s.get() != notification.excludeSession))
+				messages.push_back(notification.message);
+		}
+
+		if (messages.empty())
+			continue;
+
+		if (messages.size() == 1)
+		{
+			s->sendAsync(messages.front());
+			continue;
+		}
+
+		shared_ptr<const string>& batch = batches[messages];
+		if (!batch)
+		{
+			/// JSON-RPC Batch
+			string batchMessage = "[";
+			for (size_t n = 0; n < messages.size(); ++n)
+			{
+				if (n > 0)
+					batchMessage += ",";
+				batchMessage += *messages[n];
+			}
+			batchMessage += "]";
+			batch = make_shared<const string>(std::move(batchMessage));
+		}
+		s->sendAsync(batch);
 	}
+	pendingNotifications_.clear();
 }
 
 
 void ControlServer::onMessageReceived(ControlSession* connection, const std::string& message)
 {
-	std::lock_guard<std::recursive_mutex> mlock(mutex_);
 	LOG(DEBUG) << "received: \"" << message << "\"\n";
 	if ((message == "quit") || (message == "exit") || (message == "bye"))
 	{
-		for (auto it = sessions_.begin(); it != sessions_.end(); ++it)
+		shared_ptr<ControlSession> session = connection->shared_from_this();
+		strand_.post([this, session]()
 		{
-			if (it->get() == connection)
-			{
-				/// delete in a thread to avoid deadlock
-				auto func = [&](std::shared_ptr<ControlSession> s)->void{sessions_.erase(s);};
-				std::thread t(func, *it);
-				t.detach();
-				break;
-			}
-		}
+			session->stop();
+			sessions_.erase(session);
+		});
 	}
 	else
 	{
@@ -124,20 +192,16 @@ void ControlServer::handleAccept(socket_ptr socket)
 {
 	try
 	{
-		struct timeval tv;
-		tv.tv_sec  = 5;
-		tv.tv_usec = 0;
-		setsockopt(socket->native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-		setsockopt(socket->native_handle(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 	//	socket->set_option(boost::asio::ip::tcp::no_delay(false));
+		socket->set_option(asio::socket_base::keep_alive(true));
 		SLOG(NOTICE) << "ControlServer::NewConnection: " << socket->remote_endpoint().address().to_string() << endl;
-		shared_ptr<ControlSession> session = make_shared<ControlSession>(this, socket);
+		shared_ptr<ControlSession> session = make_shared<ControlSession>(*io_service_, this, socket);
+		strand_.post([this, session]()
 		{
-			std::lock_guard<std::recursive_mutex> mlock(mutex_);
-			session->start();
 			sessions_.insert(session);
 			cleanup();
-		}
+			session->start();
+		});
 	}
 	catch (const std::exception& e)
 	{
@@ -195,8 +259,9 @@ void ControlServer::stop()
 		acceptor_v6_->cancel();
 		acceptor_v6_ = nullptr;
 	}
-	std::lock_guard<std::recursive_mutex> mlock(mutex_);
+	/// the io_service is not running anymore, so there is no need to go through the strand
 	for (auto s: sessions_)
 		s->stop();
+	sessions_.clear();
 }
 
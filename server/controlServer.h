@@ -50,10 +50,17 @@ public:
 	virtual ~ControlServer();
 
 	void start();
+	/// Must be called after the io_service has been stopped
 	void stop();
 
-	/// Send a message to all connceted clients
-	void send(const std::string& message, const ControlSession* excludeSession = NULL);
+	/// Send a notification to all connected clients that subscribed to it (see Subscription)
+	/// Notifications sent within notificationDelayMs are coalesced into a JSON-RPC Batch
+	/// @param method the notification's method, e.g. "Client.OnVolumeChanged"
+	/// @param objects ids of the clients, groups and streams the notification is about, empty for server wide notifications
+	void send(const std::string& method, const std::vector<std::string>& objects, const std::string& message, const ControlSession* excludeSession = NULL);
+	/// Same as above, but clients that requested delta updates will receive deltaMessage instead (also the excluded one)
+	/// An empty message is only sent to clients that requested delta updates
+	void send(const std::string& method, const std::vector<std::string>& objects, const std::string& message, const std::string& deltaMessage, const ControlSession* excludeSession = NULL);
 
 	/// Clients call this when they receive a message. Implementation of MessageReceiver::onMessageReceived
 	virtual void onMessageReceived(ControlSession* connection, const std::string& message);
@@ -62,14 +69,31 @@ private:
 	void startAccept();
 	void handleAccept(socket_ptr socket);
 	void cleanup();
+	void sendPendingNotifications();
 //	void acceptor();
-	mutable std::recursive_mutex mutex_;
+	/// sessions_ are only accessed within the strand
 	std::set<std::shared_ptr<ControlSession>> sessions_;
 	std::shared_ptr<tcp::acceptor> acceptor_v4_;
 	std::shared_ptr<tcp::acceptor> acceptor_v6_;
 
 	Queue<std::shared_ptr<msg::BaseMessage>> messages_;
 	asio::io_service* io_service_;
+	asio::io_service::strand strand_;
+
+	/// Serialized once, the sessions share the message
+	struct Notification
+	{
+		std::string method;
+		std::vector<std::string> objects;
+		std::shared_ptr<const std::string> message;
+		std::shared_ptr<const std::string> deltaMessage;
+		const ControlSession* excludeSession;
+	};
+
+	static const size_t notificationDelayMs = 5;
+	/// Notifications to be sent with the next batch, only accessed within strand_
+	std::vector<Notification> pendingNotifications_;
+	asio::steady_timer notificationTimer_;
 	size_t port_;
 	ControlMessageReceiver* controlMessageReceiver_;
 };
@@ -17,158 +17,170 @@
 ***/
 
 #include <iostream>
-#include <mutex>
 #include "controlSession.h"
 #include "aixlog.hpp"
-#include "message/pcmChunk.h"
 
 using namespace std;
 
 
 
-ControlSession::ControlSession(ControlMessageReceiver* receiver, std::shared_ptr<tcp::socket> socket) : 
-	active_(false), messageReceiver_(receiver)
+bool Subscription::matches(const std::string& method, const std::vector<std::string>& objects) const
+{
+	if (!topics.empty() && (topics.find(method) == topics.end()) && (topics.find(method.substr(0, method.find('.'))) == topics.end()))
+		return false;
+
+	if (ids.empty() || objects.empty())
+		return true;
+
+	for (const auto& object: objects)
+		if (ids.find(object) != ids.end())
+			return true;
+
+	return false;
+}
+
+
+
+ControlSession::ControlSession(asio::io_service& ioService, ControlMessageReceiver* receiver, std::shared_ptr<tcp::socket> socket) : 
+	active_(false), deltaUpdates_(false), strand_(ioService), socket_(socket), messageReceiver_(receiver), isWriting_(false)
 {
-	socket_ = socket;
 }
 
 
 ControlSession::~ControlSession()
 {
-	stop();
+	LOG(DEBUG) << "ControlSession destroyed\n";
 }
 
 
 void ControlSession::start()
 {
-	{
-		std::lock_guard<std::recursive_mutex> activeLock(activeMutex_);
-		active_ = true;
-	}
-	readerThread_ = thread(&ControlSession::reader, this);
-	writerThread_ = thread(&ControlSession::writer, this);
+	active_ = true;
+	auto self(shared_from_this());
+	strand_.post([this, self]() { readLine(); });
 }
 
 
 void ControlSession::stop()
 {
 	LOG(DEBUG) << "ControlSession::stop\n";
-	std::lock_guard<std::recursive_mutex> activeLock(activeMutex_);
-	active_ = false;
-	try
+	if (!active_.exchange(false))
+		return;
+
+	/// Closing the socket will cancel the pending operations.
+	/// The handlers keep the session alive until they are finished.
+	auto self(shared_from_this());
+	strand_.post([this, self]()
 	{
 		std::error_code ec;
-		if (socket_)
-		{
-			std::lock_guard<std::recursive_mutex> socketLock(socketMutex_);
-			socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-			if (ec) LOG(ERROR) << "Error in socket shutdown: " << ec.message() << "\n";
-			socket_->close(ec);
-			if (ec) LOG(ERROR) << "Error in socket close: " << ec.message() << "\n";
-		}
-		if (readerThread_.joinable())
-		{
-			LOG(DEBUG) << "ControlSession joining readerThread\n";
-			readerThread_.join();
-		}
-		if (writerThread_.joinable())
-		{
-			LOG(DEBUG) << "ControlSession joining writerThread\n";
-			messages_.abort_wait();
-			writerThread_.join();
-		}
-	}
-	catch(...)
-	{
-	}
-	socket_ = NULL;
-	LOG(DEBUG) << "ControlSession ControlSession stopped\n";
+		socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+		if (ec) LOG(ERROR) << "Error in socket shutdown: " << ec.message() << "\n";
+		socket_->close(ec);
+		if (ec) LOG(ERROR) << "Error in socket close: " << ec.message() << "\n";
+		messages_.clear();
+		LOG(DEBUG) << "ControlSession stopped\n";
+	});
 }
 
 
 
-void ControlSession::sendAsync(const std::string& message)
+void ControlSession::setSubscription(const SubscriptionPtr& subscription)
 {
-	messages_.push(message);
+	std::lock_guard<std::mutex> lock(subscriptionMutex_);
+	subscription_ = subscription;
 }
 
 
-bool ControlSession::send(const std::string& message) const
+SubscriptionPtr ControlSession::subscription() const
 {
-	//LOG(INFO) << "send: " << message << ", size: " << message.length() << "\n";
-	std::lock_guard<std::recursive_mutex> socketLock(socketMutex_);
-	{
-		std::lock_guard<std::recursive_mutex> activeLock(activeMutex_);
-		if (!socket_ || !active_)
-			return false;
-	}
-	asio::streambuf streambuf;
-	std::ostream request_stream(&streambuf);
-	request_stream << message << "\r\n";
-	asio::write(*socket_.get(), streambuf);
-	//LOG(INFO) << "done\n";
-	return true;
+	std::lock_guard<std::mutex> lock(subscriptionMutex_);
+	return subscription_;
+}
+
+
+void ControlSession::sendAsync(const std::string& message)
+{
+	sendAsync(make_shared<const string>(message));
 }
 
 
-void ControlSession::reader()
+void ControlSession::sendAsync(const std::shared_ptr<const std::string>& message)
 {
-	try
+	if (!active_)
+		return;
+
+	auto self(shared_from_this());
+	strand_.post([this, self, message]()
 	{
-		std::stringstream message;
-		while (active_)
+		/// Dropping notifications would leave the client with an inconsistent
+		/// state, it has to reconnect and get the status again
+		if (messages_.size() >= maxPendingMessages)
 		{
-			asio::streambuf response;
-			asio::read_until(*socket_, response, "\n");
+			if (active_)
+				SLOG(ERROR) << "Client doesn't read, " << messages_.size() << " pending messages, closing the control session\n";
+			stop();
+			return;
+		}
+		messages_.push_back(message);
+		if (!isWriting_)
+			writeNext();
+	});
+}
 
-			std::string s((istreambuf_iterator<char>(&response)), istreambuf_iterator<char>());
-			message << s;
-			if (s.empty() || (s.back() != '\n'))
-				continue;
 
-			string line;
-			while (std::getline(message, line, '\n'))
+void ControlSession::writeNext()
+{
+	if (!active_ || messages_.empty())
+		return;
+
+	//LOG(INFO) << "send: " << *messages_.front() << ", size: " << messages_.front()->length() << "\n";
+	static const string delimiter("\r\n");
+	writing_ = messages_.front();
+	messages_.pop_front();
+	isWriting_ = true;
+	auto self(shared_from_this());
+	std::vector<asio::const_buffer> buffers{asio::buffer(*writing_), asio::buffer(delimiter)};
+	asio::async_write(*socket_, buffers, strand_.wrap(
+		[this, self](const std::error_code& ec, std::size_t length)
+		{
+			isWriting_ = false;
+			if (ec)
 			{
-				if (line.empty())
-					continue;
-
-				size_t len = line.length() - 1;
-				if ((len >= 2) && line[len-2] == '\r')
-					--len;
-				line.resize(len);
-				if ((messageReceiver_ != NULL) && !line.empty())
-					messageReceiver_->onMessageReceived(this, line);
+				if (active_)
+					SLOG(ERROR) << "Error in ControlSession::writeNext(): " << ec.message() << endl;
+				stop();
+				return;
 			}
-			message.str("");
-			message.clear();
-		}
-	}
-	catch (const std::exception& e)
-	{
-		SLOG(ERROR) << "Exception in ControlSession::reader(): " << e.what() << endl;
-	}
-	active_ = false;
+			writeNext();
+		}));
 }
 
 
-void ControlSession::writer()
+void ControlSession::readLine()
 {
-	try
-	{
-		asio::streambuf streambuf;
-		std::ostream stream(&streambuf);
-		string message;
-		while (active_)
-		{
-			if (messages_.try_pop(message, std::chrono::milliseconds(500)))
-				send(message);
-		}
-	}
-	catch (const std::exception& e)
-	{
-		SLOG(ERROR) << "Exception in ControlSession::writer(): " << e.what() << endl;
-	}
-	active_ = false;
-}
+	if (!active_)
+		return;
 
+	auto self(shared_from_this());
+	asio::async_read_until(*socket_, readBuffer_, "\n", strand_.wrap(
+		[this, self](const std::error_code& ec, std::size_t length)
+		{
+			if (ec)
+			{
+				if (active_)
+					SLOG(ERROR) << "Error in ControlSession::readLine(): " << ec.message() << endl;
+				stop();
+				return;
+			}
 
+			/// the streambuf might contain more data than the line
+			std::istream stream(&readBuffer_);
+			string line;
+			std::getline(stream, line);
+			if (!line.empty() && (line.back() == '\r'))
+				line.resize(line.length() - 1);
+			if (active_ && (messageReceiver_ != NULL) && !line.empty())
+				messageReceiver_->onMessageReceived(this, line);
+			readLine();
+		}));
+}
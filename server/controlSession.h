@@ -20,15 +20,13 @@
 #define CONTROL_SESSION_H
 
 #include <string>
-#include <thread>
+#include <deque>
 #include <atomic>
-#include <mutex>
 #include <memory>
-#include <asio.hpp>
-#include <condition_variable>
+#include <mutex>
 #include <set>
-#include "message/message.h"
-#include "common/queue.h"
+#include <vector>
+#include <asio.hpp>
 
 
 using asio::ip::tcp;
@@ -37,52 +35,95 @@ using asio::ip::tcp;
 class ControlSession;
 
 
+/// Notification filter of a control client, set with "Server.Subscribe"
+struct Subscription
+{
+	/// Notification methods (e.g. "Client.OnVolumeChanged") or namespaces (e.g. "Client"). Empty: all notifications
+	std::set<std::string> topics;
+	/// Ids of clients, groups or streams. Empty: notifications about all objects
+	std::set<std::string> ids;
+
+	/// objects are the ids the notification is about, server wide notifications (no objects) match every id filter
+	bool matches(const std::string& method, const std::vector<std::string>& objects) const;
+};
+
+typedef std::shared_ptr<const Subscription> SubscriptionPtr;
+
+
 /// Interface: callback for a received message.
 class ControlMessageReceiver
 {
 public:
 	virtual void onMessageReceived(ControlSession* connection, const std::string& message) = 0;
+	/// Called by the ControlServer once per batch of coalesced notifications, before it is sent
+	virtual void onNotificationBatch()
+	{
+	}
 };
 
 
 /// Endpoint for a connected control client.
 /**
  * Endpoint for a connected control client.
- * Messages are sent to the client with the "send" method.
+ * Messages are sent to the client with the "sendAsync" method.
  * Received messages from the client are passed to the ControlMessageReceiver callback
+ * All socket I/O is asynchronous and serialized on a per-session strand.
  */
-class ControlSession
+class ControlSession : public std::enable_shared_from_this<ControlSession>
 {
 public:
 	/// ctor. Received message from the client are passed to MessageReceiver
-	ControlSession(ControlMessageReceiver* receiver, std::shared_ptr<tcp::socket> socket);
+	ControlSession(asio::io_service& ioService, ControlMessageReceiver* receiver, std::shared_ptr<tcp::socket> socket);
 	~ControlSession();
 	void start();
 	void stop();
 
-	/// Sends a message to the client (synchronous)
-	bool send(const std::string& message) const;
-
-	/// Sends a message to the client (asynchronous)
+	/// Sends a message to the client (asynchronous). A client that doesn't read
+	/// and has more than maxPendingMessages pending messages is disconnected
 	void sendAsync(const std::string& message);
+	/// Same as above, the message can be shared between sessions
+	void sendAsync(const std::shared_ptr<const std::string>& message);
 
 	bool active() const
 	{
 		return active_;
 	}
 
+	/// The client wants to receive "Server.OnDelta" instead of "Server.OnUpdate"
+	void setDeltaUpdates(bool enabled)
+	{
+		deltaUpdates_ = enabled;
+	}
+
+	bool deltaUpdates() const
+	{
+		return deltaUpdates_;
+	}
+
+	/// Notifications the client is interested in, nullptr: all
+	void setSubscription(const SubscriptionPtr& subscription);
+	SubscriptionPtr subscription() const;
+
 protected:
-	void reader();
-	void writer();
+	/// Same limit as the chunk queue of a StreamSession
+	static const size_t maxPendingMessages = 2000;
+
+	void readLine();
+	void writeNext();
 
 	std::atomic<bool> active_;
-	mutable std::recursive_mutex activeMutex_;
-	mutable std::recursive_mutex socketMutex_;
-	std::thread readerThread_;
-	std::thread writerThread_;
+	std::atomic<bool> deltaUpdates_;
+	mutable std::mutex subscriptionMutex_;
+	SubscriptionPtr subscription_;
+	asio::io_service::strand strand_;
 	std::shared_ptr<tcp::socket> socket_;
 	ControlMessageReceiver* messageReceiver_;
-	Queue<std::string> messages_;
+	asio::streambuf readBuffer_;
+	/// Pending messages, only accessed within strand_
+	std::deque<std::shared_ptr<const std::string>> messages_;
+	/// Message that is currently written, only accessed within strand_
+	std::shared_ptr<const std::string> writing_;
+	bool isWriting_;
 };
 
 
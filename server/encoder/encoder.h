@@ -71,6 +71,12 @@ public:
 	/// Here the work is done. Encoded data is passed to the EncoderListener.
 	virtual void encode(const msg::PcmChunk* chunk) = 0;
 
+	/// Drops the PCM that is buffered in the encoder, so that the next encoded chunk starts with the next PCM chunk.
+	/// Encoders that buffer PCM must override this. The codec header might change, see getHeader
+	virtual void reset()
+	{
+	}
+
 	virtual std::string name() const = 0;
 
 	virtual std::string getAvailableOptions() const
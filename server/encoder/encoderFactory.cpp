@@ -24,6 +24,9 @@
 #if defined(HAS_FLAC)
 #include "flacEncoder.h"
 #endif
+#if defined(HAS_OPUS)
+#include "opusEncoder.h"
+#endif
 #include "common/utils/string_utils.h"
 #include "common/snapException.h"
 #include "aixlog.hpp"
@@ -51,6 +54,10 @@ Encoder* EncoderFactory::createEncoder(const std::string& codecSettings) const
 #if defined(HAS_FLAC)
 	else if (codec == "flac")
 		encoder = new FlacEncoder(codecOptions);
+#endif
+#if defined(HAS_OPUS)
+	else if (codec == "opus")
+		encoder = new OpusStreamEncoder(codecOptions);
 #endif
 	else
 	{
@@ -19,6 +19,8 @@
 #include <iostream>
 
 #include "flacEncoder.h"
+#include "common/payloadPool.h"
+#include "common/sampleConversion.h"
 #include "common/strCompat.h"
 #include "common/snapException.h"
 #include "aixlog.hpp"
@@ -26,7 +28,7 @@
 using namespace std;
 
 
-FlacEncoder::FlacEncoder(const std::string& codecOptions) : Encoder(codecOptions), encoder_(NULL), pcmBufferSize_(0), encodedSamples_(0)
+FlacEncoder::FlacEncoder(const std::string& codecOptions) : Encoder(codecOptions), encoder_(NULL), pcmBufferSize_(0), encodedSamples_(0), discard_(false)
 {
 	flacChunk_ = new msg::PcmChunk();
 	headerChunk_.reset(new msg::CodecHeader("flac"));
@@ -79,25 +81,7 @@ void FlacEncoder::encode(const msg::PcmChunk* chunk)
 		pcmBuffer_ = (FLAC__int32*)realloc(pcmBuffer_, pcmBufferSize_ * sizeof(FLAC__int32));
 	}
 
-	if (sampleFormat_.sampleSize == 1)
-	{
-		FLAC__int8* buffer = (FLAC__int8*)chunk->payload;
-		for(int i=0; i<samples; i++)
-			pcmBuffer_[i] = (FLAC__int32)(buffer[i]);
-	}
-	else if (sampleFormat_.sampleSize == 2)
-	{
-		FLAC__int16* buffer = (FLAC__int16*)chunk->payload;
-		for(int i=0; i<samples; i++)
-			pcmBuffer_[i] = (FLAC__int32)(buffer[i]);
-	}
-	else if (sampleFormat_.sampleSize == 4)
-	{
-		FLAC__int32* buffer = (FLAC__int32*)chunk->payload;
-		for(int i=0; i<samples; i++)
-			pcmBuffer_[i] = (FLAC__int32)(buffer[i]);
-	}
-
+	sample::toInt32(chunk->payload, pcmBuffer_, samples, sampleFormat_);
 
 	FLAC__stream_encoder_process_interleaved(encoder_, pcmBuffer_, frames);
 
@@ -112,6 +96,23 @@ void FlacEncoder::encode(const msg::PcmChunk* chunk)
 }
 
 
+void FlacEncoder::reset()
+{
+	/// libFLAC can't drop the samples of an incomplete block, so the encoder is recreated.
+	/// The header of the new encoder is the same as the old one, which stays valid
+	discard_ = true;
+	FLAC__stream_encoder_finish(encoder_);
+	FLAC__metadata_object_delete(metadata_[0]);
+	FLAC__metadata_object_delete(metadata_[1]);
+	FLAC__stream_encoder_delete(encoder_);
+	encoder_ = NULL;
+	flacChunk_->payloadSize = 0;
+	encodedSamples_ = 0;
+	initEncoder();
+	discard_ = false;
+}
+
+
 FLAC__StreamEncoderWriteStatus FlacEncoder::write_callback(const FLAC__StreamEncoder *encoder,
     const FLAC__byte buffer[],
     size_t bytes,
@@ -119,15 +120,18 @@ FLAC__StreamEncoderWriteStatus FlacEncoder::write_callback(const FLAC__StreamEnc
     unsigned current_frame)
 {
 //	LOG(INFO) << "write_callback: " << bytes << ", " << samples << ", " << current_frame << "\n";
+	if (discard_)
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+
 	if ((current_frame == 0) && (bytes > 0) && (samples == 0))
 	{
-		headerChunk_->payload = (char*)realloc(headerChunk_->payload, headerChunk_->payloadSize + bytes);
+		headerChunk_->payload = PayloadPool::instance().reallocate(headerChunk_->payload, headerChunk_->payloadSize + bytes);
 		memcpy(headerChunk_->payload + headerChunk_->payloadSize, buffer, bytes);
 		headerChunk_->payloadSize += bytes;
 	}
 	else
 	{
-		flacChunk_->payload = (char*)realloc(flacChunk_->payload, flacChunk_->payloadSize + bytes);
+		flacChunk_->payload = PayloadPool::instance().reallocate(flacChunk_->payload, flacChunk_->payloadSize + bytes);
 		memcpy(flacChunk_->payload + flacChunk_->payloadSize, buffer, bytes);
 		flacChunk_->payloadSize += bytes;
 		encodedSamples_ += samples;
@@ -33,6 +33,7 @@ public:
     FlacEncoder(const std::string& codecOptions = "");
     ~FlacEncoder();
     virtual void encode(const msg::PcmChunk* chunk);
+    virtual void reset();
    	virtual std::string getAvailableOptions() const;
 	virtual std::string getDefaultOptions() const;
 	virtual std::string name() const;
@@ -50,6 +51,8 @@ protected:
 
     msg::PcmChunk* flacChunk_;
     size_t encodedSamples_;
+    /// Drop the encoder's output, while it is reset
+    bool discard_;
 };
 
 
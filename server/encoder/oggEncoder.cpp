@@ -20,6 +20,8 @@
 #include <cstring>
 
 #include "oggEncoder.h"
+#include "common/payloadPool.h"
+#include "common/sampleConversion.h"
 #include "common/snapException.h"
 #include "common/strCompat.h"
 #include "common/utils/string_utils.h"
@@ -60,27 +62,7 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 	float **buffer=vorbis_analysis_buffer(&vd_, frames);
 
 	/* uninterleave samples */
-	for (size_t channel = 0; channel < sampleFormat_.channels; ++channel)
-	{
-		if (sampleFormat_.sampleSize == 1)
-		{
-			int8_t* chunkBuffer = (int8_t*)chunk->payload; 
-			for (int i=0; i<frames; i++)
-				buffer[channel][i]= chunkBuffer[sampleFormat_.channels*i + channel] / 128.f;
-		}
-		else if (sampleFormat_.sampleSize == 2)
-		{
-			int16_t* chunkBuffer = (int16_t*)chunk->payload;
-			for (int i=0; i<frames; i++)
-				buffer[channel][i]= chunkBuffer[sampleFormat_.channels*i + channel] / 32768.f;
-		}
-		else if (sampleFormat_.sampleSize == 4)
-		{
-			int32_t* chunkBuffer = (int32_t*)chunk->payload;
-			for (int i=0; i<frames; i++)
-				buffer[channel][i]= chunkBuffer[sampleFormat_.channels*i + channel] / 2147483648.f;
-		}
-	}
+	sample::deinterleave(chunk->payload, buffer, frames, sampleFormat_);
 
 	/* tell the library how much we actually submitted */
 	vorbis_analysis_wrote(&vd_, frames);
@@ -111,9 +93,8 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 				res = os_.granulepos - lastGranulepos_;
 
 				size_t nextLen = pos + og_.header_len + og_.body_len;
-				// make chunk larger
-				if (oggChunk->payloadSize < nextLen)
-					oggChunk->payload = (char*)realloc(oggChunk->payload, nextLen);
+				// make chunk larger, doesn't copy as long as it fits into the pool's size class
+				oggChunk->payload = PayloadPool::instance().reallocate(oggChunk->payload, nextLen);
 
 				memcpy(oggChunk->payload + pos, og_.header, og_.header_len);
 				pos += og_.header_len;
@@ -131,8 +112,6 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 		res /= (sampleFormat_.rate / 1000.);
 		// LOG(INFO) << "res: " << res << "\n";
 		lastGranulepos_ = os_.granulepos;
-		// make oggChunk smaller
-		oggChunk->payload = (char*)realloc(oggChunk->payload, pos);
 		oggChunk->payloadSize = pos;
 		listener_->onChunkEncoded(this, oggChunk, res);
 	}
@@ -141,6 +120,18 @@ void OggEncoder::encode(const msg::PcmChunk* chunk)
 }
 
 
+void OggEncoder::reset()
+{
+	ogg_stream_clear(&os_);
+	vorbis_block_clear(&vb_);
+	vorbis_dsp_clear(&vd_);
+	vorbis_comment_clear(&vc_);
+	vorbis_info_clear(&vi_);
+	lastGranulepos_ = 0;
+	initEncoder();
+}
+
+
 void OggEncoder::initEncoder()
 {
 	if (codecOptions_.find(":") == string::npos)
@@ -248,7 +239,7 @@ void OggEncoder::initEncoder()
 		if (result == 0)
 			break;
 		headerChunk_->payloadSize += og_.header_len + og_.body_len;
-		headerChunk_->payload = (char*)realloc(headerChunk_->payload, headerChunk_->payloadSize);
+		headerChunk_->payload = PayloadPool::instance().reallocate(headerChunk_->payload, headerChunk_->payloadSize);
 		LOG(DEBUG) << "HeadLen: " << og_.header_len << ", bodyLen: " << og_.body_len << ", result: " << result << "\n";
 		memcpy(headerChunk_->payload + pos, og_.header, og_.header_len);
 		pos += og_.header_len;
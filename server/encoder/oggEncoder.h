@@ -27,6 +27,8 @@ class OggEncoder : public Encoder
 public:
 	OggEncoder(const std::string& codecOptions = "");
 	virtual void encode(const msg::PcmChunk* chunk);
+	/// Starts a new Ogg stream, with a new header
+	virtual void reset();
 	virtual std::string getAvailableOptions() const;
 	virtual std::string getDefaultOptions() const;
 	virtual std::string name() const;
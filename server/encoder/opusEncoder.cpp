@@ -0,0 +1,180 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <cstring>
+
+#include "opusEncoder.h"
+#include "common/payloadPool.h"
+#include "common/sampleConversion.h"
+#include "common/strCompat.h"
+#include "common/utils/string_utils.h"
+#include "common/snapException.h"
+#include "aixlog.hpp"
+
+using namespace std;
+
+
+/// Max size of an Opus packet, as recommended by the libopus documentation
+static const size_t max_packet_size = 4000;
+
+
+OpusStreamEncoder::OpusStreamEncoder(const std::string& codecOptions) : Encoder(codecOptions), encoder_(NULL)
+{
+	headerChunk_.reset(new msg::CodecHeader("opus"));
+	packet_.resize(max_packet_size);
+}
+
+
+OpusStreamEncoder::~OpusStreamEncoder()
+{
+	if (encoder_ != NULL)
+		opus_encoder_destroy(encoder_);
+}
+
+
+std::string OpusStreamEncoder::getAvailableOptions() const
+{
+	return "BITRATE:[6 - 512] kbit/s";
+}
+
+
+std::string OpusStreamEncoder::getDefaultOptions() const
+{
+	return "BITRATE:192";
+}
+
+
+std::string OpusStreamEncoder::name() const
+{
+	return "opus";
+}
+
+
+bool OpusStreamEncoder::isFrameSize(size_t frames) const
+{
+	/// 2.5ms, multiplied by 1, 2, 4, 8, 16 or 24
+	size_t frames2_5ms = sampleFormat_.rate / 400;
+	for (size_t factor: {1, 2, 4, 8, 16, 24})
+	{
+		if (frames == frames2_5ms * factor)
+			return true;
+	}
+	return false;
+}
+
+
+void OpusStreamEncoder::encode(const msg::PcmChunk* chunk)
+{
+	size_t samples = chunk->getSampleCount();
+	size_t frames = chunk->getFrameCount();
+	size_t pos = pcmBuffer_.size();
+	pcmBuffer_.resize(pos + samples);
+
+	sample::toFloat(chunk->payload, pcmBuffer_.data() + pos, samples, sampleFormat_);
+
+	/// Encode the chunk as one packet if possible, else in 20ms frames
+	size_t frameSize = sampleFormat_.rate / 50;
+	if ((pos == 0) && isFrameSize(frames))
+		frameSize = frames;
+
+	while (pcmBuffer_.size() >= frameSize * sampleFormat_.channels)
+		encodeFrame(frameSize);
+}
+
+
+void OpusStreamEncoder::reset()
+{
+	pcmBuffer_.clear();
+	opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+}
+
+
+void OpusStreamEncoder::encodeFrame(size_t frames)
+{
+	opus_int32 len = opus_encode_float(encoder_, pcmBuffer_.data(), frames, packet_.data(), packet_.size());
+	pcmBuffer_.erase(pcmBuffer_.begin(), pcmBuffer_.begin() + frames * sampleFormat_.channels);
+	if (len < 0)
+	{
+		LOG(ERROR) << "Failed to encode opus frame: " << opus_strerror(len) << "\n";
+		return;
+	}
+
+	msg::PcmChunk* opusChunk = new msg::PcmChunk(sampleFormat_, 0);
+	opusChunk->payload = PayloadPool::instance().reallocate(opusChunk->payload, len);
+	memcpy(opusChunk->payload, packet_.data(), len);
+	opusChunk->payloadSize = len;
+	double duration = frames / ((double)sampleFormat_.rate / 1000.);
+	listener_->onChunkEncoded(this, opusChunk, duration);
+}
+
+
+void OpusStreamEncoder::initEncoder()
+{
+	if (codecOptions_.find(":") == string::npos)
+		throw SnapException("Invalid codec options: \"" + codecOptions_ + "\"");
+	string mode = utils::string::trim_copy(codecOptions_.substr(0, codecOptions_.find(":")));
+	if (mode != "BITRATE")
+		throw SnapException("Unsupported codec mode: \"" + mode + "\". Available: \"BITRATE\"");
+
+	int bitrate = 192;
+	try
+	{
+		bitrate = cpt::stoi(utils::string::trim_copy(codecOptions_.substr(codecOptions_.find(":") + 1)));
+	}
+	catch(...)
+	{
+		throw SnapException("Invalid codec option: \"" + codecOptions_ + "\"");
+	}
+	if ((bitrate < 6) || (bitrate > 512))
+		throw SnapException("bitrate has to be between 6 and 512 kbit/s");
+
+	if ((sampleFormat_.rate != 8000) && (sampleFormat_.rate != 12000) && (sampleFormat_.rate != 16000) && (sampleFormat_.rate != 24000) && (sampleFormat_.rate != 48000))
+		throw SnapException("Opus supports only sample rates of 8000, 12000, 16000, 24000 and 48000 Hz");
+	if ((sampleFormat_.channels < 1) || (sampleFormat_.channels > 2))
+		throw SnapException("Opus supports only 1 or 2 channels");
+
+	int error;
+	/// CELT only mode with the lowest algorithmic delay (2.5ms lookahead)
+	encoder_ = opus_encoder_create(sampleFormat_.rate, sampleFormat_.channels, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
+	if (error != OPUS_OK)
+		throw SnapException("failed to init opus encoder: " + string(opus_strerror(error)));
+
+	opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate * 1000));
+	opus_encoder_ctl(encoder_, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+	opus_int32 lookahead = 0;
+	opus_encoder_ctl(encoder_, OPUS_GET_LOOKAHEAD(&lookahead));
+	LOG(INFO) << "Opus bitrate: " << bitrate << " kbit/s, lookahead: " << lookahead << " frames\n";
+
+	/// "OpusHead" identification header (RFC 7845, 5.1), little endian.
+	/// The pre-skip is the encoder's lookahead, the decoder shifts the timestamps accordingly
+	unsigned char head[19] = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd'};
+	head[8] = 1;
+	head[9] = sampleFormat_.channels;
+	head[10] = lookahead & 0xff;
+	head[11] = (lookahead >> 8) & 0xff;
+	for (size_t n = 0; n < 4; ++n)
+		head[12 + n] = (sampleFormat_.rate >> (8 * n)) & 0xff;
+	/// output gain and channel mapping family
+	head[16] = head[17] = head[18] = 0;
+
+	headerChunk_->payload = PayloadPool::instance().reallocate(headerChunk_->payload, sizeof(head));
+	memcpy(headerChunk_->payload, head, sizeof(head));
+	headerChunk_->payloadSize = sizeof(head);
+}
+
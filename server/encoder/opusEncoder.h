@@ -0,0 +1,61 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef OPUS_ENCODER_H
+#define OPUS_ENCODER_H
+#include "encoder.h"
+#include <vector>
+#include <opus/opus.h>
+
+
+/// Opus encoder, for low latency and low bandwidth transport
+/**
+ * Named OpusStreamEncoder, as libopus already defines "OpusEncoder".
+ * Each encoded chunk is one Opus packet. Chunks with a duration that is a
+ * valid Opus frame size (2.5, 5, 10, 20, 40 or 60ms) are encoded 1:1 into a
+ * packet, so that the timestamps of the encoded chunks are exact.
+ * Other chunk sizes are buffered and encoded in 20ms frames.
+ * Opus supports only sample rates of 8, 12, 16, 24 and 48kHz and 1 or 2 channels.
+ */
+class OpusStreamEncoder : public Encoder
+{
+public:
+	OpusStreamEncoder(const std::string& codecOptions = "");
+	~OpusStreamEncoder();
+	virtual void encode(const msg::PcmChunk* chunk);
+	virtual void reset();
+	virtual std::string getAvailableOptions() const;
+	virtual std::string getDefaultOptions() const;
+	virtual std::string name() const;
+
+protected:
+	virtual void initEncoder();
+
+private:
+	bool isFrameSize(size_t frames) const;
+	void encodeFrame(size_t frames);
+
+	OpusEncoder* encoder_;
+	/// Interleaved samples that are not yet encoded
+	std::vector<float> pcmBuffer_;
+	std::vector<unsigned char> packet_;
+};
+
+
+#endif
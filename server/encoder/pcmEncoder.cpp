@@ -19,6 +19,7 @@
 #include <memory>
 #include "common/endian.hpp"
 #include "pcmEncoder.h"
+#include "common/payloadPool.h"
 
 
 #define ID_RIFF 0x46464952
@@ -43,7 +44,7 @@ void PcmEncoder::encode(const msg::PcmChunk* chunk)
 void PcmEncoder::initEncoder()
 {
 	headerChunk_->payloadSize = 44;
-	headerChunk_->payload = (char*)malloc(headerChunk_->payloadSize);
+	headerChunk_->payload = PayloadPool::instance().reallocate(headerChunk_->payload, headerChunk_->payloadSize);
 	char* payload = headerChunk_->payload;
 	assign(payload, SWAP_32(ID_RIFF));
 	assign(payload + 4, SWAP_32(36));
@@ -0,0 +1,138 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SHARED_MESSAGE_H
+#define SHARED_MESSAGE_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <asio.hpp>
+#include "message/message.h"
+#include "common/endian.hpp"
+#include "common/payloadPool.h"
+
+
+class SharedMessage;
+typedef std::shared_ptr<const SharedMessage> SharedMessagePtr;
+
+
+/// Message that is serialized once and sent to many clients
+/**
+ * The message is serialized exactly once per protocol version into an
+ * immutable buffer, that is shared by all sessions. Only the header, which
+ * carries the per-client "sent" timestamp, is written per send. Header and
+ * shared payload are passed to the socket in a single gathered write.
+ * The buffers are taken from the PayloadPool and serialized in place.
+ */
+class SharedMessage
+{
+public:
+	/// Max size of the serialized BaseMessage header
+	static const size_t header_size = msg::BaseMessage::header_v2_size;
+	typedef std::array<char, header_size> Header;
+
+	SharedMessage(const msg::message_ptr& message) : message_(message), buffer_{NULL, NULL}, bufferSize_{0, 0}
+	{
+	}
+
+	~SharedMessage()
+	{
+		for (auto buffer: buffer_)
+			PayloadPool::instance().release(buffer);
+	}
+
+	/// The message that has been serialized
+	const msg::message_ptr& message() const
+	{
+		return message_;
+	}
+
+	/// Total size on the wire (header + payload)
+	size_t size(uint16_t version) const
+	{
+		size_t bufferSize;
+		serialized(version, bufferSize);
+		return bufferSize;
+	}
+
+	/// Fills header with the serialized header, "sent" is set to the current time
+	/// @return header and shared payload, ready for a gathered write
+	std::vector<asio::const_buffer> buffers(Header& header, uint16_t version) const
+	{
+		size_t bufferSize;
+		const char* buffer = serialized(version, bufferSize);
+		size_t headerSize = msg::BaseMessage::header_size;
+		tv sent;
+		if (version >= 2)
+		{
+			/// offset of "sent": type, flags, id, refersTo
+			headerSize = msg::BaseMessage::header_v2_size;
+			memcpy(header.data(), buffer, headerSize);
+			int64_t val = SWAP_64(sent.toNs());
+			memcpy(header.data() + 2*sizeof(uint16_t) + 2*sizeof(uint32_t), &val, sizeof(int64_t));
+		}
+		else
+		{
+			/// offset of "sent": type, id, refersTo
+			memcpy(header.data(), buffer, headerSize);
+			int32_t val = SWAP_32(sent.sec);
+			memcpy(header.data() + 3*sizeof(uint16_t), &val, sizeof(int32_t));
+			val = SWAP_32(sent.usec);
+			memcpy(header.data() + 3*sizeof(uint16_t) + sizeof(int32_t), &val, sizeof(int32_t));
+		}
+
+		std::vector<asio::const_buffer> result;
+		result.reserve(2);
+		result.push_back(asio::buffer(header.data(), headerSize));
+		result.push_back(asio::buffer(buffer + headerSize, bufferSize - headerSize));
+		return result;
+	}
+
+private:
+	/// Serializes the message on first use for the protocol version
+	/// @param bufferSize size of the serialized message
+	const char* serialized(uint16_t version, size_t& bufferSize) const
+	{
+		size_t idx = (version >= 2) ? 1 : 0;
+		std::call_once(serializedFlag_[idx], [this, version, idx]()
+		{
+			size_t size = msg::BaseMessage::getHeaderSize(version) + message_->getSize(version);
+			buffer_[idx] = PayloadPool::instance().allocate(size);
+			omembuf databuf(buffer_[idx], buffer_[idx] + size);
+			std::ostream stream(&databuf);
+			message_->serialize(stream, version);
+			bufferSize_[idx] = databuf.written();
+		});
+		bufferSize = bufferSize_[idx];
+		return buffer_[idx];
+	}
+
+	msg::message_ptr message_;
+	mutable std::once_flag serializedFlag_[2];
+	mutable char* buffer_[2];
+	mutable size_t bufferSize_[2];
+};
+
+
+
+#endif
+
+
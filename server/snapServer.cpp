@@ -16,8 +16,11 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
+#include <thread>
+#include <vector>
 #include <sys/resource.h>
 
 #include "popl.hpp"
@@ -26,6 +29,7 @@
 #endif
 #include "common/timeDefs.h"
 #include "common/utils/string_utils.h"
+#include "common/strCompat.h"
 #include "common/signalHandler.h"
 #include "common/snapException.h"
 #include "common/sampleFormat.h"
@@ -65,13 +69,18 @@ int main(int argc, char* argv[])
 		auto versionSwitch =     op.add<Switch>("v", "version", "Show version number");
 		/*auto portValue =*/         op.add<Value<size_t>>("p", "port", "Server port", settings.port, &settings.port);
 		/*auto controlPortValue =*/  op.add<Value<size_t>>("", "controlPort", "Remote control port", settings.controlPort, &settings.controlPort);
-		auto streamValue =       op.add<Value<string>>("s", "stream", "URI of the PCM input stream.\nFormat: TYPE://host/path?name=NAME\n[&codec=CODEC]\n[&sampleformat=SAMPLEFORMAT]", pcmStream, &pcmStream);
+		/*auto timePortValue =*/     op.add<Value<size_t>>("", "timePort", "UDP time sync port (0 = disabled)", settings.timePort, &settings.timePort);
+		/*auto timeDelayValue =*/    op.add<Value<size_t>, Attribute::hidden>("", "timeDelay", "Random delay of the UDP time sync replies [ms], to test the time sync", settings.timeDelayMs, &settings.timeDelayMs);
+		auto streamValue =       op.add<Value<string>>("s", "stream", "URI of the PCM input stream.\nFormat: TYPE://host/path?name=NAME\n[&codec=CODEC[,CODEC...]]\n[&sampleformat=SAMPLEFORMAT]", pcmStream, &pcmStream);
 
 		/*auto sampleFormatValue =*/ op.add<Value<string>>("", "sampleformat", "Default sample format", settings.sampleFormat, &settings.sampleFormat);
-		/*auto codecValue =*/        op.add<Value<string>>("c", "codec", "Default transport codec\n(flac|ogg|pcm)[:options]\nType codec:? to get codec specific options", settings.codec, &settings.codec);
+		/*auto codecValue =*/        op.add<Value<string>>("c", "codec", "Default transport codec\n(flac|ogg|opus|pcm)[:options][,...]\nType codec:? to get codec specific options", settings.codec, &settings.codec);
 		/*auto streamBufferValue =*/ op.add<Value<size_t>>("", "streamBuffer", "Default stream read buffer [ms]", settings.streamReadMs, &settings.streamReadMs);
 		/*auto bufferValue =*/       op.add<Value<int>>("b", "buffer", "Buffer [ms]", settings.bufferMs, &settings.bufferMs);
 		/*auto muteSwitch =*/        op.add<Switch>("", "sendToMuted", "Send audio to muted clients", &settings.sendAudioToMutedClients);
+		/*auto fallbackSwitch =*/    op.add<Switch>("", "codecFallback", "Switch congested clients to the stream's next codec", &settings.codecFallback);
+		/*auto configSaveDelayValue =*/ op.add<Value<size_t>>("", "configSaveDelay", "Delay for saving config changes [ms]", settings.configSaveDelayMs, &settings.configSaveDelayMs);
+		auto threadsValue =      op.add<Value<string>>("", "threads", "Number of server worker threads\n(auto = number of CPU cores)", "auto");
 #ifdef HAS_DAEMON
 		int processPriority(0);
 		auto daemonOption =      op.add<Implicit<int>>("d", "daemon", "Daemonize\noptional process priority [-20..19]", 0, &processPriority);
@@ -196,18 +205,28 @@ int main(int argc, char* argv[])
 		if (settings.bufferMs < 400)
 			settings.bufferMs = 400;
 
+		size_t threads(1);
+		if (threadsValue->value() == "auto")
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		else
+			threads = std::max(1, cpt::stoi(threadsValue->value()));
+
 		asio::io_service io_service;
 		std::unique_ptr<StreamServer> streamServer(new StreamServer(&io_service, settings));
 		streamServer->start();
 
+		LOG(INFO) << "Number of threads: " << threads << "\n";
 		auto func = [](asio::io_service* ioservice)->void{ioservice->run();};
-		std::thread t(func, &io_service);
+		std::vector<std::thread> workers;
+		for (size_t n=0; n<threads; ++n)
+			workers.emplace_back(func, &io_service);
 
 		while (!g_terminated)
 			chronos::sleep(100);
 
 		io_service.stop();
-		t.join();
+		for (auto& worker: workers)
+			worker.join();
 
 		LOG(INFO) << "Stopping streamServer" << endl;
 		streamServer->stop();
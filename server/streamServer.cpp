@@ -20,6 +20,7 @@
 #include "message/time.h"
 #include "message/hello.h"
 #include "message/streamTags.h"
+#include "common/payloadPool.h"
 #include "aixlog.hpp"
 #include "config.h"
 #include <iostream>
@@ -31,6 +32,12 @@ using json = nlohmann::json;
 
 StreamServer::StreamServer(asio::io_service* io_service, const StreamServerSettings& streamServerSettings) : 
 	io_service_(io_service), 
+	strand_(*io_service),
+	configSaveTimer_(*io_service),
+	configSavePending_(false),
+	serverStatusDirty_(true),
+	serverStatusPending_(false),
+	revision_(0),
 	acceptor_v4_(nullptr),
 	acceptor_v6_(nullptr),
 	settings_(streamServerSettings)
@@ -51,15 +58,20 @@ void StreamServer::onMetaChanged(const PcmStream* pcmStream)
 	const auto meta = pcmStream->getMeta();
 	//cout << "metadata = " << meta->msg.dump(3) << "\n";
 
-	for (auto s : sessions_)
+	SharedMessagePtr shared_meta = make_shared<SharedMessage>(meta);
 	{
-		if (s->pcmStream().get() == pcmStream)
-			s->sendAsync(meta);
+		std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+		auto iter = streamSessions_.find(pcmStream);
+		if (iter != streamSessions_.end())
+		{
+			for (auto s : iter->second)
+				s->sendAsync(shared_meta);
+		}
 	}
 
+	serverStatusDirty_ = true;
 	LOG(INFO) << "onMetaChanged (" << pcmStream->getName() << ")\n";
-	json notification = jsonrpcpp::Notification("Stream.OnMetadata", jsonrpcpp::Parameter("id", pcmStream->getId(), "meta", meta->msg)).to_json();
-	controlServer_->send(notification.dump(), NULL);
+	sendNotification(jsonrpcpp::Notification("Stream.OnMetadata", jsonrpcpp::Parameter("id", pcmStream->getId(), "meta", meta->msg)), NULL);
 	////cout << "Notification: " << notification.dump() << "\n";
 }
 
@@ -67,41 +79,62 @@ void StreamServer::onStateChanged(const PcmStream* pcmStream, const ReaderState&
 {
 	/// Notification: {"jsonrpc":"2.0","method":"Stream.OnUpdate","params":{"id":"stream 1","stream":{"id":"stream 1","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 1","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 1","scheme":"pipe"}}}}
 	LOG(INFO) << "onStateChanged (" << pcmStream->getName() << "): " << state << "\n";
+	serverStatusDirty_ = true;
 //	LOG(INFO) << pcmStream->toJson().dump(4);
-	json notification = jsonrpcpp::Notification("Stream.OnUpdate", jsonrpcpp::Parameter("id", pcmStream->getId(), "stream", pcmStream->toJson())).to_json();
-	controlServer_->send(notification.dump(), NULL);
+	sendNotification(jsonrpcpp::Notification("Stream.OnUpdate", jsonrpcpp::Parameter("id", pcmStream->getId(), "stream", pcmStream->toJson())), NULL);
 	////cout << "Notification: " << notification.dump() << "\n";
 }
 
 
-void StreamServer::onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration)
+void StreamServer::onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration, size_t rendition)
 {
-//	LOG(INFO) << "onChunkRead (" << pcmStream->getName() << "): " << duration << "ms\n";
-	bool isDefaultStream(pcmStream == streamManager_->getDefaultStream().get());
-
-	msg::message_ptr shared_message(chunk);
+//	LOG(INFO) << "onChunkRead (" << pcmStream->getName() << ", " << rendition << "): " << duration << "ms\n";
+	/// serialize once, the sessions share the serialized payload
+	SharedMessagePtr shared_message = make_shared<SharedMessage>(msg::message_ptr(chunk));
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
-	for (auto s : sessions_)
+	auto& histories = chunkHistory_[pcmStream];
+	if (histories.size() <= rendition)
+		histories.resize(rendition + 1, ChunkHistory(settings_.bufferMs));
+	histories[rendition].add(shared_message, duration);
+
+	auto iter = streamSessions_.find(pcmStream);
+	if (iter == streamSessions_.end())
+		return;
+
+	vector<session_ptr> congested;
+	for (auto s : iter->second)
 	{
-		if (!settings_.sendAudioToMutedClients)
-		{
-			GroupPtr group = Config::instance().getGroupFromClient(s->clientId);
-			if (group)
-			{
-				if (group->muted)
-					continue;
+		if (s->rendition() != rendition)
+			continue;
 
-				ClientInfoPtr client = group->getClient(s->clientId);
-				if (client && client->config.volume.muted)
-					continue;
-			}
-		}
+		if (!settings_.sendAudioToMutedClients && s->muted())
+			continue;
 
-		if (!s->pcmStream() && isDefaultStream)//->getName() == "default")
-			s->sendAsync(shared_message);
-		else if (s->pcmStream().get() == pcmStream)
-			s->sendAsync(shared_message);
+		/// chunks were dropped, because the session could not keep up
+		if (settings_.codecFallback && (s->resetDroppedChunks() > 0) && (rendition + 1 < pcmStream->getRenditionCount()))
+			congested.push_back(s);
+
+		s->sendAsync(shared_message);
 	}
+
+	if (congested.empty())
+		return;
+
+	/// setPcmStream must be called within the strand. The session might have switched the stream
+	/// or the rendition in the meantime, then it is left alone
+	strand_.post([this, congested, pcmStream, rendition]()
+	{
+		std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+		for (auto s : congested)
+		{
+			PcmStreamPtr stream = s->pcmStream();
+			if ((stream.get() != pcmStream) || (s->rendition() != rendition))
+				continue;
+			LOG(INFO) << "Session " << s->clientId << " is congested, switching from codec " << stream->getCodec(rendition)
+				<< " to " << stream->getCodec(rendition + 1) << "\n";
+			setPcmStream(s, stream, rendition + 1);
+		}
+	});
 }
 
 
@@ -111,6 +144,28 @@ void StreamServer::onResync(const PcmStream* pcmStream, double ms)
 }
 
 
+void StreamServer::onHeaderChanged(const PcmStream* pcmStream, size_t rendition)
+{
+	LOG(INFO) << "onHeaderChanged (" << pcmStream->getName() << ", " << pcmStream->getCodec(rendition) << ")\n";
+	msg::message_ptr header = pcmStream->getHeader(rendition);
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	/// The history was encoded with the old header
+	auto history = chunkHistory_.find(pcmStream);
+	if ((history != chunkHistory_.end()) && (rendition < history->second.size()))
+		history->second[rendition].clear();
+
+	auto iter = streamSessions_.find(pcmStream);
+	if (iter == streamSessions_.end())
+		return;
+
+	for (auto s : iter->second)
+	{
+		if (s->rendition() == rendition)
+			s->sendAsync(header);
+	}
+}
+
+
 void StreamServer::onDisconnect(StreamSession* streamSession)
 {
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
@@ -121,44 +176,50 @@ void StreamServer::onDisconnect(StreamSession* streamSession)
 
 	LOG(INFO) << "onDisconnect: " << session->clientId << "\n";
 	LOG(DEBUG) << "sessions: " << sessions_.size() << "\n";
-	// don't block: remove StreamSession in a thread
-	auto func = [](shared_ptr<StreamSession> s)->void{s->stop();};
-	std::thread t(func, session);
-	t.detach();
+	// doesn't block: the session is closed asynchronously
+	session->stop();
+	removeFromIndex(session);
 	sessions_.erase(session);
 
 	LOG(DEBUG) << "sessions: " << sessions_.size() << "\n";
 
-	// notify controllers if not yet done
-	ClientInfoPtr clientInfo = Config::instance().getClientInfo(session->clientId);
-	if (!clientInfo || !clientInfo->connected)
-		return;
-
-	clientInfo->connected = false;
-	chronos::systemtimeofday(&clientInfo->lastSeen);
-	Config::instance().save();
-	if (controlServer_ != nullptr)
+	// Config and control clients are only touched within the strand
+	strand_.post([this, session]()
 	{
-		/// Check if there is no session of this client is left
-		/// Can happen in case of ungraceful disconnect/reconnect or 
-		/// in case of a duplicate client id
-		if (getStreamSession(clientInfo->id) == nullptr)
+		// notify controllers if not yet done
+		ClientInfoPtr clientInfo = Config::instance().getClientInfo(session->clientId);
+		if (!clientInfo || !clientInfo->connected)
+			return;
+
+		clientInfo->connected = false;
+		chronos::systemtimeofday(&clientInfo->lastSeen);
+		saveConfig();
+		if (controlServer_ != nullptr)
 		{
-			/// Notification: {"jsonrpc":"2.0","method":"Client.OnDisconnect","params":{"client":{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":81}},"connected":false,"host":{"arch":"x86_64","ip":"192.168.0.54","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025523,"usec":814067},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}},"id":"00:21:6a:7d:74:fc"}}
-			json notification = jsonrpcpp::Notification("Client.OnDisconnect", jsonrpcpp::Parameter("id", clientInfo->id, "client", clientInfo->toJson())).to_json();
-			controlServer_->send(notification.dump());
-			////cout << "Notification: " << notification.dump() << "\n";
+			/// Check if there is no session of this client is left
+			/// Can happen in case of ungraceful disconnect/reconnect or 
+			/// in case of a duplicate client id
+			if (getStreamSession(clientInfo->id) == nullptr)
+			{
+				/// Notification: {"jsonrpc":"2.0","method":"Client.OnDisconnect","params":{"client":{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":81}},"connected":false,"host":{"arch":"x86_64","ip":"192.168.0.54","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025523,"usec":814067},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}},"id":"00:21:6a:7d:74:fc"}}
+				sendNotification(jsonrpcpp::Notification("Client.OnDisconnect", jsonrpcpp::Parameter("id", clientInfo->id, "client", clientInfo->toJson())), NULL);
+				////cout << "Notification: " << notification.dump() << "\n";
+			}
 		}
-	}
+	});
 }
 
 
-void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::entity_ptr& response, jsonrpcpp::notification_ptr& notification) const
+void StreamServer::ProcessRequest(ControlSession* controlSession, const jsonrpcpp::request_ptr request, jsonrpcpp::entity_ptr& response, jsonrpcpp::notification_ptr& notification)
 {
 	try
 	{
 		////LOG(INFO) << "StreamServer::ProcessRequest method: " << request->method << ", " << "id: " << request->id() << "\n";
 		Json result;
+		/// Getters and session settings don't change the config
+		bool isGetter((request->method().find(".Get") != string::npos) || (request->method() == "Server.SetDeltaUpdates") || (request->method() == "Server.Subscribe"));
+		if (!isGetter)
+			serverStatusDirty_ = true;
 
 		if (request->method().find("Client.") == 0)
 		{
@@ -204,6 +265,16 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 				result["name"] = clientInfo->config.name;
 				notification.reset(new jsonrpcpp::Notification("Client.OnNameChanged", jsonrpcpp::Parameter("id", clientInfo->id, "name", clientInfo->config.name)));
 			}
+			else if (request->method() == "Client.SetCodec")
+			{
+				/// Request:      {"id":12,"jsonrpc":"2.0","method":"Client.SetCodec","params":{"id":"00:21:6a:7d:74:fc#2","codec":"pcm"}}
+				/// Response:     {"id":12,"jsonrpc":"2.0","result":{"codec":"pcm"}}
+				/// Notification: {"jsonrpc":"2.0","method":"Client.OnCodecChanged","params":{"id":"00:21:6a:7d:74:fc#2","codec":"pcm"}}
+				/// An empty codec or a codec that is not offered by the stream selects the stream's default codec
+				clientInfo->config.codec = request->params().get<string>("codec");
+				result["codec"] = clientInfo->config.codec;
+				notification.reset(new jsonrpcpp::Notification("Client.OnCodecChanged", jsonrpcpp::Parameter("id", clientInfo->id, "codec", clientInfo->config.codec)));
+			}
 			else
 				throw jsonrpcpp::MethodNotFoundException(request->id());
 
@@ -211,6 +282,7 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 			if (request->method().find("Client.Set") == 0)
 			{
 				/// Update client
+				updateMuted(clientInfo->id);
 				session_ptr session = getStreamSession(clientInfo->id);
 				if (session != nullptr)
 				{
@@ -221,6 +293,8 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 					serverSettings->setMuted(clientInfo->config.volume.muted || group->muted);
 					serverSettings->setLatency(clientInfo->config.latency);
 					session->sendAsync(serverSettings);
+					if (request->method() == "Client.SetCodec")
+						setPcmStream(session, session->pcmStream());
 				}
 			}
 		}
@@ -247,6 +321,7 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 				/// Update clients
 				for (auto client: group->clients)
 				{
+					updateMuted(client->id);
 					session_ptr session = getStreamSession(client->id);
 					if (session != nullptr)
 					{
@@ -282,8 +357,7 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 					if (session && (session->pcmStream() != stream))
 					{
 						session->sendAsync(stream->getMeta());
-						session->sendAsync(stream->getHeader());
-						session->setPcmStream(stream);
+						setPcmStream(session, stream);
 					}
 				}
 
@@ -298,6 +372,7 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 				/// Notification: {"jsonrpc":"2.0","method":"Server.OnUpdate","params":{"server":{"groups":[{"clients":[{"config":{"instance":2,"latency":6,"name":"123 456","volume":{"muted":false,"percent":48}},"connected":true,"host":{"arch":"x86_64","ip":"127.0.0.1","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc#2","lastSeen":{"sec":1488025901,"usec":864472},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}},{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":100}},"connected":true,"host":{"arch":"x86_64","ip":"127.0.0.1","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025905,"usec":45238},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}}],"id":"4dcc4e3b-c699-a04b-7f0c-8260d23c43e1","muted":false,"name":"","stream_id":"stream 2"}],"server":{"host":{"arch":"x86_64","ip":"","mac":"","name":"T400","os":"Linux Mint 17.3 Rosa"},"snapserver":{"controlProtocolVersion":1,"name":"Snapserver","protocolVersion":1,"version":"0.10.0"}},"streams":[{"id":"stream 1","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 1","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 1","scheme":"pipe"}},{"id":"stream 2","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 2","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 2","scheme":"pipe"}}]}}}
 				vector<string> clients = request->params().get("clients");
 				/// Remove clients from group
+				vector<ClientInfoPtr> removedClients;
 				for (auto iter = group->clients.begin(); iter != group->clients.end();)
 				{
 					auto client = *iter;
@@ -307,8 +382,14 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 						continue;
 					}
 					iter = group->clients.erase(iter);
+					removedClients.push_back(client);
+				}
+				Config::instance().updateIndex();
+				for (auto client: removedClients)
+				{
 					GroupPtr newGroup = Config::instance().addClientInfo(client);
 					newGroup->streamId = group->streamId;
+					updateMuted(client->id);
 				}
 
 				/// Add clients to group
@@ -335,19 +416,21 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 					if (session && stream && (session->pcmStream() != stream))
 					{
 						session->sendAsync(stream->getMeta());
-						session->sendAsync(stream->getHeader());
-						session->setPcmStream(stream);
+						setPcmStream(session, stream);
 					}
 				}
+				Config::instance().updateIndex();
+				for (const auto& clientId: clients)
+					updateMuted(clientId);
 
 				if (group->empty())
 					Config::instance().remove(group);
 
-				json server = Config::instance().getServerStatus(streamManager_->toJson());
-				result["server"] = server;
+				result["server"] = getServerStatus();
 
 				/// Notify others: since at least two groups are affected, send a complete server update
-				notification.reset(new jsonrpcpp::Notification("Server.OnUpdate", jsonrpcpp::Parameter("server", server)));
+				/// The notification's content is filled in by sendServerUpdate
+				notification.reset(new jsonrpcpp::Notification("Server.OnUpdate"));
 			}
 			else
 				throw jsonrpcpp::MethodNotFoundException(request->id());
@@ -361,7 +444,7 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 				// <major>: backwards incompatible change
 				result["major"] = 2;
 				// <minor>: feature addition to the API
-				result["minor"] = 0;
+				result["minor"] = 4;
 				// <patch>: bugfix release
 				result["patch"] = 0;
 			}
@@ -369,7 +452,43 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 			{
 				/// Request:      {"id":1,"jsonrpc":"2.0","method":"Server.GetStatus"}
 				/// Response:     {"id":1,"jsonrpc":"2.0","result":{"server":{"groups":[{"clients":[{"config":{"instance":2,"latency":6,"name":"123 456","volume":{"muted":false,"percent":48}},"connected":true,"host":{"arch":"x86_64","ip":"127.0.0.1","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc#2","lastSeen":{"sec":1488025696,"usec":578142},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}},{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":81}},"connected":true,"host":{"arch":"x86_64","ip":"192.168.0.54","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025696,"usec":611255},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}}],"id":"4dcc4e3b-c699-a04b-7f0c-8260d23c43e1","muted":false,"name":"","stream_id":"stream 2"}],"server":{"host":{"arch":"x86_64","ip":"","mac":"","name":"T400","os":"Linux Mint 17.3 Rosa"},"snapserver":{"controlProtocolVersion":1,"name":"Snapserver","protocolVersion":1,"version":"0.10.0"}},"streams":[{"id":"stream 1","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 1","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 1","scheme":"pipe"}},{"id":"stream 2","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 2","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 2","scheme":"pipe"}}]}}}
-				result["server"] = Config::instance().getServerStatus(streamManager_->toJson());
+				/// The status is returned together with its revision, i.e. the base of the next Server.OnDelta
+				commitServerStatus();
+				result["server"] = notifiedServerStatus_;
+				result["revision"] = revision_;
+			}
+			else if (request->method() == "Server.GetMetrics")
+			{
+				/// Request:      {"id":11,"jsonrpc":"2.0","method":"Server.GetMetrics"}
+				/// Response:     {"id":11,"jsonrpc":"2.0","result":{"streams":[{"id":"stream 1","pipeline":{"encode":{"buckets":[{"count":1180,"ltUs":512},{"count":290,"ltUs":1024}],"count":1470,"maxUs":973,"meanUs":402.7,"p50Us":512,"p99Us":1024},"overruns":0,"queue":{"buckets":[{"count":1402,"ltUs":64},{"count":68,"ltUs":128}],"count":1470,"maxUs":117,"meanUs":38.2,"p50Us":64,"p99Us":128},"queued":0,"read":{"buckets":[{"count":1466,"ltUs":32},{"count":4,"ltUs":256}],"count":1470,"maxUs":201,"meanUs":12.5,"p50Us":32,"p99Us":32},"stalls":0},"renditions":[{"codec":"flac","history":{"bytes":61432,"chunks":50,"chunksSent":1470,"durationMs":1000.0,"hitRate":1.0,"hits":30,"requests":30},"users":2},{"codec":"pcm","history":{"bytes":192000,"chunks":50,"chunksSent":480,"durationMs":1000.0,"hitRate":1.0,"hits":10,"requests":10},"users":1}]}],"payloads":{"allocations":29876,"cached":41,"heapAllocations":97,"heapFrees":0,"inUse":56,"poolHits":29779}}}
+				result["streams"] = getMetrics();
+				result["payloads"] = PayloadPool::instance().toJson();
+			}
+			else if (request->method() == "Server.SetDeltaUpdates")
+			{
+				/// Request:      {"id":9,"jsonrpc":"2.0","method":"Server.SetDeltaUpdates","params":{"enabled":true}}
+				/// Response:     {"id":9,"jsonrpc":"2.0","result":{"enabled":true,"revision":12}}
+				/// Afterwards the client receives "Server.OnDelta" instead of "Server.OnUpdate"
+				bool enabled = request->params().get<bool>("enabled");
+				controlSession->setDeltaUpdates(enabled);
+				commitServerStatus();
+				result["enabled"] = enabled;
+				result["revision"] = revision_;
+			}
+			else if (request->method() == "Server.Subscribe")
+			{
+				/// Request:      {"id":10,"jsonrpc":"2.0","method":"Server.Subscribe","params":{"topics":["Client","Group.OnMute"],"ids":["4dcc4e3b-c699-a04b-7f0c-8260d23c43e1"]}}
+				/// Response:     {"id":10,"jsonrpc":"2.0","result":{"ids":["4dcc4e3b-c699-a04b-7f0c-8260d23c43e1"],"topics":["Client","Group.OnMute"]}}
+				/// Missing or empty "topics" resp. "ids" will not filter
+				auto subscription = make_shared<Subscription>();
+				subscription->topics = request->params().get<set<string>>("topics", set<string>());
+				subscription->ids = request->params().get<set<string>>("ids", set<string>());
+				if (subscription->topics.empty() && subscription->ids.empty())
+					controlSession->setSubscription(nullptr);
+				else
+					controlSession->setSubscription(subscription);
+				result["topics"] = subscription->topics;
+				result["ids"] = subscription->ids;
 			}
 			else if (request->method() == "Server.DeleteClient")
 			{
@@ -381,12 +500,13 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 					throw jsonrpcpp::InternalErrorException("Client not found", request->id());
 
 				Config::instance().remove(clientInfo);
+				updateMuted(clientInfo->id);
 
-				json server = Config::instance().getServerStatus(streamManager_->toJson());
-				result["server"] = server;
+				result["server"] = getServerStatus();
 
 				/// Notify others
-				notification.reset(new jsonrpcpp::Notification("Server.OnUpdate", jsonrpcpp::Parameter("server", server)));
+				/// The notification's content is filled in by sendServerUpdate
+				notification.reset(new jsonrpcpp::Notification("Server.OnUpdate"));
 			}
 			else
 				throw jsonrpcpp::MethodNotFoundException(request->id());
@@ -421,7 +541,8 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 		else
 			throw jsonrpcpp::MethodNotFoundException(request->id());
 
-		Config::instance().save();
+		if (!isGetter)
+			saveConfig();
 		response.reset(new jsonrpcpp::Response(*request, result));
 	}
 	catch (const jsonrpcpp::RequestException& e)
@@ -438,6 +559,24 @@ void StreamServer::ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcp
 
 
 void StreamServer::onMessageReceived(ControlSession* controlSession, const std::string& message)
+{
+	/// Requests are processed within the strand, so they don't race with other requests or stream clients
+	shared_ptr<ControlSession> session = controlSession->shared_from_this();
+	strand_.post([this, session, message]()
+	{
+		try
+		{
+			processMessage(session.get(), message);
+		}
+		catch (const std::exception& e)
+		{
+			SLOG(ERROR) << "Exception in StreamServer::processMessage: " << e.what() << endl;
+		}
+	});
+}
+
+
+void StreamServer::processMessage(ControlSession* controlSession, const std::string& message)
 {
 	LOG(DEBUG) << "onMessageReceived: " << message << "\n";
 	jsonrpcpp::entity_ptr entity(nullptr);
@@ -449,12 +588,12 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 	}
 	catch(const jsonrpcpp::ParseErrorException& e)
 	{
-		controlSession->send(e.to_json().dump());
+		controlSession->sendAsync(e.to_json().dump());
 		return;
 	}
 	catch(const std::exception& e)
 	{
-		controlSession->send(jsonrpcpp::ParseErrorException(e.what()).to_json().dump());
+		controlSession->sendAsync(jsonrpcpp::ParseErrorException(e.what()).to_json().dump());
 		return;
 	}
 
@@ -463,17 +602,17 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 	if (entity->is_request())
 	{
 		jsonrpcpp::request_ptr request = dynamic_pointer_cast<jsonrpcpp::Request>(entity);
-		ProcessRequest(request, response, notification);
+		ProcessRequest(controlSession, request, response, notification);
 		////cout << "Request:      " << request->to_json().dump() << "\n";
 		if (response)
 		{
 			////cout << "Response:     " << response->to_json().dump() << "\n";
-			controlSession->send(response->to_json().dump());
+			controlSession->sendAsync(response->to_json().dump());
 		}
 		if (notification)
 		{
 			////cout << "Notification: " << notification->to_json().dump() << "\n";
-			controlServer_->send(notification->to_json().dump(), controlSession);
+			sendNotification(*notification, controlSession);
 		}
 	}
 	else if (entity->is_batch())
@@ -481,29 +620,50 @@ void StreamServer::onMessageReceived(ControlSession* controlSession, const std::
 		jsonrpcpp::batch_ptr batch = dynamic_pointer_cast<jsonrpcpp::Batch>(entity);
 		////cout << "Batch: " << batch->to_json().dump() << "\n";
 		jsonrpcpp::Batch responseBatch;
-		jsonrpcpp::Batch notificationBatch;
+		vector<jsonrpcpp::notification_ptr> notifications;
 		for (const auto& batch_entity: batch->entities)
 		{
 			if (batch_entity->is_request())
 			{
 				jsonrpcpp::request_ptr request = dynamic_pointer_cast<jsonrpcpp::Request>(batch_entity);
-				ProcessRequest(request, response, notification);
+				ProcessRequest(controlSession, request, response, notification);
 				if (response != nullptr)
 					responseBatch.add_ptr(response);
 				if (notification != nullptr)
-					notificationBatch.add_ptr(notification);
+					notifications.push_back(notification);
 			}
 		}
 		if (!responseBatch.entities.empty())
-			controlSession->send(responseBatch.to_json().dump());
-		if (!notificationBatch.entities.empty())
-			controlServer_->send(notificationBatch.to_json().dump(), controlSession);
+			controlSession->sendAsync(responseBatch.to_json().dump());
+		/// the ControlServer will send them as a Batch
+		for (const auto& notification: notifications)
+			sendNotification(*notification, controlSession);
 	}
 }
 
 
 
 void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::BaseMessage& baseMessage, char* buffer)
+{
+	/// buffer is only valid during this call, messages from clients are small, so just copy them
+	session_ptr session = streamSession->shared_from_this();
+	auto payload = make_shared<vector<char>>(buffer, buffer + baseMessage.size);
+	msg::BaseMessage message(baseMessage);
+	strand_.post([this, session, message, payload]()
+	{
+		try
+		{
+			processMessage(session.get(), message, payload->data());
+		}
+		catch (const std::exception& e)
+		{
+			SLOG(ERROR) << "Exception in StreamServer::processMessage: " << e.what() << endl;
+		}
+	});
+}
+
+
+void StreamServer::processMessage(StreamSession* streamSession, const msg::BaseMessage& baseMessage, char* buffer)
 {
 //	LOG(DEBUG) << "onMessageReceived: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << ", sent: " << baseMessage.sent.sec << "," << baseMessage.sent.usec << ", recv: " << baseMessage.received.sec << "," << baseMessage.received.usec << "\n";
 	if (baseMessage.type == message_type::kTime)
@@ -527,10 +687,17 @@ void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::Ba
 	{
 		msg::Hello helloMsg;
 		helloMsg.deserialize(baseMessage, buffer);
-		streamSession->clientId = helloMsg.getUniqueId();
+		session_ptr session = streamSession->shared_from_this();
+		{
+			std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+			removeFromIndex(session);
+			streamSession->clientId = helloMsg.getUniqueId();
+			if (sessions_.find(session) != sessions_.end())
+				clientSessions_.emplace(streamSession->clientId, session);
+		}
 		LOG(INFO) << "Hello from " << streamSession->clientId << ", host: " << helloMsg.getHostName() << ", v" << helloMsg.getVersion()
 			<< ", ClientName: " << helloMsg.getClientName() << ", OS: " << helloMsg.getOS() << ", Arch: " << helloMsg.getArch()
-			<< ", Protocol version: " << helloMsg.getProtocolVersion() << "\n";
+			<< ", Protocol version: " << helloMsg.getProtocolVersion() << ", Capabilities: " << helloMsg.getCapabilities() << ", Codec: " << helloMsg.getCodec() << "\n";
 
 		LOG(DEBUG) << "request kServerSettings: " << streamSession->clientId << "\n";
 //		std::lock_guard<std::mutex> mlock(mutex_);
@@ -550,8 +717,15 @@ void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::Ba
 		serverSettings->setMuted(client->config.volume.muted || group->muted);
 		serverSettings->setLatency(client->config.latency);
 		serverSettings->setBufferMs(settings_.bufferMs);
+		/// Negotiate capabilities: the client can read both protocol versions, if it supports version 2
+		uint32_t capabilities = helloMsg.getCapabilities() & capability::kCapProtocolV2;
+		serverSettings->setCapabilities(capabilities);
+		if (timeServer_)
+			serverSettings->setTimePort(settings_.timePort);
 		serverSettings->refersTo = helloMsg.id;
+		streamSession->setProtocolVersion((capabilities & capability::kCapProtocolV2) ? 2 : 1);
 		streamSession->sendAsync(serverSettings);
+		streamSession->setMuted(client->config.volume.muted || group->muted);
 
 		client->host.mac = helloMsg.getMacAddress();
 		client->host.ip = streamSession->getIP();
@@ -562,6 +736,9 @@ void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::Ba
 		client->snapclient.name = helloMsg.getClientName();
 		client->snapclient.protocolVersion = helloMsg.getProtocolVersion();
 		client->config.instance = helloMsg.getInstance();
+		/// The codec requested by the client, overrides the configured one
+		if (!helloMsg.getCodec().empty())
+			client->config.codec = helloMsg.getCodec();
 		client->connected = true;
 		chronos::systemtimeofday(&client->lastSeen);
 
@@ -574,26 +751,20 @@ void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::Ba
 		}
 		LOG(DEBUG) << "Group: " << group->id << ", stream: " << group->streamId << "\n";
 
-		Config::instance().save();
+		saveConfig();
 
 		streamSession->sendAsync(stream->getMeta());
-		streamSession->setPcmStream(stream);
-		auto headerChunk = stream->getHeader();
-		streamSession->sendAsync(headerChunk);
+		setPcmStream(session, stream);
 
 		if (newGroup)
 		{
 			/// Notification: {"jsonrpc":"2.0","method":"Server.OnUpdate","params":{"server":{"groups":[{"clients":[{"config":{"instance":2,"latency":6,"name":"123 456","volume":{"muted":false,"percent":48}},"connected":true,"host":{"arch":"x86_64","ip":"127.0.0.1","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc#2","lastSeen":{"sec":1488025796,"usec":714671},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}}],"id":"4dcc4e3b-c699-a04b-7f0c-8260d23c43e1","muted":false,"name":"","stream_id":"stream 2"},{"clients":[{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":100}},"connected":true,"host":{"arch":"x86_64","ip":"127.0.0.1","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025798,"usec":728305},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}}],"id":"c5da8f7a-f377-1e51-8266-c5cc61099b71","muted":false,"name":"","stream_id":"stream 1"}],"server":{"host":{"arch":"x86_64","ip":"","mac":"","name":"T400","os":"Linux Mint 17.3 Rosa"},"snapserver":{"controlProtocolVersion":1,"name":"Snapserver","protocolVersion":1,"version":"0.10.0"}},"streams":[{"id":"stream 1","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 1","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 1","scheme":"pipe"}},{"id":"stream 2","status":"idle","uri":{"fragment":"","host":"","path":"/tmp/snapfifo","query":{"buffer_ms":"20","codec":"flac","name":"stream 2","sampleformat":"48000:16:2"},"raw":"pipe:///tmp/snapfifo?name=stream 2","scheme":"pipe"}}]}}}
-			json server = Config::instance().getServerStatus(streamManager_->toJson());
-			json notification = jsonrpcpp::Notification("Server.OnUpdate", jsonrpcpp::Parameter("server", server)).to_json();
-			controlServer_->send(notification.dump());
-			////cout << "Notification: " << notification.dump() << "\n";
+			sendServerUpdate(nullptr);
 		}
 		else
 		{
 			/// Notification: {"jsonrpc":"2.0","method":"Client.OnConnect","params":{"client":{"config":{"instance":1,"latency":0,"name":"","volume":{"muted":false,"percent":81}},"connected":true,"host":{"arch":"x86_64","ip":"192.168.0.54","mac":"00:21:6a:7d:74:fc","name":"T400","os":"Linux Mint 17.3 Rosa"},"id":"00:21:6a:7d:74:fc","lastSeen":{"sec":1488025524,"usec":876332},"snapclient":{"name":"Snapclient","protocolVersion":2,"version":"0.10.0"}},"id":"00:21:6a:7d:74:fc"}}
-			json notification = jsonrpcpp::Notification("Client.OnConnect", jsonrpcpp::Parameter("id", client->id, "client", client->toJson())).to_json();
-			controlServer_->send(notification.dump());
+			sendNotification(jsonrpcpp::Notification("Client.OnConnect", jsonrpcpp::Parameter("id", client->id, "client", client->toJson())), NULL);
 			////cout << "Notification: " << notification.dump() << "\n";
 		}
 //		cout << Config::instance().getServerStatus(streamManager_->toJson()).dump(4) << "\n";
@@ -606,11 +777,9 @@ void StreamServer::onMessageReceived(StreamSession* streamSession, const msg::Ba
 session_ptr StreamServer::getStreamSession(StreamSession* streamSession) const
 {
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
-	for (auto session: sessions_)
-	{
-		if (session.get() == streamSession)
-			return session;
-	}
+	auto iter = sessions_.find(streamSession->shared_from_this());
+	if (iter != sessions_.end())
+		return *iter;
 	return nullptr;
 }
 
@@ -619,12 +788,229 @@ session_ptr StreamServer::getStreamSession(const std::string& clientId) const
 {
 //	LOG(INFO) << "getStreamSession: " << mac << "\n";
 	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
-	for (auto session: sessions_)
+	auto iter = clientSessions_.find(clientId);
+	if (iter != clientSessions_.end())
+		return iter->second;
+	return nullptr;
+}
+
+
+void StreamServer::setPcmStream(const session_ptr& session, const PcmStreamPtr& stream)
+{
+	size_t rendition = 0;
+	if (stream)
+		rendition = getRendition(session->clientId, stream);
+	setPcmStream(session, stream, rendition);
+}
+
+
+void StreamServer::setPcmStream(const session_ptr& session, const PcmStreamPtr& stream, size_t rendition)
+{
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	if ((session->pcmStream() == stream) && (session->rendition() == rendition))
+		return;
+	if (session->pcmStream())
 	{
-		if (session->clientId == clientId)
-			return session;
+		streamSessions_[session->pcmStream().get()].erase(session);
+		session->pcmStream()->removeUser(session->rendition());
+	}
+	session->setPcmStream(stream);
+	session->setRendition(rendition);
+	/// don't index sessions that are already disconnected
+	if (!stream || (sessions_.find(session) == sessions_.end()))
+	{
+		session->setPcmStream(nullptr);
+		return;
+	}
+
+	streamSessions_[stream.get()].insert(session);
+	stream->addUser(rendition);
+	session->sendAsync(stream->getHeader(rendition));
+
+	/// Burst the recent chunks, so that the client can start playing immediately.
+	/// Live chunks are sent under the same lock, so they will follow without gap
+	auto history = chunkHistory_.find(stream.get());
+	if ((history == chunkHistory_.end()) || (history->second.size() <= rendition) || (!settings_.sendAudioToMutedClients && session->muted()))
+		return;
+
+	/// leave some time to transmit and decode the chunks
+	const size_t marginMs = 50;
+	auto chunks = history->second[rendition].getPlayable(settings_.bufferMs, marginMs);
+	for (const auto& chunk: chunks)
+		session->sendAsync(chunk);
+	LOG(DEBUG) << "Sent " << chunks.size() << " chunks from the history of stream " << stream->getId() << " (" << stream->getCodec(rendition) << ") to " << session->clientId << "\n";
+}
+
+
+size_t StreamServer::getRendition(const std::string& clientId, const PcmStreamPtr& stream) const
+{
+	ClientInfoPtr client = Config::instance().getClientInfo(clientId);
+	if (!client || client->config.codec.empty())
+		return 0;
+
+	int rendition = stream->getRendition(client->config.codec);
+	if (rendition < 0)
+	{
+		LOG(INFO) << "Stream " << stream->getId() << " has no codec " << client->config.codec << ", using " << stream->getCodec(0) << " for " << clientId << "\n";
+		return 0;
+	}
+	return rendition;
+}
+
+
+void StreamServer::updateMuted(const std::string& clientId)
+{
+	bool muted(false);
+	GroupPtr group = Config::instance().getGroupFromClient(clientId);
+	ClientInfoPtr client = Config::instance().getClientInfo(clientId);
+	if (group && client)
+		muted = client->config.volume.muted || group->muted;
+
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	auto range = clientSessions_.equal_range(clientId);
+	for (auto iter = range.first; iter != range.second; ++iter)
+		iter->second->setMuted(muted);
+}
+
+
+void StreamServer::sendNotification(const jsonrpcpp::Notification& notification, const ControlSession* excludeSession)
+{
+	string method = notification.method();
+	if (method == "Server.OnUpdate")
+	{
+		sendServerUpdate(excludeSession);
+		return;
+	}
+
+	/// Objects the notification is about, matched against the ids the control clients subscribed to
+	vector<string> objects;
+	if ((method.find("Client.") == 0) || (method.find("Group.") == 0) || (method.find("Stream.") == 0))
+	{
+		objects.push_back(notification.params().get<string>("id"));
+		/// clients are also addressed by their group
+		if (method.find("Client.") == 0)
+		{
+			GroupPtr group = Config::instance().getGroupFromClient(objects.front());
+			if (group)
+				objects.push_back(group->id);
+		}
+	}
+	serverStatusPending_ = true;
+	controlServer_->send(method, objects, notification.to_json().dump(), excludeSession);
+}
+
+
+void StreamServer::onNotificationBatch()
+{
+	/// Called within the ControlServer's strand, the Server.OnDelta goes out with the next batch
+	if (serverStatusPending_.exchange(false))
+		strand_.post([this]()
+		{
+			commitServerStatus();
+		});
+}
+
+
+void StreamServer::sendServerUpdate(const ControlSession* excludeSession)
+{
+	/// Notification: {"jsonrpc":"2.0","method":"Server.OnUpdate","params":{"revision":13,"server":{...}}}
+	/// Delta:        {"jsonrpc":"2.0","method":"Server.OnDelta","params":{"base":12,"revision":13,"patch":[{"op":"replace","path":"/groups/0/muted","value":true}]}}
+	const json& server = getServerStatus();
+	++revision_;
+	json notification = jsonrpcpp::Notification("Server.OnUpdate", jsonrpcpp::Parameter("server", server, "revision", revision_)).to_json();
+	json delta = jsonrpcpp::Notification("Server.OnDelta", jsonrpcpp::Parameter("base", revision_ - 1, "revision", revision_, "patch", json::diff(notifiedServerStatus_, server))).to_json();
+	notifiedServerStatus_ = server;
+	controlServer_->send("Server.OnUpdate", {}, notification.dump(), delta.dump(), excludeSession);
+}
+
+
+void StreamServer::commitServerStatus()
+{
+	serverStatusPending_ = false;
+	const json& server = getServerStatus();
+	if (server == notifiedServerStatus_)
+		return;
+
+	++revision_;
+	json delta = jsonrpcpp::Notification("Server.OnDelta", jsonrpcpp::Parameter("base", revision_ - 1, "revision", revision_, "patch", json::diff(notifiedServerStatus_, server))).to_json();
+	notifiedServerStatus_ = server;
+	controlServer_->send("Server.OnUpdate", {}, "", delta.dump());
+}
+
+
+json StreamServer::getMetrics() const
+{
+	json streams = json::array();
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	for (const auto& stream: streamManager_->getStreams())
+	{
+		json renditions = json::array();
+		auto history = chunkHistory_.find(stream.get());
+		for (size_t n = 0; n < stream->getRenditionCount(); ++n)
+		{
+			json rendition;
+			rendition["codec"] = stream->getCodec(n);
+			rendition["users"] = stream->getUsers(n);
+			if ((history != chunkHistory_.end()) && (n < history->second.size()))
+				rendition["history"] = history->second[n].getMetrics();
+			renditions.push_back(rendition);
+		}
+		json j;
+		j["id"] = stream->getId();
+		j["renditions"] = renditions;
+		j["pipeline"] = stream->getMetrics();
+		streams.push_back(j);
+	}
+	return streams;
+}
+
+
+const json& StreamServer::getServerStatus()
+{
+	if (serverStatusDirty_.exchange(false) || serverStatus_.is_null())
+		serverStatus_ = Config::instance().getServerStatus(streamManager_->toJson());
+	return serverStatus_;
+}
+
+
+void StreamServer::saveConfig()
+{
+	serverStatusDirty_ = true;
+	if (configSavePending_)
+		return;
+
+	configSavePending_ = true;
+	configSaveTimer_.expires_from_now(std::chrono::milliseconds(settings_.configSaveDelayMs));
+	configSaveTimer_.async_wait(strand_.wrap([this](const std::error_code& ec)
+	{
+		configSavePending_ = false;
+		if (ec)
+			return;
+		Config::instance().save();
+	}));
+}
+
+
+void StreamServer::removeFromIndex(const session_ptr& session)
+{
+	std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+	auto range = clientSessions_.equal_range(session->clientId);
+	for (auto iter = range.first; iter != range.second; )
+	{
+		if (iter->second == session)
+			iter = clientSessions_.erase(iter);
+		else
+			++iter;
+	}
+
+	if (session->pcmStream())
+	{
+		auto iter = streamSessions_.find(session->pcmStream().get());
+		if (iter != streamSessions_.end())
+			iter->second.erase(session);
+		session->pcmStream()->removeUser(session->rendition());
+		session->setPcmStream(nullptr);
 	}
-	return nullptr;
 }
 
 
@@ -647,23 +1033,22 @@ void StreamServer::handleAccept(socket_ptr socket)
 {
 	try
 	{
-		struct timeval tv;
-		tv.tv_sec  = 5;
-		tv.tv_usec = 0;
-		setsockopt(socket->native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-		setsockopt(socket->native_handle(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		/// the session's I/O is asynchronous, so SO_RCVTIMEO/SO_SNDTIMEO would not apply.
+		/// Use keep alive to detect dead peers instead
+		socket->set_option(asio::socket_base::keep_alive(true));
 
 		/// experimental: turn on tcp::no_delay
 		socket->set_option(tcp::no_delay(true));
 
 		SLOG(NOTICE) << "StreamServer::NewConnection: " << socket->remote_endpoint().address().to_string() << endl;
-		shared_ptr<StreamSession> session = make_shared<StreamSession>(this, socket);
+		shared_ptr<StreamSession> session = make_shared<StreamSession>(*io_service_, this, socket);
 
 		session->setBufferMs(settings_.bufferMs);
+		{
+			std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+			sessions_.insert(session);
+		}
 		session->start();
-
-		std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
-		sessions_.insert(session);
 	}
 	catch (const std::exception& e)
 	{
@@ -680,6 +1065,12 @@ void StreamServer::start()
 		controlServer_.reset(new ControlServer(io_service_, settings_.controlPort, this));
 		controlServer_->start();
 
+		if (settings_.timePort != 0)
+		{
+			timeServer_.reset(new TimeServer(io_service_, settings_.timePort, settings_.timeDelayMs));
+			timeServer_->start();
+		}
+
 		streamManager_.reset(new StreamManager(this, settings_.sampleFormat, settings_.codec, settings_.streamReadMs));
 //	throw SnapException("xxx");
 		for (const auto& streamUri: settings_.pcmStreams)
@@ -750,6 +1141,8 @@ void StreamServer::stop()
 			}
 		}
 		sessions_.clear();
+		clientSessions_.clear();
+		streamSessions_.clear();
 	}
 
 	if (controlServer_)
@@ -758,6 +1151,22 @@ void StreamServer::stop()
 		controlServer_ = nullptr;
 	}
 
+	if (timeServer_)
+	{
+		timeServer_->stop();
+		timeServer_ = nullptr;
+	}
+
+	/// the io_service is stopped, a pending delayed save will not be executed anymore
+	std::error_code ec;
+	configSaveTimer_.cancel(ec);
+	if (configSavePending_)
+	{
+		Config::instance().save();
+		configSavePending_ = false;
+	}
+	Config::instance().flush();
+
 	if (acceptor_v4_)
 	{
 		acceptor_v4_->cancel();
@@ -26,9 +26,12 @@
 #include <set>
 #include <sstream>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #include "jsonrpcpp.hpp"
 #include "streamSession.h"
+#include "chunkHistory.h"
 #include "streamreader/streamManager.h"
 #include "common/queue.h"
 #include "common/sampleFormat.h"
@@ -36,6 +39,7 @@
 #include "message/codecHeader.h"
 #include "message/serverSettings.h"
 #include "controlServer.h"
+#include "timeServer.h"
 
 
 using asio::ip::tcp;
@@ -47,21 +51,32 @@ struct StreamServerSettings
 	StreamServerSettings() :
 		port(1704),
 		controlPort(1705),
+		timePort(1706),
+		timeDelayMs(0),
 		codec("flac"),
 		bufferMs(1000),
 		sampleFormat("48000:16:2"),
 		streamReadMs(20),
-		sendAudioToMutedClients(false)
+		sendAudioToMutedClients(false),
+		codecFallback(false),
+		configSaveDelayMs(1000)
 	{
 	}
 	size_t port;
 	size_t controlPort;
+	/// UDP time sync port, 0 = disabled
+	size_t timePort;
+	/// Random delay of the UDP time sync replies, for testing
+	size_t timeDelayMs;
 	std::vector<std::string> pcmStreams;
 	std::string codec;
 	int32_t bufferMs;
 	std::string sampleFormat;
 	size_t streamReadMs;
 	bool sendAudioToMutedClients;
+	/// Switch congested sessions to the stream's next rendition (codec)
+	bool codecFallback;
+	size_t configSaveDelayMs;
 };
 
 
@@ -90,28 +105,75 @@ public:
 
 	/// Implementation of ControllMessageReceiver::onMessageReceived, called by ControlServer::onMessageReceived
 	virtual void onMessageReceived(ControlSession* connection, const std::string& message);
+	/// Implementation of ControlMessageReceiver::onNotificationBatch: commits the server status once per batch
+	virtual void onNotificationBatch();
 
 	/// Implementation of PcmListener
 	virtual void onMetaChanged(const PcmStream* pcmStream);
 	virtual void onStateChanged(const PcmStream* pcmStream, const ReaderState& state);
-	virtual void onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration);
+	virtual void onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration, size_t rendition);
 	virtual void onResync(const PcmStream* pcmStream, double ms);
+	virtual void onHeaderChanged(const PcmStream* pcmStream, size_t rendition);
 
 private:
 	void startAccept();
 	void handleAccept(socket_ptr socket);
 	session_ptr getStreamSession(const std::string& mac) const;
 	session_ptr getStreamSession(StreamSession* session) const;
-	void ProcessRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::entity_ptr& response, jsonrpcpp::notification_ptr& notification) const;
+	/// Assigns the stream with the client's rendition to the session. Only call within strand_
+	void setPcmStream(const session_ptr& session, const PcmStreamPtr& stream);
+	/// Assigns the stream to the session and updates the stream => sessions index
+	/// The rendition's codec header and the still playable chunks from its history are sent to the session
+	void setPcmStream(const session_ptr& session, const PcmStreamPtr& stream, size_t rendition);
+	/// Rendition of the codec configured for the client, the stream's default rendition if it has no such codec
+	size_t getRendition(const std::string& clientId, const PcmStreamPtr& stream) const;
+	/// Refreshes the cached mute state of the client's sessions from the config
+	void updateMuted(const std::string& clientId);
+	void removeFromIndex(const session_ptr& session);
+	/// Saves the config after configSaveDelayMs, changes in the meantime are coalesced
+	void saveConfig();
+	void ProcessRequest(ControlSession* controlSession, const jsonrpcpp::request_ptr request, jsonrpcpp::entity_ptr& response, jsonrpcpp::notification_ptr& notification);
+	/// Client.* notifications must be sent within strand_, as the client's group is looked up in the config
+	void sendNotification(const jsonrpcpp::Notification& notification, const ControlSession* excludeSession);
+	/// Sends Server.OnUpdate, resp. Server.OnDelta to clients that requested delta updates
+	void sendServerUpdate(const ControlSession* excludeSession);
+	/// Assigns a new revision to the server status, if it has changed since the last notification,
+	/// and sends the Server.OnDelta to clients that requested delta updates. Only call within strand_
+	void commitServerStatus();
+	/// Cached server status, only rebuilt if something has changed. Only call within strand_
+	const nlohmann::json& getServerStatus();
+	/// Per stream metrics, e.g. of the chunk history and the read/encode pipeline
+	nlohmann::json getMetrics() const;
+	void processMessage(ControlSession* controlSession, const std::string& message);
+	void processMessage(StreamSession* streamSession, const msg::BaseMessage& baseMessage, char* buffer);
 	mutable std::recursive_mutex sessionsMutex_;
 	std::set<session_ptr> sessions_;
+	/// Lookup tables for sessions, guarded by sessionsMutex_. Client id => sessions, stream => sessions
+	std::unordered_multimap<std::string, session_ptr> clientSessions_;
+	std::unordered_map<const PcmStream*, std::set<session_ptr>> streamSessions_;
+	/// Recent chunks per stream and rendition, sent to newly attached sessions. Guarded by sessionsMutex_
+	std::unordered_map<const PcmStream*, std::vector<ChunkHistory>> chunkHistory_;
 	asio::io_service* io_service_;
+	/// Serializes the processing of client and control messages
+	asio::io_service::strand strand_;
+	/// Delayed saving of the config, only accessed within strand_
+	asio::steady_timer configSaveTimer_;
+	bool configSavePending_;
+	/// Cached server status. Invalidated by config and stream changes, but not by "lastSeen" updates
+	nlohmann::json serverStatus_;
+	std::atomic<bool> serverStatusDirty_;
+	/// A notification was sent, the server status is committed with the next notification batch
+	std::atomic<bool> serverStatusPending_;
+	/// Revision of the server status, incremented with every change that is notified. Base for the delta updates
+	nlohmann::json notifiedServerStatus_;
+	uint64_t revision_;
 	std::shared_ptr<tcp::acceptor> acceptor_v4_;
 	std::shared_ptr<tcp::acceptor> acceptor_v6_;
 
 	StreamServerSettings settings_;
 	Queue<std::shared_ptr<msg::BaseMessage>> messages_;
 	std::unique_ptr<ControlServer> controlServer_;
+	std::unique_ptr<TimeServer> timeServer_;
 	std::unique_ptr<StreamManager> streamManager_;
 };
 
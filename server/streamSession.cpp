@@ -19,7 +19,6 @@
 #include "streamSession.h"
 
 #include <iostream>
-#include <mutex>
 #include "aixlog.hpp"
 #include "message/pcmChunk.h"
 
@@ -27,16 +26,16 @@ using namespace std;
 
 
 
-StreamSession::StreamSession(MessageReceiver* receiver, std::shared_ptr<tcp::socket> socket) :
-	active_(false), readerThread_(nullptr), writerThread_(nullptr), messageReceiver_(receiver), pcmStream_(nullptr)
+StreamSession::StreamSession(asio::io_service& ioService, MessageReceiver* receiver, std::shared_ptr<tcp::socket> socket) :
+	active_(false), strand_(ioService), socket_(socket), messageReceiver_(receiver), writing_(nullptr), bufferMs_(0), pcmStream_(nullptr), rendition_(0), droppedChunks_(0), muted_(false), protocolVersion_(1)
 {
-	socket_ = socket;
+	buffer_.resize(msg::BaseMessage::header_v2_size);
 }
 
 
 StreamSession::~StreamSession()
 {
-	stop();
+	LOG(DEBUG) << "StreamSession destroyed\n";
 }
 
 
@@ -52,69 +51,87 @@ const PcmStreamPtr StreamSession::pcmStream() const
 }
 
 
+void StreamSession::setRendition(size_t rendition)
+{
+	rendition_ = rendition;
+}
+
+
+size_t StreamSession::rendition() const
+{
+	return rendition_;
+}
+
+
+size_t StreamSession::resetDroppedChunks()
+{
+	return droppedChunks_.exchange(0);
+}
+
+
+void StreamSession::setMuted(bool muted)
+{
+	muted_ = muted;
+}
+
+
+bool StreamSession::muted() const
+{
+	return muted_;
+}
+
+
+void StreamSession::setProtocolVersion(uint16_t version)
+{
+	protocolVersion_ = version;
+}
+
+
+uint16_t StreamSession::protocolVersion() const
+{
+	return protocolVersion_;
+}
+
+
 void StreamSession::start()
 {
-	{
-		std::lock_guard<std::mutex> activeLock(activeMutex_);
-		active_ = true;
-	}
-	readerThread_.reset(new thread(&StreamSession::reader, this));
-	writerThread_.reset(new thread(&StreamSession::writer, this));
+	active_ = true;
+	auto self(shared_from_this());
+	strand_.post([this, self]() { readHeader(); });
 }
 
 
 void StreamSession::stop()
 {
-	{
-		std::lock_guard<std::mutex> activeLock(activeMutex_);
-		if (!active_)
-			return;
-
-		active_ = false;
-	}
+	if (!active_.exchange(false))
+		return;
 
-	try
+	/// Closing the socket will cancel the pending operations.
+	/// The handlers keep the session alive until they are finished.
+	auto self(shared_from_this());
+	strand_.post([this, self]()
 	{
 		std::error_code ec;
-		if (socket_)
-		{
-			std::lock_guard<std::mutex> socketLock(socketMutex_);
-			socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-			if (ec) LOG(ERROR) << "Error in socket shutdown: " << ec.message() << "\n";
-			socket_->close(ec);
-			if (ec) LOG(ERROR) << "Error in socket close: " << ec.message() << "\n";
-		}
-		if (readerThread_ && readerThread_->joinable())
-		{
-			LOG(DEBUG) << "StreamSession joining readerThread\n";
-			readerThread_->join();
-		}
-		if (writerThread_ && writerThread_->joinable())
-		{
-			LOG(DEBUG) << "StreamSession joining writerThread\n";
-			messages_.abort_wait();
-			writerThread_->join();
-		}
-	}
-	catch(...)
-	{
-	}
-
-	readerThread_ = nullptr;
-	writerThread_ = nullptr;
-	socket_ = nullptr;
-	LOG(DEBUG) << "StreamSession stopped\n";
+		socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+		if (ec) LOG(ERROR) << "Error in socket shutdown: " << ec.message() << "\n";
+		socket_->close(ec);
+		if (ec) LOG(ERROR) << "Error in socket close: " << ec.message() << "\n";
+		messages_.clear();
+		LOG(DEBUG) << "StreamSession stopped\n";
+	});
 }
 
 
-void StreamSession::socketRead(void* _to, size_t _bytes)
+void StreamSession::disconnect(const std::string& reason)
 {
-	size_t read = 0;
-	do
-	{
-		read += socket_->read_some(asio::buffer((char*)_to + read, _bytes - read));
-	}
-	while (active_ && (read < _bytes));
+	if (!active_)
+		return;
+
+	SLOG(ERROR) << "StreamSession " << clientId << " disconnected: " << reason << endl;
+	if (messageReceiver_ != NULL)
+		messageReceiver_->onDisconnect(this);
+	/// In case the receiver didn't stop us
+	stop();
 }
 
 
@@ -123,14 +140,33 @@ void StreamSession::sendAsync(const msg::message_ptr& message, bool sendNow)
 	if (!message)
 		return;
 
-	//the writer will take care about old messages
-	while (messages_.size() > 2000)// chunk->getDuration() > 10000)
-		messages_.pop();
+	sendAsync(make_shared<SharedMessage>(message), sendNow);
+}
+
+
+void StreamSession::sendAsync(const SharedMessagePtr& message, bool sendNow)
+{
+	if (!message || !active_)
+		return;
+
+	auto self(shared_from_this());
+	strand_.post([this, self, message, sendNow]()
+	{
+		//the writer will take care about old messages
+		while (messages_.size() > 2000)// chunk->getDuration() > 10000)
+		{
+			messages_.pop_front();
+			++droppedChunks_;
+		}
 
-	if (sendNow)
-		messages_.push_front(message);
-	else	
-		messages_.push(message);
+		if (sendNow)
+			messages_.push_front(message);
+		else
+			messages_.push_back(message);
+
+		if (!writing_)
+			writeNext();
+	});
 }
 
 
@@ -146,118 +182,139 @@ void StreamSession::setBufferMs(size_t bufferMs)
 }
 
 
-bool StreamSession::send(const msg::message_ptr& message) const
+void StreamSession::writeNext()
 {
-	//TODO on exception: set active = false
-//	LOG(INFO) << "send: " << message->type << ", size: " << message->getSize() << ", id: " << message->id << ", refers: " << message->refersTo << "\n";
-	std::lock_guard<std::mutex> socketLock(socketMutex_);
+	while (active_ && !messages_.empty())
 	{
-		std::lock_guard<std::mutex> activeLock(activeMutex_);
-		if (!socket_ || !active_)
-			return false;
+		SharedMessagePtr message = messages_.front();
+		messages_.pop_front();
+
+		if (bufferMs_ > 0)
+		{
+			const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(message->message().get());
+			if (wireChunk != NULL)
+			{
+				chronos::time_point_clk now = chronos::clk::now();
+				size_t age = 0;
+				if (now > wireChunk->start())
+					age = std::chrono::duration_cast<chronos::msec>(now - wireChunk->start()).count();
+				//LOG(DEBUG) << "PCM chunk. Age: " << age << ", buffer: " << bufferMs_ << ", age > buffer: " << (age > bufferMs_) << "\n";
+				if (age > bufferMs_)
+				{
+					++droppedChunks_;
+					continue;
+				}
+			}
+		}
+
+		/// the payload is shared with other sessions, only the header with our "sent" time is private
+		writing_ = message;
+		auto self(shared_from_this());
+		asio::async_write(*socket_, writing_->buffers(header_, protocolVersion_), strand_.wrap(
+			[this, self](const std::error_code& ec, std::size_t length)
+			{
+				writing_ = nullptr;
+				if (ec)
+				{
+					disconnect("error while writing: " + ec.message());
+					return;
+				}
+				writeNext();
+			}));
+		return;
 	}
-	asio::streambuf streambuf;
-	std::ostream stream(&streambuf);
-	tv t;
-	message->sent = t;
-	message->serialize(stream);
-	asio::write(*socket_.get(), streambuf);
-//	LOG(INFO) << "done: " << message->type << ", size: " << message->size << ", id: " << message->id << ", refers: " << message->refersTo << "\n";
-	return true;
 }
 
 
-void StreamSession::getNextMessage()
+void StreamSession::readHeader()
 {
-	msg::BaseMessage baseMessage;
-	size_t baseMsgSize = baseMessage.getSize();
-	vector<char> buffer(baseMsgSize);
-	socketRead(&buffer[0], baseMsgSize);
-	baseMessage.deserialize(&buffer[0]);
+	if (!active_)
+		return;
 
-	if ((baseMessage.type > message_type::kLast) || (baseMessage.type < message_type::kFirst))
-	{
-		stringstream ss;
-		ss << "unknown message type received: " << baseMessage.type << ", size: " << baseMessage.size;
-		throw std::runtime_error(ss.str().c_str());
-	}
-	else if (baseMessage.size > msg::max_size)
-	{
-		stringstream ss;
-		ss << "received message of type " << baseMessage.type << " to large: " << baseMessage.size;
-		throw std::runtime_error(ss.str().c_str());
-	}
-	
-//	LOG(INFO) << "getNextMessage: " << baseMessage.type << ", size: " << baseMessage.size << ", id: " << baseMessage.id << ", refers: " << baseMessage.refersTo << "\n";
-	if (baseMessage.size > buffer.size())
-		buffer.resize(baseMessage.size);
-//	{
-//		std::lock_guard<std::mutex> socketLock(socketMutex_);
-	socketRead(&buffer[0], baseMessage.size);
-//	}	
-	tv t;
-	baseMessage.received = t;
-
-	if (active_ && (messageReceiver_ != NULL))
-		messageReceiver_->onMessageReceived(this, baseMessage, &buffer[0]);
+	auto self(shared_from_this());
+	asio::async_read(*socket_, asio::buffer(buffer_.data(), msg::BaseMessage::header_size), strand_.wrap(
+		[this, self](const std::error_code& ec, std::size_t length)
+		{
+			if (ec)
+			{
+				disconnect("error while reading message header: " + ec.message());
+				return;
+			}
+
+			if (msg::BaseMessage::isV2Header(buffer_.data()))
+				readHeaderV2();
+			else
+				onHeader();
+		}));
 }
 
 
-void StreamSession::reader()
+void StreamSession::readHeaderV2()
 {
-	try
-	{
-		while (active_)
+	auto self(shared_from_this());
+	size_t headerSize = msg::BaseMessage::header_size;
+	asio::async_read(*socket_, asio::buffer(buffer_.data() + headerSize, msg::BaseMessage::header_v2_size - headerSize), strand_.wrap(
+		[this, self](const std::error_code& ec, std::size_t length)
 		{
-			getNextMessage();
-		}
+			if (ec)
+			{
+				disconnect("error while reading message header: " + ec.message());
+				return;
+			}
+			onHeader();
+		}));
+}
+
+
+void StreamSession::onHeader()
+{
+	baseMessage_.deserialize(buffer_.data());
+	if ((baseMessage_.type > message_type::kLast) || (baseMessage_.type < message_type::kFirst))
+	{
+		stringstream ss;
+		ss << "unknown message type received: " << baseMessage_.type << ", size: " << baseMessage_.size;
+		disconnect(ss.str());
+		return;
 	}
-	catch (const std::exception& e)
+	else if (baseMessage_.size > msg::max_size)
 	{
-		SLOG(ERROR) << "Exception in StreamSession::reader(): " << e.what() << endl;
+		stringstream ss;
+		ss << "received message of type " << baseMessage_.type << " to large: " << baseMessage_.size;
+		disconnect(ss.str());
+		return;
 	}
 
-	if (active_ && (messageReceiver_ != NULL))
-		messageReceiver_->onDisconnect(this);
+	if (baseMessage_.size > buffer_.size())
+		buffer_.resize(baseMessage_.size);
+	readPayload();
 }
 
 
-void StreamSession::writer()
+void StreamSession::readPayload()
 {
-	try
-	{
-		asio::streambuf streambuf;
-		std::ostream stream(&streambuf);
-		shared_ptr<msg::BaseMessage> message;
-		while (active_)
+	auto self(shared_from_this());
+	asio::async_read(*socket_, asio::buffer(buffer_.data(), baseMessage_.size), strand_.wrap(
+		[this, self](const std::error_code& ec, std::size_t length)
 		{
-			if (messages_.try_pop(message, std::chrono::milliseconds(500)))
+			if (ec)
 			{
-				if (bufferMs_ > 0)
-				{
-					const msg::WireChunk* wireChunk = dynamic_cast<const msg::WireChunk*>(message.get());
-					if (wireChunk != NULL)
-					{
-						chronos::time_point_clk now = chronos::clk::now();
-						size_t age = 0;
-						if (now > wireChunk->start())
-							age = std::chrono::duration_cast<chronos::msec>(now - wireChunk->start()).count();
-						//LOG(DEBUG) << "PCM chunk. Age: " << age << ", buffer: " << bufferMs_ << ", age > buffer: " << (age > bufferMs_) << "\n";
-						if (age > bufferMs_)
-							continue;
-					}
-				}
-				send(message);
+				disconnect("error while reading message payload: " + ec.message());
+				return;
 			}
-		}
-	}
-	catch (const std::exception& e)
-	{
-		SLOG(ERROR) << "Exception in StreamSession::writer(): " << e.what() << endl;
-	}
 
-	if (active_ && (messageReceiver_ != NULL))
-		messageReceiver_->onDisconnect(this);
+//			LOG(INFO) << "getNextMessage: " << baseMessage_.type << ", size: " << baseMessage_.size << ", id: " << baseMessage_.id << ", refers: " << baseMessage_.refersTo << "\n";
+			tv t;
+			baseMessage_.received = t;
+			try
+			{
+				if (active_ && (messageReceiver_ != NULL))
+					messageReceiver_->onMessageReceived(this, baseMessage_, buffer_.data());
+			}
+			catch (const std::exception& e)
+			{
+				disconnect(string("exception while processing message: ") + e.what());
+				return;
+			}
+			readHeader();
+		}));
 }
-
-
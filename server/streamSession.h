@@ -20,15 +20,13 @@
 #define STREAM_SESSION_H
 
 #include <string>
-#include <thread>
+#include <deque>
 #include <atomic>
 #include <memory>
 #include <asio.hpp>
-#include <condition_variable>
-#include <set>
-#include <mutex>
+#include <vector>
 #include "message/message.h"
-#include "common/queue.h"
+#include "sharedMessage.h"
 #include "streamreader/streamManager.h"
 
 
@@ -50,23 +48,24 @@ public:
 /// Endpoint for a connected client.
 /**
  * Endpoint for a connected client.
- * Messages are sent to the client with the "send" method.
+ * Messages are sent to the client with the "sendAsync" method.
  * Received messages from the client are passed to the MessageReceiver callback
+ * All socket I/O is asynchronous and serialized on a per-session strand, so
+ * there are no dedicated reader or writer threads.
  */
-class StreamSession
+class StreamSession : public std::enable_shared_from_this<StreamSession>
 {
 public:
 	/// ctor. Received message from the client are passed to MessageReceiver
-	StreamSession(MessageReceiver* receiver, std::shared_ptr<tcp::socket> socket);
+	StreamSession(asio::io_service& ioService, MessageReceiver* receiver, std::shared_ptr<tcp::socket> socket);
 	~StreamSession();
 	void start();
 	void stop();
 
-	/// Sends a message to the client (synchronous)
-	bool send(const msg::message_ptr& message) const;
-
 	/// Sends a message to the client (asynchronous)
 	void sendAsync(const msg::message_ptr& message, bool sendNow = false);
+	/// Sends an already serialized message to the client (asynchronous)
+	void sendAsync(const SharedMessagePtr& message, bool sendNow = false);
 
 	bool active() const;
 
@@ -83,23 +82,48 @@ public:
 	void setPcmStream(PcmStreamPtr pcmStream);
 	const PcmStreamPtr pcmStream() const;
 
+	/// Rendition (codec) of the PcmStream that is sent to the client
+	void setRendition(size_t rendition);
+	size_t rendition() const;
+
+	/// Number of chunks that were dropped since the last call, because they were too old or the queue was full
+	size_t resetDroppedChunks();
+
+	/// Cached effective mute state (client or group muted)
+	void setMuted(bool muted);
+	bool muted() const;
+
+	/// Protocol version used to send messages, negotiated with Hello/ServerSettings. Received messages can have either version
+	void setProtocolVersion(uint16_t version);
+	uint16_t protocolVersion() const;
+
 protected:
-	void socketRead(void* _to, size_t _bytes);
-	void getNextMessage();
-	void reader();
-	void writer();
+	void readHeader();
+	/// Reads the rest of a version 2 header
+	void readHeaderV2();
+	void onHeader();
+	void readPayload();
+	void writeNext();
+	void disconnect(const std::string& reason);
 
-	mutable std::mutex activeMutex_;
 	std::atomic<bool> active_;
 
-	std::unique_ptr<std::thread> readerThread_;
-	std::unique_ptr<std::thread> writerThread_;
-	mutable std::mutex socketMutex_;
+	asio::io_service::strand strand_;
 	std::shared_ptr<tcp::socket> socket_;
 	MessageReceiver* messageReceiver_;
-	Queue<std::shared_ptr<msg::BaseMessage>> messages_;
+	msg::BaseMessage baseMessage_;
+	std::vector<char> buffer_;
+	/// Pending messages, only accessed within strand_
+	std::deque<SharedMessagePtr> messages_;
+	/// Message that is currently written, only accessed within strand_
+	SharedMessagePtr writing_;
+	SharedMessage::Header header_;
 	size_t bufferMs_;
 	PcmStreamPtr pcmStream_;
+	std::atomic<size_t> rendition_;
+	std::atomic<size_t> droppedChunks_;
+	std::atomic<bool> muted_;
+	std::atomic<uint16_t> protocolVersion_;
 };
 
 
@@ -62,7 +62,7 @@ void FileStream::worker()
 	while (active_)
 	{
 		chronos::systemtimeofday(&tvChunk);
-		tvEncodedChunk_ = tvChunk;
+		restartEncodedTimestamps();
 		long nextTick = chronos::getTickCount();
 		try
 		{
@@ -83,7 +83,7 @@ void FileStream::worker()
 				}
 				ifs.read(chunk->payload + count, toRead - count);
 
-				encoder_->encode(chunk.get());
+				enqueue(chunk);
 				if (!active_) break;
 				nextTick += pcmReadMs_;
 				chronos::addUs(tvChunk, pcmReadMs_ * 1000);
@@ -98,8 +98,8 @@ void FileStream::worker()
 				else
 				{
 					chronos::systemtimeofday(&tvChunk);
-					tvEncodedChunk_ = tvChunk;
-					pcmListener_->onResync(this, currentTick - nextTick);
+					restartEncodedTimestamps();
+					resync(currentTick - nextTick);
 					nextTick = currentTick;
 				}
 			}
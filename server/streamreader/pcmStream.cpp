@@ -23,6 +23,7 @@
 #include "encoder/encoderFactory.h"
 #include "common/snapException.h"
 #include "common/strCompat.h"
+#include "common/utils/string_utils.h"
 #include "pcmStream.h"
 #include "aixlog.hpp"
 
@@ -32,12 +33,20 @@ using namespace std;
 
 
 PcmStream::PcmStream(PcmListener* pcmListener, const StreamUri& uri) : 
-	active_(false), pcmListener_(pcmListener), uri_(uri), pcmReadMs_(20), state_(kIdle)
+	active_(false), readChunks_(64), freeChunks_(128), restartTimestamps_(false), stalls_(0), overruns_(0),
+	pcmListener_(pcmListener), uri_(uri), pcmReadMs_(20), state_(kIdle)
 {
 	EncoderFactory encoderFactory;
  	if (uri_.query.find("codec") == uri_.query.end())
 		throw SnapException("Stream URI must have a codec");
-	encoder_.reset(encoderFactory.createEncoder(uri_.query["codec"]));
+	for (const auto& codec: utils::string::split(uri_.query["codec"], ','))
+	{
+		string trimmed = utils::string::trim_copy(codec);
+		if (!trimmed.empty())
+			renditions_.emplace_back(new Rendition(encoderFactory.createEncoder(trimmed)));
+	}
+	if (renditions_.empty())
+		throw SnapException("Stream URI must have a codec");
 
 	if (uri_.query.find("name") == uri_.query.end())
 		throw SnapException("Stream URI must have a name");
@@ -65,12 +74,60 @@ PcmStream::PcmStream(PcmListener* pcmListener, const StreamUri& uri) :
 PcmStream::~PcmStream()
 {
 	stop();
+	ReadChunk readChunk;
+	while (readChunks_.pop(readChunk))
+		delete readChunk.chunk;
+	msg::PcmChunk* chunk;
+	while (freeChunks_.pop(chunk))
+		delete chunk;
+}
+
+
+std::shared_ptr<msg::CodecHeader> PcmStream::getHeader(size_t rendition) const
+{
+	std::lock_guard<std::mutex> lock(headerMutex_);
+	return renditions_.at(rendition)->encoder->getHeader();
+}
+
+
+size_t PcmStream::getRenditionCount() const
+{
+	return renditions_.size();
+}
+
+
+int PcmStream::getRendition(const std::string& codec) const
+{
+	for (size_t n = 0; n < renditions_.size(); ++n)
+	{
+		if (renditions_[n]->encoder->name() == codec)
+			return n;
+	}
+	return -1;
 }
 
 
-std::shared_ptr<msg::CodecHeader> PcmStream::getHeader()
+std::string PcmStream::getCodec(size_t rendition) const
 {
-	return encoder_->getHeader();
+	return renditions_.at(rendition)->encoder->name();
+}
+
+
+void PcmStream::addUser(size_t rendition)
+{
+	++renditions_.at(rendition)->users;
+}
+
+
+void PcmStream::removeUser(size_t rendition)
+{
+	--renditions_.at(rendition)->users;
+}
+
+
+size_t PcmStream::getUsers(size_t rendition) const
+{
+	return renditions_.at(rendition)->users;
 }
 
 
@@ -101,8 +158,11 @@ const SampleFormat& PcmStream::getSampleFormat() const
 void PcmStream::start()
 {
 	LOG(DEBUG) << "PcmStream start: " << sampleFormat_.getFormat() << "\n";
-	encoder_->init(this, sampleFormat_);
+	for (auto& rendition: renditions_)
+		rendition->encoder->init(this, sampleFormat_);
 	active_ = true;
+	readStart_ = chrono::steady_clock::now();
+	encodeThread_ = thread(&PcmStream::encodeWorker, this);
 	thread_ = thread(&PcmStream::worker, this);
 }
 
@@ -114,8 +174,14 @@ void PcmStream::stop()
 		
 	active_ = false;
 	cv_.notify_one();
+	{
+		std::lock_guard<std::mutex> lock(encodeMutex_);
+		encodeCv_.notify_one();
+	}
 	if (thread_.joinable())
 		thread_.join();
+	if (encodeThread_.joinable())
+		encodeThread_.join();
 }
 
 
@@ -124,7 +190,9 @@ bool PcmStream::sleep(int32_t ms)
 	if (ms < 0)
 		return true;
 	std::unique_lock<std::mutex> lck(mtx_);
-	return (!cv_.wait_for(lck, std::chrono::milliseconds(ms), [this] { return !active_; }));
+	bool result = !cv_.wait_for(lck, std::chrono::milliseconds(ms), [this] { return !active_; });
+	readStart_ = chrono::steady_clock::now();
+	return result;
 }
 
 
@@ -145,17 +213,145 @@ void PcmStream::setState(const ReaderState& newState)
 }
 
 
+void PcmStream::enqueue(std::unique_ptr<msg::PcmChunk>& chunk)
+{
+	auto now = chrono::steady_clock::now();
+	readLatency_.add(now - readStart_);
+	readStart_ = now;
+
+	ReadChunk readChunk;
+	readChunk.chunk = chunk.get();
+	readChunk.restart = restartTimestamps_;
+	readChunk.enqueued = now;
+	if (!readChunks_.push(readChunk))
+	{
+		/// The encoder doesn't keep up. Drop the chunk, the next one will restart the timestamps
+		if (overruns_++ == 0)
+			LOG(WARNING) << "Encoder of stream " << getId() << " doesn't keep up, dropping chunks\n";
+		restartTimestamps_ = true;
+		return;
+	}
+	restartTimestamps_ = false;
+
+	chunk.release();
+	msg::PcmChunk* freeChunk;
+	if (freeChunks_.pop(freeChunk))
+		chunk.reset(freeChunk);
+	else
+		chunk.reset(new msg::PcmChunk(sampleFormat_, pcmReadMs_));
+
+	/// take the lock, so that the notification can't get lost between the encoder's check and wait
+	{
+		std::lock_guard<std::mutex> lock(encodeMutex_);
+	}
+	encodeCv_.notify_one();
+}
+
+
+void PcmStream::restartEncodedTimestamps()
+{
+	restartTimestamps_ = true;
+}
+
+
+void PcmStream::resync(double ms)
+{
+	++stalls_;
+	if (pcmListener_)
+		pcmListener_->onResync(this, ms);
+}
+
+
+void PcmStream::encodeWorker()
+{
+	ReadChunk readChunk;
+	while (active_)
+	{
+		if (!readChunks_.pop(readChunk))
+		{
+			std::unique_lock<std::mutex> lock(encodeMutex_);
+			encodeCv_.wait(lock, [this] { return !active_ || !readChunks_.empty(); });
+			continue;
+		}
+
+		auto start = chrono::steady_clock::now();
+		queueLatency_.add(start - readChunk.enqueued);
+		if (readChunk.restart)
+		{
+			for (auto& rendition: renditions_)
+				rendition->encoding = false;
+		}
+		encode(readChunk.chunk);
+		encodeLatency_.add(chrono::steady_clock::now() - start);
+
+		if (!freeChunks_.push(readChunk.chunk))
+			delete readChunk.chunk;
+	}
+}
+
+
+void PcmStream::encode(const msg::PcmChunk* chunk)
+{
+	for (size_t n = 0; n < renditions_.size(); ++n)
+	{
+		Rendition& rendition = *renditions_[n];
+		if ((n != 0) && (rendition.users == 0))
+		{
+			rendition.encoding = false;
+			continue;
+		}
+
+		/// The encoded stream of a rendition that was not in use, or after a resync, restarts with this chunk.
+		/// PCM that the encoder buffered before would be encoded with the restarted timestamps
+		if (!rendition.encoding)
+		{
+			if (rendition.encoded)
+				resetEncoder(n);
+			rendition.tvEncodedChunk.tv_sec = chunk->timestamp.sec;
+			rendition.tvEncodedChunk.tv_usec = chunk->timestamp.usec;
+			rendition.encoding = true;
+		}
+		rendition.encoded = true;
+		rendition.encoder->encode(chunk);
+	}
+}
+
+
+void PcmStream::resetEncoder(size_t rendition)
+{
+	bool headerChanged;
+	{
+		std::lock_guard<std::mutex> lock(headerMutex_);
+		Encoder* encoder = renditions_[rendition]->encoder.get();
+		std::shared_ptr<msg::CodecHeader> header = encoder->getHeader();
+		encoder->reset();
+		headerChanged = (encoder->getHeader() != header);
+	}
+	renditions_[rendition]->encoded = false;
+	if (headerChanged && pcmListener_)
+		pcmListener_->onHeaderChanged(this, rendition);
+}
+
+
 void PcmStream::onChunkEncoded(const Encoder* encoder, msg::PcmChunk* chunk, double duration)
 {
 //	LOG(INFO) << "onChunkEncoded: " << duration << " us\n";
 	if (duration <= 0)
 		return;
 
-	chunk->timestamp.sec = tvEncodedChunk_.tv_sec;
-	chunk->timestamp.usec = tvEncodedChunk_.tv_usec;
-	chronos::addUs(tvEncodedChunk_, duration * 1000);
+	size_t n = 0;
+	while ((n < renditions_.size()) && (renditions_[n]->encoder.get() != encoder))
+		++n;
+	if (n == renditions_.size())
+		return;
+
+	Rendition& rendition = *renditions_[n];
+	chunk->timestamp.sec = rendition.tvEncodedChunk.tv_sec;
+	chunk->timestamp.usec = rendition.tvEncodedChunk.tv_usec;
+	chunk->sequence = ++rendition.chunkSequence;
+	chronos::addUs(rendition.tvEncodedChunk, duration * 1000);
 	if (pcmListener_)
-		pcmListener_->onChunkRead(this, chunk, duration);
+		pcmListener_->onChunkRead(this, chunk, duration, n);
 }
 
 
@@ -181,6 +377,19 @@ json PcmStream::toJson() const
 	return j;
 }
 
+json PcmStream::getMetrics() const
+{
+	json j;
+	j["read"] = readLatency_.toJson();
+	j["queue"] = queueLatency_.toJson();
+	j["encode"] = encodeLatency_.toJson();
+	j["queued"] = readChunks_.size();
+	j["stalls"] = stalls_.load();
+	j["overruns"] = overruns_.load();
+	return j;
+}
+
+
 std::shared_ptr<msg::StreamTags> PcmStream::getMeta() const
 {
 	return meta_;
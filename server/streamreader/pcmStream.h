@@ -25,9 +25,13 @@
 #include <mutex>
 #include <condition_variable>
 #include <map>
+#include <vector>
+#include <chrono>
 #include "streamUri.h"
 #include "encoder/encoder.h"
 #include "common/sampleFormat.h"
+#include "common/spscQueue.h"
+#include "common/latencyHistogram.h"
 #include "common/json.hpp"
 #include "message/codecHeader.h"
 #include "message/streamTags.h"
@@ -53,14 +57,24 @@ class PcmListener
 public:
 	virtual void onMetaChanged(const PcmStream* pcmStream) = 0;
 	virtual void onStateChanged(const PcmStream* pcmStream, const ReaderState& state) = 0;
-	virtual void onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration) = 0;
+	/// rendition: index of the encoder that produced the chunk, see PcmStream::getRenditionCount
+	virtual void onChunkRead(const PcmStream* pcmStream, msg::PcmChunk* chunk, double duration, size_t rendition) = 0;
 	virtual void onResync(const PcmStream* pcmStream, double ms) = 0;
+	/// The codec header of the rendition has changed, the following chunks need the new header
+	virtual void onHeaderChanged(const PcmStream* pcmStream, size_t rendition) = 0;
 };
 
 
 /// Reads and decodes PCM data
 /**
- * Reads PCM and passes the data to an encoder.
+ * Reads PCM and passes the data to one or more encoders ("renditions").
+ * The renditions are configured with a comma separated list in the URI's
+ * codec parameter (e.g. "codec=flac,pcm"). The first one is the default
+ * rendition and is always encoded, the others only while they are used by
+ * at least one session. When a rendition is resumed, its encoder is reset.
+ * Reading and encoding run in separate threads, connected by a lock-free
+ * queue, so that a slow encoder or a contended fan-out to the sessions
+ * doesn't delay reading from the source.
  * Implements EncoderListener to get the encoded data.
  * Data is passed to the PcmListener
  */
@@ -76,7 +90,16 @@ public:
 
 	/// Implementation of EncoderListener::onChunkEncoded
 	virtual void onChunkEncoded(const Encoder* encoder, msg::PcmChunk* chunk, double duration);
-	virtual std::shared_ptr<msg::CodecHeader> getHeader();
+	virtual std::shared_ptr<msg::CodecHeader> getHeader(size_t rendition = 0) const;
+
+	size_t getRenditionCount() const;
+	/// Index of the rendition with the codec name (e.g. "flac"), -1 if there is none
+	int getRendition(const std::string& codec) const;
+	std::string getCodec(size_t rendition) const;
+	/// Reference count of sessions that use the rendition
+	void addUser(size_t rendition);
+	void removeUser(size_t rendition);
+	size_t getUsers(size_t rendition) const;
 
 	virtual const StreamUri& getUri() const;
 	virtual const std::string& getName() const;
@@ -88,6 +111,8 @@ public:
 
 	virtual ReaderState getState() const;
 	virtual json toJson() const;
+	/// Latency histograms of the read and encode stages, source stalls and queue overruns
+	json getMetrics() const;
 
 
 protected:
@@ -96,17 +121,80 @@ protected:
 	std::thread thread_;
 	std::atomic<bool> active_;
 
+	/// Reads from the source, runs in thread_
 	virtual void worker() = 0;
 	virtual bool sleep(int32_t ms);
 	void setState(const ReaderState& newState);
+	/// Passes the chunk to the encode thread. Takes the chunk and returns a recycled one to read into
+	void enqueue(std::unique_ptr<msg::PcmChunk>& chunk);
+	/// The timestamps of the encoded chunks restart with the next enqueued chunk, e.g. after a resync
+	void restartEncodedTimestamps();
+	/// The source stalled for ms, the reader's timestamps are reset. Notifies the PcmListener
+	void resync(double ms);
+
+	/// Encodes the enqueued chunks, runs in encodeThread_
+	void encodeWorker();
+	/// Passes the chunk to the encoders of the renditions that are in use
+	void encode(const msg::PcmChunk* chunk);
+	/// Drops the PCM that is buffered in the rendition's encoder. Notifies the PcmListener, if the codec header changed
+	void resetEncoder(size_t rendition);
+
+	/// An encoder and the state of its encoded stream
+	struct Rendition
+	{
+		Rendition(Encoder* encoder) : encoder(encoder), chunkSequence(0), users(0), encoding(false), encoded(false)
+		{
+		}
+
+		std::unique_ptr<Encoder> encoder;
+		timeval tvEncodedChunk;
+		/// Sequence number of the last encoded chunk
+		uint64_t chunkSequence;
+		std::atomic<size_t> users;
+		/// The encoder got the previous chunk and the timestamps continue. Only accessed by the encode thread
+		bool encoding;
+		/// The encoder got PCM since it was created resp. reset. Only accessed by the encode thread
+		bool encoded;
+	};
+
+	/// A chunk that was read and waits to be encoded
+	struct ReadChunk
+	{
+		msg::PcmChunk* chunk;
+		/// restart the encoded timestamps with this chunk
+		bool restart;
+		std::chrono::steady_clock::time_point enqueued;
+	};
+
+	/// Reader => encoder
+	SpscQueue<ReadChunk> readChunks_;
+	/// Encoder => reader, encoded chunks are recycled
+	SpscQueue<msg::PcmChunk*> freeChunks_;
+	/// Only to wake up the encode thread, the queues are lock-free
+	std::mutex encodeMutex_;
+	std::condition_variable encodeCv_;
+	std::thread encodeThread_;
+	/// Only accessed by the reader thread
+	bool restartTimestamps_;
+	std::chrono::steady_clock::time_point readStart_;
+
+	/// Read: from the reader's wakeup until the chunk is read, queue: wait for the encoder, encode: encoding and fan-out
+	LatencyHistogram readLatency_;
+	LatencyHistogram queueLatency_;
+	LatencyHistogram encodeLatency_;
+	/// Number of resyncs, i.e. the source didn't deliver in time
+	std::atomic<uint64_t> stalls_;
+	/// Chunks dropped, because the encoder didn't keep up
+	std::atomic<uint64_t> overruns_;
 
-	timeval tvEncodedChunk_;
 	PcmListener* pcmListener_;
 	StreamUri uri_;
 	SampleFormat sampleFormat_;
 	size_t pcmReadMs_;
 	size_t dryoutMs_;
-	std::unique_ptr<Encoder> encoder_;
+	std::vector<std::unique_ptr<Rendition>> renditions_;
+	/// Guards the codec headers, which are replaced by the encode thread when an encoder is reset
+	mutable std::mutex headerMutex_;
 	std::string name_;
 	ReaderState state_;
         std::shared_ptr<msg::StreamTags> meta_;
@@ -70,7 +70,7 @@ void PipeStream::worker()
 			close(fd_);
 		fd_ = open(uri_.path.c_str(), O_RDONLY | O_NONBLOCK);
 		chronos::systemtimeofday(&tvChunk);
-		tvEncodedChunk_ = tvChunk;
+		restartEncodedTimestamps();
 		long nextTick = chronos::getTickCount();
 		int idleBytes = 0;
 		int maxIdleBytes = sampleFormat_.rate*sampleFormat_.frameSize*dryoutMs_/1000;
@@ -114,7 +114,7 @@ void PipeStream::worker()
 				if (!active_) break;
 
 				/// TODO: use less raw pointers, make this encoding more transparent
-				encoder_->encode(chunk.get());
+				enqueue(chunk);
 
 				if (!active_) break;
 
@@ -131,8 +131,8 @@ void PipeStream::worker()
 				else
 				{
 					chronos::systemtimeofday(&tvChunk);
-					tvEncodedChunk_ = tvChunk;
-					pcmListener_->onResync(this, currentTick - nextTick);
+					restartEncodedTimestamps();
+					resync(currentTick - nextTick);
 					nextTick = currentTick;
 				}
 
@@ -156,7 +156,7 @@ void ProcessStream::worker()
 		stderrReaderThread_.detach();
 
 		chronos::systemtimeofday(&tvChunk);
-		tvEncodedChunk_ = tvChunk;
+		restartEncodedTimestamps();
 		long nextTick = chronos::getTickCount();
 		int idleBytes = 0;
 		int maxIdleBytes = sampleFormat_.rate*sampleFormat_.frameSize*dryoutMs_/1000;
@@ -196,7 +196,7 @@ void ProcessStream::worker()
 
 				if (!active_) break;
 
-				encoder_->encode(chunk.get());
+				enqueue(chunk);
 
 				if (!active_) break;
 
@@ -213,8 +213,8 @@ void ProcessStream::worker()
 				else
 				{
 					chronos::systemtimeofday(&tvChunk);
-					tvEncodedChunk_ = tvChunk;
-					pcmListener_->onResync(this, currentTick - nextTick);
+					restartEncodedTimestamps();
+					resync(currentTick - nextTick);
 					nextTick = currentTick;
 				}
 
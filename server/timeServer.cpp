@@ -0,0 +1,179 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include "timeServer.h"
+#include "common/timeSync.h"
+#include "aixlog.hpp"
+#include <cerrno>
+
+using namespace std;
+using asio::ip::udp;
+
+
+TimeServer::TimeServer(asio::io_service* io_service, size_t port, size_t delayMs) :
+	io_service_(io_service),
+	socket_v4_(nullptr),
+	socket_v6_(nullptr),
+	port_(port),
+	delayMs_(delayMs),
+	random_(std::random_device()())
+{
+}
+
+
+TimeServer::~TimeServer()
+{
+//	stop();
+}
+
+
+void TimeServer::start()
+{
+	bool is_v6_only(true);
+	try
+	{
+		socket_v6_ = make_shared<udp::socket>(*io_service_, udp::v6());
+		error_code ec;
+		socket_v6_->set_option(asio::ip::v6_only(false), ec);
+		asio::ip::v6_only option;
+		socket_v6_->get_option(option);
+		is_v6_only = option.value();
+		socket_v6_->bind(udp::endpoint(udp::v6(), port_));
+	}
+	catch (const asio::system_error& e)
+	{
+		LOG(ERROR) << "error creating UDP time sync socket: " << e.what() << ", code: " << e.code() << "\n";
+		socket_v6_ = nullptr;
+	}
+
+	if (!socket_v6_ || is_v6_only)
+	{
+		try
+		{
+			socket_v4_ = make_shared<udp::socket>(*io_service_, udp::endpoint(udp::v4(), port_));
+		}
+		catch (const asio::system_error& e)
+		{
+			LOG(ERROR) << "error creating UDP time sync socket: " << e.what() << ", code: " << e.code() << "\n";
+		}
+	}
+
+	for (auto socket: {socket_v4_, socket_v6_})
+	{
+		if (!socket)
+			continue;
+		if (!time_sync::enableTimestamps(socket->native_handle()))
+			LOG(WARNING) << "Kernel receive timestamps not supported, using the less accurate user space timestamps\n";
+		startReceive(socket);
+	}
+	LOG(INFO) << "UDP time sync on port " << port_ << (delayMs_ > 0 ? ", random reply delay up to [ms]: " + to_string(delayMs_) : "") << "\n";
+}
+
+
+void TimeServer::stop()
+{
+	for (auto socket: {socket_v4_, socket_v6_})
+	{
+		if (!socket)
+			continue;
+		error_code ec;
+		socket->cancel(ec);
+		socket->close(ec);
+	}
+	socket_v4_ = nullptr;
+	socket_v6_ = nullptr;
+}
+
+
+void TimeServer::startReceive(udp_socket_ptr socket)
+{
+	socket->async_wait(udp::socket::wait_read, [this, socket](const std::error_code& ec)
+	{
+		if (ec)
+		{
+			if (ec != asio::error::operation_aborted)
+				LOG(ERROR) << "Error while waiting for time sync requests: " << ec.message() << "\n";
+			return;
+		}
+
+		/// read all pending requests, before waiting again
+		while (handleRequest(socket))
+			;
+		startReceive(socket);
+	});
+}
+
+
+bool TimeServer::handleRequest(udp_socket_ptr socket)
+{
+	char buffer[time_sync::Packet::kSize + 1];
+	udp::endpoint sender;
+	socklen_t senderLen = sender.capacity();
+	int64_t received;
+	ssize_t bytes = time_sync::receive(socket->native_handle(), buffer, sizeof(buffer), received, sender.data(), &senderLen);
+	if (bytes < 0)
+	{
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			LOG(ERROR) << "Error receiving time sync request: " << strerror(errno) << "\n";
+		return (errno == EINTR);
+	}
+	sender.resize(senderLen);
+
+	time_sync::Packet packet;
+	if (!packet.deserialize(buffer, bytes) || (packet.type != time_sync::kRequest))
+	{
+		LOG(DEBUG) << "Invalid time sync request from " << sender.address().to_string() << "\n";
+		return true;
+	}
+
+	packet.type = time_sync::kResponse;
+	packet.serverReceived = received;
+	packet.serverSent = time_sync::now();
+
+	auto send = [socket, sender](const time_sync::Packet& packet)
+	{
+		char buffer[time_sync::Packet::kSize];
+		packet.serialize(buffer);
+		error_code ec;
+		socket->send_to(asio::buffer(buffer, sizeof(buffer)), sender, 0, ec);
+		if (ec)
+			LOG(DEBUG) << "Error sending time sync reply to " << sender.address().to_string() << ": " << ec.message() << "\n";
+	};
+
+	if (delayMs_ == 0)
+	{
+		send(packet);
+		return true;
+	}
+
+	/// the delay is not included in serverSent, so that it looks like a delay on the network
+	size_t delayUs;
+	{
+		std::lock_guard<std::mutex> lock(randomMutex_);
+		delayUs = std::uniform_int_distribution<size_t>(0, delayMs_ * 1000)(random_);
+	}
+	auto timer = make_shared<asio::steady_timer>(*io_service_, chrono::microseconds(delayUs));
+	timer->async_wait([timer, send, packet](const std::error_code& ec)
+	{
+		if (!ec)
+			send(packet);
+	});
+	return true;
+}
+
@@ -0,0 +1,66 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2018  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#ifndef TIME_SERVER_H
+#define TIME_SERVER_H
+
+#include <asio.hpp>
+#include <memory>
+#include <random>
+#include <mutex>
+
+
+/// Replies to the UDP time sync requests of the clients
+/**
+ * Optional NTP like time sync port (see time_sync::Packet). Requests are
+ * received with their kernel receive timestamp, the replies carry the
+ * receive and the send time.
+ * For testing, the replies can be held back for a random time up to
+ * "delayMs", to simulate an asymmetric network delay.
+ */
+class TimeServer
+{
+public:
+	TimeServer(asio::io_service* io_service, size_t port, size_t delayMs = 0);
+	virtual ~TimeServer();
+
+	void start();
+	/// Must be called after the io_service has been stopped
+	void stop();
+
+private:
+	typedef std::shared_ptr<asio::ip::udp::socket> udp_socket_ptr;
+	void startReceive(udp_socket_ptr socket);
+	/// Replies to a pending request, false if there is none
+	bool handleRequest(udp_socket_ptr socket);
+
+	asio::io_service* io_service_;
+	udp_socket_ptr socket_v4_;
+	udp_socket_ptr socket_v6_;
+	size_t port_;
+	size_t delayMs_;
+	std::mutex randomMutex_;
+	std::default_random_engine random_;
+};
+
+
+
+#endif
+
+